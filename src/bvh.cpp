@@ -1,55 +1,123 @@
 #include "bvh.hpp"
 #include "defs.hpp"
 #include "options_manager.hpp"
+#include <algorithm>
+#include <bitset>
 #include <chrono>
+#include <cstring>
+#include <deque>
 #include "GLFW/glfw3.h"
 #include <iostream>
 #include <list>
 #include <stack>
 
-BVH::BVH(std::vector<HittablePtr> h, Heuristic heur, bool _refit, bool makeTopLevel) : hittables(h), heuristic(heur), animate(false), mustRefit(_refit) {
+static AABB transformAABB(const AABB& box, const glm::mat4& m) {
+	glm::fvec4 vertices[8] = {
+		{ box.minX, box.minY, box.minZ, 1.0f },
+		{ box.minX, box.minY, box.maxZ, 1.0f },
+		{ box.minX, box.maxY, box.minZ, 1.0f },
+		{ box.minX, box.maxY, box.maxZ, 1.0f },
+		{ box.maxX, box.minY, box.minZ, 1.0f },
+		{ box.maxX, box.minY, box.maxZ, 1.0f },
+		{ box.maxX, box.maxY, box.minZ, 1.0f },
+		{ box.maxX, box.maxY, box.maxZ, 1.0f }
+	};
+
+	AABB ret = { INF, INF, INF, -INF, -INF, -INF };
+	for (auto vertex : vertices) {
+		auto tranformedVertex = m * vertex;
+		ret.minX = min(tranformedVertex.x, ret.minX);
+		ret.minY = min(tranformedVertex.y, ret.minY);
+		ret.minZ = min(tranformedVertex.z, ret.minZ);
+		ret.maxX = max(tranformedVertex.x, ret.maxX);
+		ret.maxY = max(tranformedVertex.y, ret.maxY);
+		ret.maxZ = max(tranformedVertex.z, ret.maxZ);
+	}
+	return ret;
+}
+
+BVH::BVH(std::vector<HittablePtr> h, Heuristic heur, bool _refit, SAHCost cost) : hittables(h), heuristic(heur), sahCost(cost), animate(false), mustRefit(_refit) {
 	this->refitCounter = 0;
 	auto t1 = std::chrono::high_resolution_clock::now();
-	this->nodePool = nullptr;
-	if (makeTopLevel) {
-		constructTopLevelBVH();
-	} else {
-		constructSubBVH();
-	}
+	constructSubBVH();
 	auto t2 = std::chrono::high_resolution_clock::now();
 	auto ms_int = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
 	std::cout << "BVH Construction for " << h.size() << " hittables: " << ms_int.count() << "us" << std::endl;
 }
 
+BVH::BVH(std::shared_ptr<TriangleMesh> m, Heuristic heur, bool _refit, SAHCost cost) : mesh(m), heuristic(heur), sahCost(cost), animate(false), mustRefit(_refit) {
+	this->refitCounter = 0;
+	auto t1 = std::chrono::high_resolution_clock::now();
+	constructSubBVH();
+	auto t2 = std::chrono::high_resolution_clock::now();
+	auto ms_int = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+	std::cout << "BVH Construction for " << m->nTriangles << " triangles: " << ms_int.count() << "us" << std::endl;
+}
+
+BVH::BVH(std::shared_ptr<CurveMesh> c, Heuristic heur, bool _refit, SAHCost cost) : curveMesh(c), heuristic(heur), sahCost(cost), animate(false), mustRefit(_refit) {
+	this->refitCounter = 0;
+	auto t1 = std::chrono::high_resolution_clock::now();
+	constructSubBVH();
+	auto t2 = std::chrono::high_resolution_clock::now();
+	auto ms_int = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+	std::cout << "BVH Construction for " << c->segmentCount() << " curve segments: " << ms_int.count() << "us" << std::endl;
+}
+
+BVH::BVH(std::vector<std::shared_ptr<BVH>> instanced, std::vector<BVHInstance> instances, std::vector<Animation> animations) :
+	heuristic(Heuristic::SAH), animate(false), mustRefit(false), isTopLevel(true),
+	instanced(instanced), instances(instances), animations(animations) {
+	this->refitCounter = 0;
+	auto t1 = std::chrono::high_resolution_clock::now();
+	for (auto& instance : this->instances) {
+		updateInstanceBBox(instance);
+	}
+	constructTopLevelBVH();
+	auto t2 = std::chrono::high_resolution_clock::now();
+	auto ms_int = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+	std::cout << "Top Level BVH Construction for " << this->instances.size() << " instances: " << ms_int.count() << "us" << std::endl;
+}
+
+BVH::BVH(std::shared_ptr<TriangleMesh> m, std::shared_ptr<CurveMesh> c, MappedArray<BVHNode> nodes, size_t nNodes, MappedArray<int> primitives,
+		MappedArray<TriangleBlock> blocks, size_t nBlocks, MappedArray<int> leafBlocks) :
+	mesh(m), curveMesh(c), heuristic(Heuristic::SAH), animate(false), mustRefit(false) {
+	this->refitCounter = 0;
+	this->nodePool = std::move(nodes);
+	this->poolPtr = nNodes;
+	this->hittableIdxs = std::move(primitives);
+	this->root = &this->nodePool[0];
+	updateRootAABB();
+	if (blocks) {
+		this->triangleBlocks = std::move(blocks);
+		this->nTriangleBlocks = nBlocks;
+		this->leafBlocks = std::move(leafBlocks);
+	} else {
+		packBlocks();
+	}
+}
+
 BVH::~BVH(){
-	delete[] this->nodePool;
 }
 
 void BVH::constructTopLevelBVH() {
-	delete[] this->nodePool;
-	this->nodePool = new BVHNode[hittables.size() * 2];
-	this->hittableIdxs.clear();
-	for (int i = 0; i < hittables.size(); ++i) {
-		this->hittableIdxs.push_back(i);
+	this->nodePool.allocate(instances.size() * 2);
+	this->hittableIdxs.allocate(instances.size());
+	for (int i = 0; i < instances.size(); ++i) {
+		this->hittableIdxs[i] = i;
 	}
 
 	auto nodeList = std::list<BVHNode*>();
-	for (int i = 0; i < hittables.size(); ++i) {
+	std::vector<BVHNode*> allocatedNodes;
+	for (int i = 0; i < instances.size(); ++i) {
 		auto* node = new BVHNode;
-		auto hittable = hittables[i];
-		auto aabb = hittable->getWorldAABB();
+		allocatedNodes.push_back(node);
+		auto aabb = instances[i].worldBBox;
 		node->minAABBLeftFirst = { aabb.minX, aabb.minY, aabb.minZ, i };
 		node->maxAABBCount = { aabb.maxX, aabb.maxY, aabb.maxZ, 1 };
 		nodeList.push_back(node);
 	}
 
-	int index = 2 * hittables.size() - 1;
-
-	this->root = &this->nodePool[0];
-	this->root->minAABBLeftFirst.w = 0;
-	this->root->maxAABBCount.w = this->hittableIdxs.size();
+	int index = 2 * instances.size() - 1;
 	this->poolPtr = 2;
-	computeBounding(root);
 
 	auto nodeA = nodeList.front();
 	if (nodeList.size() > 1) {
@@ -92,27 +160,35 @@ void BVH::constructTopLevelBVH() {
 		}
 	}
 
-	this->root = nodeA;
+	// The two first slots of the pool are never used by the agglomerative build: move the root there
+	// so that every node can be addressed by its offset in the pool.
+	this->nodePool[0] = *nodeA;
+	this->root = &this->nodePool[0];
 	nodeList.clear();
+	for (auto* node : allocatedNodes) {
+		delete node;
+	}
 
-	setLocalAABB({
-		this->root->minAABBLeftFirst.x,
-		this->root->minAABBLeftFirst.y,
-		this->root->minAABBLeftFirst.z,
-		this->root->maxAABBCount.x,
-		this->root->maxAABBCount.y,
-		this->root->maxAABBCount.z
-		});
-	this->surfaceArea = calculateSurfaceArea(worldBBox);
+	this->nodeMasks.assign(instances.size() * 2, 0);
+	computeNodeMask(this->root);
+
+	this->nodeParents.assign(instances.size() * 2, -1);
+	this->instanceNodes.assign(instances.size(), 0);
+	this->treeArea = 0.0f;
+	linkTopLevelNodes(0, -1);
+
+	updateRootAABB();
+	this->builtCost = treeCost();
 }
 
 void BVH::collapseBVH() {
 
-	if (hittables.size() < 4) {
+	if (primitiveCount() < 4) {
 		return;
 	}
 
-	auto newNodePool = new BVHNode[hittables.size() * 2];
+	MappedArray<BVHNode> newNodePool;
+	newNodePool.allocate(primitiveCount() * 2);
 	auto newNodePoolPtr = 4;
 
 	auto newRoot = &newNodePool[0];
@@ -126,7 +202,7 @@ void BVH::collapseBVH() {
 
 	int emptyCount = 0;
 	// while currnode aabb is not negative bounding box;
-	while (currPointer < hittables.size() * 2 - 1) {
+	while (currPointer < primitiveCount() * 2 - 1) {
 		if (currNode->maxAABBCount.w != 0) {
 			currNode = &newNodePool[currPointer++];
 			continue;
@@ -204,38 +280,37 @@ void BVH::collapseBVH() {
 		currNode = &newNodePool[currPointer++];
 	}
 
-	delete[] this->nodePool;
-	this->nodePool = &newNodePool[0];
-	this->root = &newNodePool[0];
+	this->nodePool = std::move(newNodePool);
+	this->root = &this->nodePool[0];
+	this->nodeMasks.clear();
 	this->root->minAABBLeftFirst.w = 4;
 
 	isCollapsed = true;
 }
 
 void BVH::constructSubBVH() {
-	if(this->nodePool != nullptr)
-		delete[] this->nodePool;
-	this->nodePool = new BVHNode[hittables.size() * 2];
-	this->hittableIdxs.clear();
-	for (int i = 0; i < hittables.size(); ++i) {
-		this->hittableIdxs.push_back(i);
+	// The bounds of a curve segment are derived from its curve, and the build asks for them many times
+	if (curveMesh) {
+		curveBounds.resize(primitiveCount());
+		for (size_t i = 0; i < primitiveCount(); ++i) {
+			curveBounds[i] = curveMesh->getBounds(i);
+		}
+	}
+	this->nodePool.allocate(primitiveCount() * 2);
+	this->hittableIdxs.allocate(primitiveCount());
+	for (int i = 0; i < primitiveCount(); ++i) {
+		this->hittableIdxs[i] = i;
 	}
 
 	this->root = &this->nodePool[0];
 	this->root->minAABBLeftFirst.w = 0;
-	this->root->maxAABBCount.w = this->hittableIdxs.size();
+	this->root->maxAABBCount.w = primitiveCount();
 	this->poolPtr = 2;
 	computeBounding(root);
 	subdivideBin(root);
-	setLocalAABB({
-		this->root->minAABBLeftFirst.x,
-		this->root->minAABBLeftFirst.y,
-		this->root->minAABBLeftFirst.z,
-		this->root->maxAABBCount.x,
-		this->root->maxAABBCount.y,
-		this->root->maxAABBCount.z
-	});
-	this->surfaceArea = calculateSurfaceArea(worldBBox);
+	updateRootAABB();
+	packBlocks();
+	std::vector<AABB>().swap(curveBounds);
 }
 
 bool BVH::computeBounding(BVHNode *node) {
@@ -256,8 +331,7 @@ bool BVH::computeBounding(BVHNode *node) {
 			futures.push_back(Threading::pool.queue([&, threadNodeStart, threadNodeEnd, i](uint32_t &rng){
 				AABB aabb{INF, INF, INF, -INF, -INF, -INF};
 				for(size_t j = threadNodeStart; j < threadNodeEnd; ++j){
-					auto hit = hittables[hittableIdxs[j]];
-					AABB hitAABB = hit->getWorldAABB();
+					AABB hitAABB = getPrimitiveAABB(hittableIdxs[j]);
 					aabb.minX = min(aabb.minX, hitAABB.minX);
 					aabb.minY = min(aabb.minY, hitAABB.minY);
 					aabb.minZ = min(aabb.minZ, hitAABB.minZ);
@@ -269,8 +343,8 @@ bool BVH::computeBounding(BVHNode *node) {
 			}));
 		}
 
-		for(size_t i = 0; i < futures.size(); ++i){
-			futures[i].get();
+		Threading::pool.wait(futures);
+		for(size_t i = 0; i < nChunks; ++i){
 			AABB aabb = bboxes[i];
 			node->minAABBLeftFirst.x = min(aabb.minX, node->minAABBLeftFirst.x);
 			node->minAABBLeftFirst.y = min(aabb.minY, node->minAABBLeftFirst.y);
@@ -281,8 +355,7 @@ bool BVH::computeBounding(BVHNode *node) {
 		}
 	} else {
 		for(size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i){
-			auto hit = hittables[hittableIdxs[i]];
-			AABB aabb = hit->getWorldAABB();
+			AABB aabb = getPrimitiveAABB(hittableIdxs[i]);
 			node->minAABBLeftFirst.x = min(aabb.minX, node->minAABBLeftFirst.x);
 			node->minAABBLeftFirst.y = min(aabb.minY, node->minAABBLeftFirst.y);
 			node->minAABBLeftFirst.z = min(aabb.minZ, node->minAABBLeftFirst.z);
@@ -296,19 +369,23 @@ bool BVH::computeBounding(BVHNode *node) {
 
 void BVH::subdivideBin(BVHNode* node) {
 	if (node == nullptr) return;
-	if (node->maxAABBCount.w < 3) {
+	if (node->maxAABBCount.w < 2) {
 		computeBounding(node);
 		return; 
 	}
+	bool split = false;
 	if(this->heuristic == Heuristic::SAH){
 		if (node->maxAABBCount.w > 20000)
-			partitionBinMulti(node);
+			split = partitionBinMulti(node);
 		else
-			partitionBinSingle(node);
+			split = partitionBinSingle(node);
 	} else if (this->heuristic == Heuristic::MIDPOINT){ 
-		midpointSplit(node);
+		split = midpointSplit(node);
 	}
 
+	// The node is cheaper to intersect as a leaf
+	if (!split) return;
+
 	// Then subdivide again 
 	subdivideBin(&this->nodePool[(int)node->minAABBLeftFirst.w]);
 	subdivideBin(&this->nodePool[(int)node->minAABBLeftFirst.w + 1]);
@@ -316,12 +393,31 @@ void BVH::subdivideBin(BVHNode* node) {
 	return;
 }
 
-void BVH::midpointSplit(BVHNode* node){
+bool BVH::shouldSplit(const BVHNode* node, float splitCost) {
+	// Leaves that are too big are always split, no matter what the cost model says
+	if (node->maxAABBCount.w > sahCost.maxLeafSize) return true;
+
+	float area = calculateSurfaceArea({
+		node->minAABBLeftFirst.x,
+		node->minAABBLeftFirst.y,
+		node->minAABBLeftFirst.z,
+		node->maxAABBCount.x,
+		node->maxAABBCount.y,
+		node->maxAABBCount.z
+	});
+	if (area <= 0.0f) return false;
+
+	// splitCost is the sum of area * count of the two children; normalize it by the parent area
+	float leafCost = sahCost.intersection * node->maxAABBCount.w;
+	float interiorCost = sahCost.traversal + sahCost.intersection * splitCost / area;
+	return interiorCost < leafCost;
+}
+
+bool BVH::midpointSplit(BVHNode* node){
 	// Compute the centroid bounds (the bounds defined by the centroids of all triangles within the node)
 	AABB globalCentroidAABB = AABB{ INF,INF,INF,-INF,-INF,-INF };
 	for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-		auto prim = hittables[hittableIdxs[i]];
-		AABB aabb = prim->getWorldAABB();
+		AABB aabb = getPrimitiveAABB(hittableIdxs[i]);
 		float cx = (aabb.minX + aabb.maxX) / 2.0f;
 		float cy = (aabb.minY + aabb.maxY) / 2.0f;
 		float cz = (aabb.minZ + aabb.maxZ) / 2.0f;
@@ -357,7 +453,7 @@ void BVH::midpointSplit(BVHNode* node){
 	}
 
 	if (longestAxisIdx == -1) {
-		return;
+		return false;
 	}
 	glm::fvec3 minBBox = glm::fvec3(globalCentroidAABB.minX, globalCentroidAABB.minY, globalCentroidAABB.minZ);
 	glm::fvec3 maxBBox = glm::fvec3(globalCentroidAABB.maxX, globalCentroidAABB.maxY, globalCentroidAABB.maxZ);
@@ -365,7 +461,7 @@ void BVH::midpointSplit(BVHNode* node){
 	auto split = (maxBBox[longestAxisIdx] + minBBox[longestAxisIdx]) / 2.0f;
 	
 	auto right = std::partition(&hittableIdxs[node->minAABBLeftFirst.w], &hittableIdxs[node->minAABBLeftFirst.w + node->maxAABBCount.w - 1] + 1, [&](int idx){
-			auto aabb = hittables[idx]->getWorldAABB();
+			auto aabb = getPrimitiveAABB(idx);
 			glm::fvec3 centroid = glm::fvec3((aabb.minX + aabb.maxX) / 2.0f, (aabb.minY + aabb.maxY) / 2.0f, (aabb.minZ + aabb.maxZ) / 2.0f);
 			return centroid[longestAxisIdx] < split;
 		}
@@ -373,10 +469,8 @@ void BVH::midpointSplit(BVHNode* node){
 
 	auto first = node->minAABBLeftFirst.w;
 	auto numElems = node->maxAABBCount.w;
-	node->maxAABBCount.w = 0;
-	node->minAABBLeftFirst.w = poolPtr;
-	auto leftNode = &this->nodePool[poolPtr++];
-	auto rightNode = &this->nodePool[poolPtr++];
+	auto leftNode = &this->nodePool[poolPtr];
+	auto rightNode = &this->nodePool[poolPtr + 1];
 
 	// Asign leftFirst and count to our left and right nodes
 	leftNode->minAABBLeftFirst.w = first;
@@ -386,16 +480,34 @@ void BVH::midpointSplit(BVHNode* node){
 	rightNode->minAABBLeftFirst.w = first + leftNode->maxAABBCount.w;
 	rightNode->maxAABBCount.w = (&hittableIdxs[first + numElems - 1] + 1) - right;
 	computeBounding(rightNode);
+
+	if (leftNode->maxAABBCount.w == 0 || rightNode->maxAABBCount.w == 0) {
+		return false;
+	}
+
+	// The midpoint does not look at the cost while picking the plane, but we can still refuse splits that don't pay off
+	auto splitCost = calculateSurfaceArea({ leftNode->minAABBLeftFirst.x, leftNode->minAABBLeftFirst.y, leftNode->minAABBLeftFirst.z,
+			leftNode->maxAABBCount.x, leftNode->maxAABBCount.y, leftNode->maxAABBCount.z }) * leftNode->maxAABBCount.w +
+		calculateSurfaceArea({ rightNode->minAABBLeftFirst.x, rightNode->minAABBLeftFirst.y, rightNode->minAABBLeftFirst.z,
+			rightNode->maxAABBCount.x, rightNode->maxAABBCount.y, rightNode->maxAABBCount.z }) * rightNode->maxAABBCount.w;
+	if (!shouldSplit(node, splitCost)) {
+		return false;
+	}
+
+	node->maxAABBCount.w = 0;
+	node->minAABBLeftFirst.w = poolPtr;
+	poolPtr += 2;
+	return true;
 }
 
 void BVH::subdivideHQ(BVHNode* node) {
 	if (node == nullptr) return;
-	if (node->maxAABBCount.w < 3) {
+	if (node->maxAABBCount.w < 2) {
 		computeBounding(node);
-		return; // Jacco said this was wrong (or not efficient). Why?
+		return;
 	}
 
-	partitionHQ(node);
+	if (!partitionHQ(node)) return;
 	// Then subdivide again 
 	subdivideHQ(&this->nodePool[(int)node->minAABBLeftFirst.w]);
 	subdivideHQ(&this->nodePool[(int)node->minAABBLeftFirst.w + 1]);
@@ -403,7 +515,7 @@ void BVH::subdivideHQ(BVHNode* node) {
 	return;
 }
 
-void BVH::partitionBinMulti(BVHNode* node) {
+bool BVH::partitionBinMulti(BVHNode* node) {
 
 	// For a partition of a node
 	// Divide the node into k bins vertically along its longest AABB axis.
@@ -423,8 +535,7 @@ void BVH::partitionBinMulti(BVHNode* node) {
 			// Compute the centroid bounds (the bounds defined by the centroids of all triangles within the node)
 			AABB centroidBBox = AABB{ INF,INF,INF,-INF,-INF,-INF };
 			for (size_t i = threadNodeStart; i < threadNodeEnd; ++i) {
-				auto prim = hittables[hittableIdxs[i]];
-				AABB aabb = prim->getWorldAABB();
+				AABB aabb = getPrimitiveAABB(hittableIdxs[i]);
 				float cx = (aabb.minX + aabb.maxX) / 2.0f;
 				float cy = (aabb.minY + aabb.maxY) / 2.0f;
 				float cz = (aabb.minZ + aabb.maxZ) / 2.0f;
@@ -440,10 +551,7 @@ void BVH::partitionBinMulti(BVHNode* node) {
 		}));
 	}
 
-	for (auto& f : futures) {
-		f.get();
-	}
-	futures.clear();
+	Threading::pool.wait(futures);
 
 	AABB globalCentroidAABB = AABB{ INF,INF,INF,-INF,-INF,-INF };
 	for (const auto& aabb : chunkBoundingBoxes) {
@@ -478,7 +586,7 @@ void BVH::partitionBinMulti(BVHNode* node) {
 	}
 
 	if (longestAxisIdx == -1) {
-		return;
+		return false;
 	}
 
 	glm::fvec3 minBBox = glm::fvec3(globalCentroidAABB.minX, globalCentroidAABB.minY, globalCentroidAABB.minZ);
@@ -495,8 +603,7 @@ void BVH::partitionBinMulti(BVHNode* node) {
 			std::vector<Bin> bins(numOfBins);
 
 			for (size_t i = threadNodeStart; i < threadNodeEnd; ++i) {
-				auto prim = hittables[hittableIdxs[i]];
-				auto primAABB = prim->getWorldAABB();
+				auto primAABB = getPrimitiveAABB(hittableIdxs[i]);
 				int binID = calculateBinID(primAABB, k1, k0, longestAxisIdx);
 
 				// For each bin we keep track of the number of triangles as well as the bins bounds
@@ -532,10 +639,7 @@ void BVH::partitionBinMulti(BVHNode* node) {
 		}));
 	}
 
-	for(auto &f : futures){
-		f.get();
-	}
-	futures.clear();
+	Threading::pool.wait(futures);
 
 	// Find best partition from the one in binnings;
 	// Is this the best way to do it? Obviously not, I'm doing a mess here.
@@ -594,6 +698,7 @@ void BVH::partitionBinMulti(BVHNode* node) {
 
 		auto leftCount = leftNumArea[split - 1].first;
 		auto leftArea = leftNumArea[split - 1].second;
+		if (leftCount == 0 || rightElemCount == 0) continue;
 		auto splitCost = leftArea * leftCount + calculateSurfaceArea(rightBBox) * rightElemCount;
 
 		if (splitCost < lowestCost) {
@@ -607,6 +712,10 @@ void BVH::partitionBinMulti(BVHNode* node) {
 	}
 
 
+	if (optimalSplitIdx == -1 || !shouldSplit(node, lowestCost)) {
+		return false;
+	}
+
 	std::vector<int> threadCumulativeLeftCount(binnings.size() + 1);
 	threadCumulativeLeftCount[0] = 0;
 	std::vector<int> threadCumulativeRightCount(binnings.size() + 1);
@@ -621,13 +730,11 @@ void BVH::partitionBinMulti(BVHNode* node) {
 	//Quicksort our hittableIdx 
 	int maxj = node->minAABBLeftFirst.w + node->maxAABBCount.w - 1;
 	for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-		auto leftPrim = hittables[hittableIdxs[i]];
-		int leftBinID = calculateBinID(leftPrim->getWorldAABB(), k1, k0, longestAxisIdx);
+		int leftBinID = calculateBinID(getPrimitiveAABB(hittableIdxs[i]), k1, k0, longestAxisIdx);
 
 		if (leftBinID >= optimalSplitIdx) {
 			for (size_t j = maxj; j > i; --j) {
-				auto rightPrim = hittables[hittableIdxs[j]];
-				int rightBinID = calculateBinID(rightPrim->getWorldAABB(), k1, k0, longestAxisIdx);
+				int rightBinID = calculateBinID(getPrimitiveAABB(hittableIdxs[j]), k1, k0, longestAxisIdx);
 
 				if (rightBinID < optimalSplitIdx) {
 					std::swap(hittableIdxs[i], hittableIdxs[j]);
@@ -694,9 +801,10 @@ void BVH::partitionBinMulti(BVHNode* node) {
 	rightNode->maxAABBCount.y = optimalRightBBox.maxY;
 	rightNode->maxAABBCount.z = optimalRightBBox.maxZ;
 	rightNode->maxAABBCount.w = optimalRightCount;
+	return true;
 }
 
-void BVH::partitionBinSingle(BVHNode* node) {
+bool BVH::partitionBinSingle(BVHNode* node) {
 
 	auto t1 = std::chrono::high_resolution_clock::now();
 
@@ -708,8 +816,7 @@ void BVH::partitionBinSingle(BVHNode* node) {
 	// Compute the centroid bounds (the bounds defined by the centroids of all triangles within the node)
 	AABB globalCentroidAABB = AABB{ INF,INF,INF,-INF,-INF,-INF };
 	for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-		auto prim = hittables[hittableIdxs[i]];
-		AABB aabb = prim->getWorldAABB();
+		AABB aabb = getPrimitiveAABB(hittableIdxs[i]);
 		float cx = (aabb.minX + aabb.maxX) / 2.0f;
 		float cy = (aabb.minY + aabb.maxY) / 2.0f;
 		float cz = (aabb.minZ + aabb.maxZ) / 2.0f;
@@ -745,7 +852,7 @@ void BVH::partitionBinSingle(BVHNode* node) {
 	}
 
 	if (longestAxisIdx == -1) {
-		return;
+		return false;
 	}
 
 	glm::fvec3 minBBox = glm::fvec3(globalCentroidAABB.minX, globalCentroidAABB.minY, globalCentroidAABB.minZ);
@@ -757,8 +864,7 @@ void BVH::partitionBinSingle(BVHNode* node) {
 	std::vector<Bin> bins(numOfBins);
 
 	for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-		auto prim = hittables[hittableIdxs[i]];
-		auto primAABB = prim->getWorldAABB();
+		auto primAABB = getPrimitiveAABB(hittableIdxs[i]);
 		int binID = calculateBinID(primAABB, k1, k0, longestAxisIdx);
 
 		// For each bin we keep track of the number of triangles as well as the bins bounds
@@ -813,6 +919,7 @@ void BVH::partitionBinSingle(BVHNode* node) {
 
 		auto leftCount = leftNumArea[split - 1].first;
 		auto leftArea = leftNumArea[split - 1].second;
+		if (leftCount == 0 || rightElemCount == 0) continue;
 		auto splitCost = leftArea * leftCount + calculateSurfaceArea(rightBBox) * rightElemCount;
 
 		if (splitCost < lowestCost) {
@@ -825,16 +932,18 @@ void BVH::partitionBinSingle(BVHNode* node) {
 		}
 	}
 
+	if (optimalSplitIdx == -1 || !shouldSplit(node, lowestCost)) {
+		return false;
+	}
+
 	//Quicksort our hittableIdx 
 	int maxj = node->minAABBLeftFirst.w + node->maxAABBCount.w - 1;
 	for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-		auto leftPrim = hittables[hittableIdxs[i]];
-		int leftBinID = calculateBinID(leftPrim->getWorldAABB(), k1, k0, longestAxisIdx);
+		int leftBinID = calculateBinID(getPrimitiveAABB(hittableIdxs[i]), k1, k0, longestAxisIdx);
 
 		if (leftBinID >= optimalSplitIdx) {
 			for (size_t j = maxj; j > i; --j) {
-				auto rightPrim = hittables[hittableIdxs[j]];
-				int rightBinID = calculateBinID(rightPrim->getWorldAABB(), k1, k0, longestAxisIdx);
+				int rightBinID = calculateBinID(getPrimitiveAABB(hittableIdxs[j]), k1, k0, longestAxisIdx);
 
 				if (rightBinID < optimalSplitIdx) {
 					std::swap(hittableIdxs[i], hittableIdxs[j]);
@@ -873,9 +982,10 @@ void BVH::partitionBinSingle(BVHNode* node) {
 	rightNode->maxAABBCount.y = optimalRightBBox.maxY;
 	rightNode->maxAABBCount.z = optimalRightBBox.maxZ;
 	rightNode->maxAABBCount.w = optimalRightCount;
+	return true;
 }
 
-void BVH::partitionHQ(BVHNode* node) {
+bool BVH::partitionHQ(BVHNode* node) {
 
 	// For a high quality partition of a node
 	// Find all possible partitions using the centroids across all 3 axes. 
@@ -885,17 +995,7 @@ void BVH::partitionHQ(BVHNode* node) {
 	int optimalRightCount = 0;
 	float optimalSplitPos = INF;
 
-	AABB parentNodeAABB = AABB{
-		node->minAABBLeftFirst.x,
-		node->minAABBLeftFirst.y,
-		node->minAABBLeftFirst.z,
-		node->maxAABBCount.x,
-		node->maxAABBCount.y,
-		node->maxAABBCount.z
-	};
-
-	float parentCost = calculateSurfaceArea(parentNodeAABB) * node->maxAABBCount.w;
-	auto lowestCost = parentCost;
+	auto lowestCost = INF;
 
 	AABB optimalLeftBBox = AABB{ INF,INF,INF,-INF,-INF,-INF };
 	AABB optimalRightBBox = AABB{ INF,INF,INF,-INF,-INF,-INF };
@@ -908,8 +1008,7 @@ void BVH::partitionHQ(BVHNode* node) {
 			AABB leftBBox = AABB{ INF,INF,INF,-INF,-INF,-INF };
 			AABB rightBBox = AABB{ INF,INF,INF,-INF,-INF,-INF };
 
-			auto prim = hittables[hittableIdxs[i]];
-			AABB splitAABB = prim->getWorldAABB();
+			AABB splitAABB = getPrimitiveAABB(hittableIdxs[i]);
 			float splitCX = (splitAABB.minX + splitAABB.maxX) / 2.0f;
 			float splitCY = (splitAABB.minY + splitAABB.maxY) / 2.0f;
 			float splitCZ = (splitAABB.minZ + splitAABB.maxZ) / 2.0f;
@@ -917,8 +1016,7 @@ void BVH::partitionHQ(BVHNode* node) {
 			auto splitPos = splitCentroid[axis];
 
 			for (size_t j = node->minAABBLeftFirst.w; j < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++j) {
-				auto prim = hittables[hittableIdxs[j]];
-				AABB aabb = prim->getWorldAABB();
+				AABB aabb = getPrimitiveAABB(hittableIdxs[j]);
 				float cx = (aabb.minX + aabb.maxX) / 2.0f;
 				float cy = (aabb.minY + aabb.maxY) / 2.0f;
 				float cz = (aabb.minZ + aabb.maxZ) / 2.0f;
@@ -945,6 +1043,7 @@ void BVH::partitionHQ(BVHNode* node) {
 				}
 			}
 
+			if (leftCount == 0 || rightCount == 0) continue;
 			auto splitCost = calculateSurfaceArea(leftBBox) * leftCount + calculateSurfaceArea(rightBBox) * rightCount;
 			if (splitCost < lowestCost) {
 				lowestCost = splitCost;
@@ -958,11 +1057,14 @@ void BVH::partitionHQ(BVHNode* node) {
 		}
 	}
 
+	if (optimalSplitIdx == -1 || !shouldSplit(node, lowestCost)) {
+		return false;
+	}
+
 	// Quicksort our hittableIdx 
 	int maxj = node->minAABBLeftFirst.w + node->maxAABBCount.w - 1;
 	for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-		auto leftPrim = hittables[hittableIdxs[i]];
-		AABB leftAABB = leftPrim->getWorldAABB();
+		AABB leftAABB = getPrimitiveAABB(hittableIdxs[i]);
 		float leftCX = (leftAABB.minX + leftAABB.maxX) / 2.0f;
 		float leftCY = (leftAABB.minY + leftAABB.maxY) / 2.0f;
 		float leftCZ = (leftAABB.minZ + leftAABB.maxZ) / 2.0f;
@@ -971,8 +1073,7 @@ void BVH::partitionHQ(BVHNode* node) {
 
 		if (leftPos > optimalSplitPos) {
 			for (size_t j = maxj; j > i; --j) {
-				auto rightPrim = hittables[hittableIdxs[j]];
-				AABB rightAABB = rightPrim->getWorldAABB();
+				AABB rightAABB = getPrimitiveAABB(hittableIdxs[j]);
 				float rightCX = (rightAABB.minX + rightAABB.maxX) / 2.0f;
 				float rightCY = (rightAABB.minY + rightAABB.maxY) / 2.0f;
 				float rightCZ = (rightAABB.minZ + rightAABB.maxZ) / 2.0f;
@@ -1016,9 +1117,10 @@ void BVH::partitionHQ(BVHNode* node) {
 	rightNode->maxAABBCount.y = optimalRightBBox.maxY;
 	rightNode->maxAABBCount.z = optimalRightBBox.maxZ;
 	rightNode->maxAABBCount.w = optimalRightCount;
+	return true;
 }
 
-float BVH::calculateSurfaceArea(AABB bbox) {
+float BVH::calculateSurfaceArea(AABB bbox) const {
 
 	auto length = bbox.maxX - bbox.minX;
 	auto height = bbox.maxY - bbox.minY;
@@ -1033,6 +1135,7 @@ float BVH::calculateBinID(AABB primAABB, float k1, float k0, int longestAxisIdx)
 }
 
 bool BVH::hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+	if (!(visibility & ray.getType())) return false;
 	auto transformInv = transform.getInverse();
 	auto transposeInv = transform.getTransposeInverse();
 	auto transformMat = transform.getMatrix();
@@ -1042,16 +1145,27 @@ bool BVH::hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
 	if (isCollapsed) {
 		if (traverseCollapsed(transformedRay, &this->nodePool[0], tMin, tMax, tmp)) {
 			rec = tmp;
+			computeHitAttributes(transformedRay, rec);
+			rec.p = transformMat * glm::fvec4(rec.p, 1.0f);
+			rec.setFaceNormal(ray, transposeInv * glm::fvec4(rec.normal, 0.0));
+			return true;
+		}
+	} else if (!compressedNodes.empty()) {
+		float dist = 0;
+		if (hitAABB(transformedRay, localBBox, dist) && dist < tMax && traverseCompressed(transformedRay, 0, tMin, tMax, tmp)) {
+			rec = tmp;
+			computeHitAttributes(transformedRay, rec);
 			rec.p = transformMat * glm::fvec4(rec.p, 1.0f);
 			rec.setFaceNormal(ray, transposeInv * glm::fvec4(rec.normal, 0.0));
 			return true;
 		}
 	} else {
 		float dist = 0;
-		bool hitRoot = hitAABB(transformedRay, this->root->minAABBLeftFirst, this->root->maxAABBCount, dist);
+		bool hitRoot = isNodeVisible(this->root, ray.getType()) && hitAABB(transformedRay, this->root->minAABBLeftFirst, this->root->maxAABBCount, dist);
 
 		if (hitRoot && traverse(transformedRay, this->root, tMin, tMax, tmp)) {
 			rec = tmp;
+			computeHitAttributes(transformedRay, rec);
 			rec.p = transformMat * glm::fvec4(rec.p, 1.0f);
 			rec.setFaceNormal(ray, transposeInv * glm::fvec4(rec.normal, 0.0));
 			return true;
@@ -1061,6 +1175,254 @@ bool BVH::hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
 	return false;
 }
 
+bool BVH::hitFrom(const Ray& ray, float tMin, float tMax, HitRecord& rec, const std::vector<BVHNode*>& startNodes) const {
+	if (!(visibility & ray.getType())) return false;
+	const Ray transformedRay = ray.transformRay(transform.getInverse());
+
+	HitRecord tmp;
+	bool hasHit = false;
+	for (auto node : startNodes) {
+		float dist = 0;
+		if (!hitAABB(transformedRay, node->minAABBLeftFirst, node->maxAABBCount, dist) || dist >= tMax) continue;
+		float nodeTMin = tMin;
+		if (traverse(transformedRay, node, nodeTMin, tMax, tmp)) {
+			rec = tmp;
+			hasHit = true;
+		}
+	}
+	if (!hasHit) return false;
+
+	computeHitAttributes(transformedRay, rec);
+	rec.p = transform.getMatrix() * glm::fvec4(rec.p, 1.0f);
+	rec.setFaceNormal(ray, transform.getTransposeInverse() * glm::fvec4(rec.normal, 0.0));
+	return true;
+}
+
+bool BVH::cullFrustum(const Frustum& frustum, uint8_t rayType, std::vector<BVHNode*>& nodes) const {
+	nodes.clear();
+	if (isCollapsed || !compressedNodes.empty()) return false;
+
+	// Planes go to the BVH space with the transpose of the BVH transform
+	Frustum local;
+	auto transposed = glm::transpose(transform.getMatrix());
+	local.origin = transform.getInverse() * glm::fvec4(frustum.origin, 1.0f);
+	for (int i = 0; i < 4; ++i) {
+		local.normals[i] = transposed * glm::fvec4(frustum.normals[i], 0.0f);
+	}
+	if (!isNodeVisible(this->root, rayType) || !overlapsFrustum(local, this->root->minAABBLeftFirst, this->root->maxAABBCount)) {
+		return true;
+	}
+
+	// Breadth first, replacing each node with its children inside the frustum while the list stays short:
+	// chains of nodes with a single child inside are skipped entirely
+	std::deque<BVHNode*> open = { this->root };
+	while (!open.empty()) {
+		BVHNode* node = open.front();
+		open.pop_front();
+		if (node->maxAABBCount.w != 0) {
+			nodes.push_back(node);
+			continue;
+		}
+		BVHNode* inside[2];
+		size_t nInside = 0;
+		for (int c = 0; c < 2; ++c) {
+			BVHNode* child = &this->nodePool[(int)node->minAABBLeftFirst.w + c];
+			if (isNodeVisible(child, rayType) && overlapsFrustum(local, child->minAABBLeftFirst, child->maxAABBCount)) {
+				inside[nInside++] = child;
+			}
+		}
+		if (nodes.size() + open.size() + nInside > maxFrustumNodes) {
+			nodes.push_back(node);
+			continue;
+		}
+		for (size_t c = 0; c < nInside; ++c) {
+			open.push_back(inside[c]);
+		}
+	}
+
+	auto distance = [&local](const BVHNode* node) {
+		float d = 0.0f;
+		for (int a = 0; a < 3; ++a) {
+			float outside = max(node->minAABBLeftFirst[a] - local.origin[a], local.origin[a] - node->maxAABBCount[a]);
+			if (outside > 0.0f) d += outside * outside;
+		}
+		return d;
+	};
+	std::sort(nodes.begin(), nodes.end(), [&distance](const BVHNode* a, const BVHNode* b) {
+		return distance(a) < distance(b);
+	});
+	return true;
+}
+
+uint64_t BVH::hitPacket(RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs, const std::vector<BVHNode*>* startNodes) const {
+	if (!(visibility & packet.type)) return 0;
+	// Instanced BVHs usually have no transform of their own: their packets are traced in place, the
+	// others trace a copy of the rays of mask in their space
+	const bool identity = transform.isIdentity();
+	RayPacket local;
+	if (!identity) packet.transform(transform.getInverse(), mask, local);
+	RayPacket& traced = identity ? packet : local;
+	// Collapsed nodes are only traversed ray by ray
+	if (isCollapsed || !traced.isCoherent()) {
+		return hitSingleRays(packet, mask, tMin, recs, startNodes);
+	}
+
+	uint64_t hits = 0;
+	if (!compressedNodes.empty()) {
+		hits = traversePacketCompressed(traced, mask, tMin, recs);
+	} else if (startNodes) {
+		for (auto node : *startNodes) {
+			hits |= traversePacket(traced, node, mask, tMin, recs);
+		}
+	} else if (isNodeVisible(this->root, packet.type)) {
+		hits = traversePacket(traced, this->root, mask, tMin, recs);
+	}
+	auto transposeInv = transform.getTransposeInverse();
+	auto transformMat = transform.getMatrix();
+	for (int i = 0; i < packet.size; ++i) {
+		if (!(hits & (1ull << i))) continue;
+		computeHitAttributes(traced.rays[i], recs[i]);
+		recs[i].p = transformMat * glm::fvec4(recs[i].p, 1.0f);
+		recs[i].setFaceNormal(packet.rays[i], transposeInv * glm::fvec4(recs[i].normal, 0.0));
+		packet.tMax[i] = traced.tMax[i];
+	}
+	return hits;
+}
+
+uint64_t BVH::hitSingleRays(RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs, const std::vector<BVHNode*>* startNodes) const {
+	uint64_t hits = 0;
+	for (int i = 0; i < packet.size; ++i) {
+		if (!(mask & (1ull << i))) continue;
+		HitRecord tmp;
+		bool rayHit = startNodes ?
+			hitFrom(packet.rays[i], tMin, packet.tMax[i], tmp, *startNodes) :
+			hit(packet.rays[i], tMin, packet.tMax[i], tmp);
+		if (rayHit) {
+			recs[i] = tmp;
+			packet.tMax[i] = tmp.t;
+			hits |= 1ull << i;
+		}
+	}
+	return hits;
+}
+
+uint64_t BVH::traversePacket(RayPacket& packet, BVHNode* node, uint64_t mask, float tMin, HitRecord* recs) const {
+	struct PacketStackNode {
+		BVHNode* node;
+		uint64_t mask;
+	};
+	uint64_t hits = 0;
+
+	PacketStackNode nodestack[64];
+	size_t stackPtr = 0;
+	nodestack[stackPtr++] = { node, mask };
+	while (stackPtr != 0) {
+		auto entry = nodestack[--stackPtr];
+		BVHNode* currNode = entry.node;
+		// One test for the whole packet first, then the rays that are still active
+		if (!packet.mayHitAABB(currNode->minAABBLeftFirst, currNode->maxAABBCount)) continue;
+		uint64_t active = packet.hitAABB(currNode->minAABBLeftFirst, currNode->maxAABBCount, entry.mask);
+		if (active == 0) continue;
+
+		if (std::bitset<64>(active).count() < minPacketRays) {
+			for (int i = 0; i < packet.size; ++i) {
+				if (!(active & (1ull << i))) continue;
+				HitRecord tmp;
+				float rayTMin = tMin;
+				float rayTMax = packet.tMax[i];
+				if (traverse(packet.rays[i], currNode, rayTMin, rayTMax, tmp)) {
+					recs[i] = tmp;
+					packet.tMax[i] = tmp.t;
+					hits |= 1ull << i;
+				}
+			}
+			continue;
+		}
+
+		if (currNode->maxAABBCount.w != 0) {
+			if (isTopLevel) {
+				for (size_t j = currNode->minAABBLeftFirst.w; j < currNode->minAABBLeftFirst.w + currNode->maxAABBCount.w; ++j) {
+					hits |= hitInstancePacket(instances[hittableIdxs[j]], packet, active, tMin, recs);
+				}
+				continue;
+			}
+			hits |= hitLeafPacket(packet, currNode->minAABBLeftFirst.w, currNode->maxAABBCount.w, active, tMin, recs);
+		} else {
+			auto firstNode = &this->nodePool[(int)currNode->minAABBLeftFirst.w];
+			auto secondNode = &this->nodePool[(int)currNode->minAABBLeftFirst.w + 1];
+			bool visibleFirst = isNodeVisible(firstNode, packet.type);
+			bool visibleSecond = isNodeVisible(secondNode, packet.type);
+			// Visit first the child that comes first along the packet direction, on the axis that separates them most
+			glm::fvec3 offset = (glm::fvec3(secondNode->minAABBLeftFirst) + glm::fvec3(secondNode->maxAABBCount)) -
+				(glm::fvec3(firstNode->minAABBLeftFirst) + glm::fvec3(firstNode->maxAABBCount));
+			int axis = std::fabs(offset.x) > std::fabs(offset.y) ?
+				(std::fabs(offset.x) > std::fabs(offset.z) ? 0 : 2) :
+				(std::fabs(offset.y) > std::fabs(offset.z) ? 1 : 2);
+			if ((offset[axis] < 0.0f) != packet.isNegative(axis)) {
+				std::swap(firstNode, secondNode);
+				std::swap(visibleFirst, visibleSecond);
+			}
+			if (visibleSecond) nodestack[stackPtr++] = { secondNode, active };
+			if (visibleFirst) nodestack[stackPtr++] = { firstNode, active };
+		}
+	}
+	return hits;
+}
+
+// The packet only shares the node tests: each active ray tests the blocks or primitives of the leaf on its own
+uint64_t BVH::hitLeafPacket(RayPacket& packet, int first, int count, uint64_t mask, float tMin, HitRecord* recs) const {
+	uint64_t hits = 0;
+	for (int i = 0; i < packet.size; ++i) {
+		if (!(mask & (1ull << i))) continue;
+		HitRecord tmp;
+		if (leafBlocks) {
+			if (hitLeafBlocks(packet.rays[i], first, count, tMin, packet.tMax[i], tmp)) {
+				recs[i] = tmp;
+				packet.tMax[i] = tmp.t;
+				hits |= 1ull << i;
+			}
+			continue;
+		}
+		for (int j = first; j < first + count; ++j) {
+			if (hitPrimitive(hittableIdxs[j], packet.rays[i], tMin, packet.tMax[i], tmp)) {
+				recs[i] = tmp;
+				packet.tMax[i] = tmp.t;
+				hits |= 1ull << i;
+			}
+		}
+	}
+	return hits;
+}
+
+uint64_t BVH::hitInstancePacket(const BVHInstance& instance, RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs) const {
+	if (!(instance.visibility & packet.type)) return 0;
+
+	RayPacket local;
+	packet.transform(instance.transformInv, mask, local);
+	uint64_t hits = instanced[instance.bvh]->hitPacket(local, mask, tMin, recs);
+	auto normalMatrix = glm::transpose(instance.transformInv);
+	for (int i = 0; i < packet.size; ++i) {
+		if (!(hits & (1ull << i))) continue;
+		recs[i].p = instance.transform * glm::fvec4(recs[i].p, 1.0f);
+		recs[i].setFaceNormal(packet.rays[i], normalMatrix * glm::fvec4(recs[i].normal, 0.0));
+		packet.tMax[i] = local.tMax[i];
+	}
+	return hits;
+}
+
+void BVH::computeAttributes(const Ray& ray, HitRecord& rec) const {
+	if (mesh) mesh->computeAttributes(rec.primitive, ray, rec);
+}
+
+void BVH::computeHitAttributes(const Ray& ray, HitRecord& rec) const {
+	if (rec.object == nullptr) return;
+	// Shadow rays only need to know that something is in the way
+	if (ray.getType() != RAY_SHADOW) {
+		rec.object->computeAttributes(ray, rec);
+	}
+	rec.object = nullptr;
+}
+
 bool BVH::traverse(const Ray& ray, BVHNode* node, float& tMin, float& tMax, HitRecord& rec) const {
 	HitRecord tmp;
 	bool hasHit = false;
@@ -1073,13 +1435,23 @@ bool BVH::traverse(const Ray& ray, BVHNode* node, float& tMin, float& tMax, HitR
 	while(stackPtr != 0){
 		BVHNode* currNode = nodestack[--stackPtr];
 		if(currNode->maxAABBCount.w != 0) {// I'm a leaf
-			for (size_t i = currNode->minAABBLeftFirst.w; i < currNode->minAABBLeftFirst.w + currNode->maxAABBCount.w; ++i) {
-				auto prim = hittables[hittableIdxs[i]];
-				if (prim->hit(ray, tMin, closest, tmp)) {
+			if (leafBlocks) {
+				if (hitLeafBlocks(ray, currNode->minAABBLeftFirst.w, currNode->maxAABBCount.w, tMin, closest, tmp)) {
 					rec = tmp;
 					closest = rec.t;
 					hasHit = true;
 				}
+			} else {
+				for (size_t i = currNode->minAABBLeftFirst.w; i < currNode->minAABBLeftFirst.w + currNode->maxAABBCount.w; ++i) {
+					bool primHit = isTopLevel ?
+						hitInstance(instances[hittableIdxs[i]], ray, tMin, closest, tmp) :
+						hitPrimitive(hittableIdxs[i], ray, tMin, closest, tmp);
+					if (primHit) {
+						rec = tmp;
+						closest = rec.t;
+						hasHit = true;
+					}
+				}
 			}
 			tMax = closest;
 		} else {
@@ -1087,8 +1459,8 @@ bool BVH::traverse(const Ray& ray, BVHNode* node, float& tMin, float& tMax, HitR
 			auto secondNode = &this->nodePool[(int)currNode->minAABBLeftFirst.w + 1];
 			float firstDistance = 0.0f;
 			float secondDistance = 0.0f;
-			bool hitAABBFirst = hitAABB(ray, firstNode->minAABBLeftFirst, firstNode->maxAABBCount, firstDistance);
-			bool hitAABBSecond = hitAABB(ray, secondNode->minAABBLeftFirst, secondNode->maxAABBCount, secondDistance);
+			bool hitAABBFirst = isNodeVisible(firstNode, ray.getType()) && hitAABB(ray, firstNode->minAABBLeftFirst, firstNode->maxAABBCount, firstDistance);
+			bool hitAABBSecond = isNodeVisible(secondNode, ray.getType()) && hitAABB(ray, secondNode->minAABBLeftFirst, secondNode->maxAABBCount, secondDistance);
 			if (hitAABBFirst && hitAABBSecond) {
 				if(firstDistance < secondDistance && firstDistance < tMax){
 					nodestack[stackPtr++] = secondNode;
@@ -1116,13 +1488,20 @@ bool BVH::traverseCollapsed(const Ray& ray, const BVHNode* node, float& tMin, fl
 
 		// We are a leaf
 		// Intersect the primitives
-		for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
-			auto prim = hittables[hittableIdxs[i]];
-			if (prim->hit(ray, tMin, closest, tmp)) {
+		if (leafBlocks) {
+			if (hitLeafBlocks(ray, node->minAABBLeftFirst.w, node->maxAABBCount.w, tMin, closest, tmp)) {
 				rec = tmp;
 				closest = rec.t;
 				hasHit = true;
 			}
+		} else {
+			for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
+				if (hitPrimitive(hittableIdxs[i], ray, tMin, closest, tmp)) {
+					rec = tmp;
+					closest = rec.t;
+					hasHit = true;
+				}
+			}
 		}
 
 		tMax = closest;
@@ -1148,6 +1527,419 @@ bool BVH::traverseCollapsed(const Ray& ray, const BVHNode* node, float& tMin, fl
 	return hasHit;
 }
 
+// A child gathered by compressNode: an inner node of the binary BVH, or a range of the primitives of one of its leaves
+struct BVH::CompressionChild {
+	glm::fvec3 min;
+	glm::fvec3 max;
+	const BVHNode* node; // nullptr for the ranges
+	int leaf; // First primitive of the leaf holding the range
+	int first;
+	int count;
+
+	inline bool isInner() const {
+		return node != nullptr || count > CompressedBVHNode::maxLeafSize;
+	}
+};
+
+void BVH::compressNodes() {
+	if (isTopLevel || isCollapsed || !compressedNodes.empty() || primitiveCount() == 0) return;
+	auto t1 = std::chrono::high_resolution_clock::now();
+	// The primitives are reordered so that the leaf children of each node are next to each other
+	std::vector<int> order;
+	order.reserve(primitiveCount());
+	std::vector<int> orderBlocks(leafBlocks ? primitiveCount() : 0, -1);
+	compressedNodes.resize(1);
+	compressNode({ glm::fvec3(root->minAABBLeftFirst), glm::fvec3(root->maxAABBCount), root, 0, 0, 0 }, 0, order, orderBlocks);
+	hittableIdxs.allocate(order.size());
+	std::copy(order.begin(), order.end(), hittableIdxs.get());
+	if (leafBlocks) {
+		leafBlocks.allocate(orderBlocks.size());
+		std::copy(orderBlocks.begin(), orderBlocks.end(), leafBlocks.get());
+	}
+
+	// Bounds of the whole BVH stay in localBBox; the binary nodes aren't needed anymore
+	this->nodePool.reset();
+	this->root = nullptr;
+	this->nodeMasks.clear();
+	auto t2 = std::chrono::high_resolution_clock::now();
+	auto ms_int = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+	std::cout << "BVH Compression into " << compressedNodes.size() << " nodes: " << ms_int.count() << "us" << std::endl;
+}
+
+namespace {
+	// Leaves too big for the 8 bit counts are split at multiples of this many primitives, a whole number of blocks
+	constexpr int compressedLeafSplit = 128;
+
+	inline float decodeBound(float origin, float scale, uint8_t q) {
+		return origin + scale * static_cast<float>(q);
+	}
+
+	inline float exponentScale(int exponent) {
+		uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		return scale;
+	}
+
+	inline glm::fvec3 decodeScale(const CompressedBVHNode& node) {
+		return { exponentScale(node.exponent[0]), exponentScale(node.exponent[1]), exponentScale(node.exponent[2]) };
+	}
+
+	inline uint8_t quantizeMin(float v, float origin, float scale) {
+		int q = std::clamp((int)std::floor((v - origin) / scale), 0, 255);
+		while (q > 0 && decodeBound(origin, scale, q) > v) --q;
+		return q;
+	}
+
+	inline uint8_t quantizeMax(float v, float origin, float scale) {
+		int q = std::clamp((int)std::ceil((v - origin) / scale), 0, 255);
+		while (q < 255 && decodeBound(origin, scale, q) < v) ++q;
+		return q;
+	}
+}
+
+void BVH::compressNode(const CompressionChild& node, uint32_t idx, std::vector<int>& order, std::vector<int>& orderBlocks) {
+	std::vector<CompressionChild> children;
+	auto addChild = [&children](const BVHNode* child) {
+		glm::fvec3 lo(child->minAABBLeftFirst);
+		glm::fvec3 hi(child->maxAABBCount);
+		if (child->maxAABBCount.w == 0) {
+			children.push_back({ lo, hi, child, 0, 0, 0 });
+		} else {
+			int first = child->minAABBLeftFirst.w;
+			children.push_back({ lo, hi, nullptr, first, first, (int)child->maxAABBCount.w });
+		}
+	};
+	auto expand = [&](const CompressionChild& child) {
+		if (child.node) {
+			addChild(&this->nodePool[(int)child.node->minAABBLeftFirst.w]);
+			addChild(&this->nodePool[(int)child.node->minAABBLeftFirst.w + 1]);
+		} else {
+			int half = (child.count / 2 + compressedLeafSplit - 1) / compressedLeafSplit * compressedLeafSplit;
+			children.push_back({ child.min, child.max, nullptr, child.leaf, child.first, half });
+			children.push_back({ child.min, child.max, nullptr, child.leaf, child.first + half, child.count - half });
+		}
+	};
+	if (node.node && node.node->maxAABBCount.w != 0) addChild(node.node);
+	else expand(node);
+
+	// Pull up the grandchildren with the largest area until the node is full
+	while (children.size() < CompressedBVHNode::width) {
+		int best = -1;
+		float bestArea = -INF;
+		for (int i = 0; i < children.size(); ++i) {
+			if (!children[i].isInner()) continue;
+			float area = calculateSurfaceArea({
+				children[i].min.x, children[i].min.y, children[i].min.z,
+				children[i].max.x, children[i].max.y, children[i].max.z });
+			if (area > bestArea) {
+				bestArea = area;
+				best = i;
+			}
+		}
+		if (best == -1) break;
+		CompressionChild expanded = children[best];
+		children.erase(children.begin() + best);
+		expand(expanded);
+	}
+
+	CompressedBVHNode compressed;
+	compressed.origin = node.min;
+	for (int a = 0; a < 3; ++a) {
+		float extent = node.max[a] - node.min[a];
+		int exponent = extent > 0.0f ? (int)std::ceil(std::log2(extent / 255.0f)) : 0;
+		exponent = std::clamp(exponent, -126, 127);
+		while (exponent < 127 && decodeBound(node.min[a], exponentScale(exponent), 255) < node.max[a]) ++exponent;
+		compressed.exponent[a] = exponent;
+	}
+	const glm::fvec3 scale = decodeScale(compressed);
+	compressed.innerMask = 0;
+	compressed.childBase = compressedNodes.size();
+	compressed.primitiveBase = order.size();
+	const int blockWidth = curveBlocks ? CURVE_BLOCK_LANES : TRIANGLE_BLOCK_WIDTH;
+	int nInner = 0;
+	for (int c = 0; c < CompressedBVHNode::width; ++c) {
+		compressed.count[c] = 0;
+		for (int a = 0; a < 3; ++a) {
+			compressed.lo[a][c] = 0;
+			compressed.hi[a][c] = 0;
+		}
+		if (c >= children.size()) continue;
+		for (int a = 0; a < 3; ++a) {
+			compressed.lo[a][c] = quantizeMin(children[c].min[a], compressed.origin[a], scale[a]);
+			compressed.hi[a][c] = quantizeMax(children[c].max[a], compressed.origin[a], scale[a]);
+		}
+		if (children[c].isInner()) {
+			compressed.innerMask |= 1 << c;
+			++nInner;
+			continue;
+		}
+		compressed.count[c] = children[c].count;
+		if (!orderBlocks.empty()) {
+			orderBlocks[order.size()] = leafBlocks[children[c].leaf] + (children[c].first - children[c].leaf) / blockWidth;
+		}
+		for (int i = children[c].first; i < children[c].first + children[c].count; ++i) {
+			order.push_back(hittableIdxs[i]);
+		}
+	}
+
+	compressedNodes[idx] = compressed;
+	compressedNodes.resize(compressed.childBase + nInner);
+	uint32_t childIdx = compressed.childBase;
+	for (int c = 0; c < children.size(); ++c) {
+		if (children[c].isInner()) compressNode(children[c], childIdx++, order, orderBlocks);
+	}
+}
+
+bool BVH::traverseCompressed(const Ray& ray, uint32_t start, float tMin, float& tMax, HitRecord& rec) const {
+	struct CompressedStackNode {
+		uint32_t index; // Compressed node, or first primitive of a leaf
+		uint32_t count;
+		float distance;
+	};
+	HitRecord tmp;
+	bool hasHit = false;
+	float closest = tMax;
+	const glm::fvec3 origin = ray.getOrigin();
+	const glm::fvec3 inverse = ray.getInverseDirection();
+
+	CompressedStackNode nodestack[256];
+	size_t stackPtr = 0;
+	nodestack[stackPtr++] = { start, 0, 0.0f };
+	while (stackPtr != 0) {
+		auto entry = nodestack[--stackPtr];
+		// The closest hit may have moved in front of the entry since it was pushed
+		if (entry.distance >= closest) continue;
+
+		if (entry.count != 0) {
+			if (leafBlocks) {
+				if (hitLeafBlocks(ray, entry.index, entry.count, tMin, closest, tmp)) {
+					rec = tmp;
+					closest = rec.t;
+					hasHit = true;
+				}
+			} else {
+				for (size_t i = entry.index; i < entry.index + entry.count; ++i) {
+					if (hitPrimitive(hittableIdxs[i], ray, tMin, closest, tmp)) {
+						rec = tmp;
+						closest = rec.t;
+						hasHit = true;
+					}
+				}
+			}
+			continue;
+		}
+
+		const CompressedBVHNode& node = compressedNodes[entry.index];
+		const glm::fvec3 scale = decodeScale(node);
+		uint32_t nextChild = node.childBase;
+		uint32_t nextPrimitive = node.primitiveBase;
+		CompressedStackNode hits[CompressedBVHNode::width];
+		int nHits = 0;
+		for (int c = 0; c < CompressedBVHNode::width; ++c) {
+			bool inner = (node.innerMask >> c) & 1;
+			// Children are stored first, the empty slots last
+			if (!inner && node.count[c] == 0) break;
+			CompressedStackNode child = { inner ? nextChild++ : nextPrimitive, node.count[c], 0.0f };
+			nextPrimitive += node.count[c];
+
+			float tNear = 0.0f;
+			float tFar = closest;
+			for (int a = 0; a < 3; ++a) {
+				float t1 = (decodeBound(node.origin[a], scale[a], node.lo[a][c]) - origin[a]) * inverse[a];
+				float t2 = (decodeBound(node.origin[a], scale[a], node.hi[a][c]) - origin[a]) * inverse[a];
+				tNear = max(tNear, min(t1, t2));
+				tFar = min(tFar, max(t1, t2));
+			}
+			if (tNear > tFar) continue;
+			child.distance = tNear;
+			// Insertion sort, nearest child first
+			int j = nHits++;
+			while (j > 0 && hits[j - 1].distance > tNear) {
+				hits[j] = hits[j - 1];
+				--j;
+			}
+			hits[j] = child;
+		}
+		for (int h = nHits - 1; h >= 0; --h) {
+			nodestack[stackPtr++] = hits[h];
+		}
+	}
+	tMax = closest;
+	return hasHit;
+}
+
+uint64_t BVH::traversePacketCompressed(RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs) const {
+	struct PacketStackNode {
+		uint32_t index; // Compressed node, or first primitive of a leaf
+		uint32_t count;
+		uint64_t mask;
+	};
+	uint64_t hits = 0;
+
+	PacketStackNode nodestack[256];
+	size_t stackPtr = 0;
+	nodestack[stackPtr++] = { 0, 0, mask };
+	while (stackPtr != 0) {
+		auto entry = nodestack[--stackPtr];
+		if (entry.count != 0) {
+			hits |= hitLeafPacket(packet, entry.index, entry.count, entry.mask, tMin, recs);
+			continue;
+		}
+
+		if (std::bitset<64>(entry.mask).count() < minPacketRays) {
+			for (int i = 0; i < packet.size; ++i) {
+				if (!(entry.mask & (1ull << i))) continue;
+				HitRecord tmp;
+				float rayTMax = packet.tMax[i];
+				if (traverseCompressed(packet.rays[i], entry.index, tMin, rayTMax, tmp)) {
+					recs[i] = tmp;
+					packet.tMax[i] = tmp.t;
+					hits |= 1ull << i;
+				}
+			}
+			continue;
+		}
+
+		const CompressedBVHNode& node = compressedNodes[entry.index];
+		const glm::fvec3 scale = decodeScale(node);
+		uint32_t nextChild = node.childBase;
+		uint32_t nextPrimitive = node.primitiveBase;
+		PacketStackNode children[CompressedBVHNode::width];
+		float keys[CompressedBVHNode::width];
+		int nChildren = 0;
+		for (int c = 0; c < CompressedBVHNode::width; ++c) {
+			bool inner = (node.innerMask >> c) & 1;
+			if (!inner && node.count[c] == 0) break;
+			PacketStackNode child = { inner ? nextChild++ : nextPrimitive, node.count[c], 0 };
+			nextPrimitive += node.count[c];
+
+			glm::fvec4 minAABB(0.0f);
+			glm::fvec4 maxAABB(0.0f);
+			for (int a = 0; a < 3; ++a) {
+				minAABB[a] = decodeBound(node.origin[a], scale[a], node.lo[a][c]);
+				maxAABB[a] = decodeBound(node.origin[a], scale[a], node.hi[a][c]);
+			}
+			// One test for the whole packet first, then the rays that are still active
+			if (!packet.mayHitAABB(minAABB, maxAABB)) continue;
+			child.mask = packet.hitAABB(minAABB, maxAABB, entry.mask);
+			if (child.mask == 0) continue;
+			// The rays of a coherent packet share an octant: they enter the boxes through the same corner,
+			// and visiting the children by the position of that corner along the directions is nearest first
+			float key = 0.0f;
+			for (int a = 0; a < 3; ++a) {
+				key += packet.isNegative(a) ? -maxAABB[a] : minAABB[a];
+			}
+			int j = nChildren++;
+			while (j > 0 && keys[j - 1] > key) {
+				children[j] = children[j - 1];
+				keys[j] = keys[j - 1];
+				--j;
+			}
+			children[j] = child;
+			keys[j] = key;
+		}
+		for (int c = nChildren - 1; c >= 0; --c) {
+			nodestack[stackPtr++] = children[c];
+		}
+	}
+	return hits;
+}
+
+void BVH::packBlocks() {
+	triangleBlocks.reset();
+	curveBlocks.reset();
+	leafBlocks.reset();
+	nTriangleBlocks = 0;
+	nCurveBlocks = 0;
+	if (isTopLevel || primitiveCount() == 0) return;
+	bool triangles = mesh != nullptr;
+	bool curves = curveMesh && curveMesh->getIntersector() == CurveIntersector::PHANTOM;
+#if !defined(SIMD_ENABLED)
+	// The curve kernel has no scalar fallback: the leaves keep testing one segment at a time
+	curves = false;
+#endif
+	if (curveMesh) {
+		if (curves) curveMesh->clearSegmentCache();
+		else curveMesh->cacheSegments();
+	}
+	if (!triangles && !curves) return;
+	const int width = triangles ? TRIANGLE_BLOCK_WIDTH : CURVE_BLOCK_LANES;
+	size_t blockCount = 0;
+	for (size_t i = 0; i < poolPtr; ++i) {
+		blockCount += ((int)nodePool[i].maxAABBCount.w + width - 1) / width;
+	}
+	if (triangles) triangleBlocks.allocate(blockCount);
+	else curveBlocks.allocate(blockCount);
+	leafBlocks.allocate(primitiveCount());
+	std::fill(leafBlocks.get(), leafBlocks.get() + primitiveCount(), -1);
+	packLeafBlocks(this->root);
+}
+
+void BVH::packLeafBlocks(const BVHNode* node) {
+	if (node->maxAABBCount.w == 0) {
+		packLeafBlocks(&this->nodePool[(int)node->minAABBLeftFirst.w]);
+		packLeafBlocks(&this->nodePool[(int)node->minAABBLeftFirst.w + 1]);
+		return;
+	}
+	int first = node->minAABBLeftFirst.w;
+	int count = node->maxAABBCount.w;
+	if (curveBlocks) {
+		leafBlocks[first] = nCurveBlocks;
+		for (int i = 0; i < count; i += CURVE_BLOCK_LANES) {
+			CurveBlock block;
+			for (int lane = 0; lane < CURVE_BLOCK_LANES; ++lane) {
+				setCurveBlockLane(block, lane, i + lane < count ? hittableIdxs[first + i + lane] : -1, *curveMesh);
+			}
+			fitCurveBlockBox(block, *curveMesh);
+			curveBlocks[nCurveBlocks++] = block;
+		}
+		return;
+	}
+	leafBlocks[first] = nTriangleBlocks;
+	for (int i = 0; i < count; i += TRIANGLE_BLOCK_WIDTH) {
+		TriangleBlock block;
+		for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; ++lane) {
+			if (i + lane < count) {
+				int idx = hittableIdxs[first + i + lane];
+				glm::fvec3 v0, v1, v2;
+				mesh->getVertices(idx, v0, v1, v2);
+				setTriangleBlockLane(block, lane, idx, v0, v1, v2);
+			} else {
+				setTriangleBlockLane(block, lane, -1, glm::fvec3(0.0f), glm::fvec3(0.0f), glm::fvec3(0.0f));
+			}
+		}
+		triangleBlocks[nTriangleBlocks++] = block;
+	}
+}
+
+bool BVH::hitLeafBlocks(const Ray& ray, int first, int count, float tMin, float tMax, HitRecord& rec) const {
+	int firstBlock = leafBlocks[first];
+	bool hasHit = false;
+#if defined(SIMD_ENABLED)
+	if (curveBlocks) {
+		int lastBlock = firstBlock + (count + CURVE_BLOCK_LANES - 1) / CURVE_BLOCK_LANES;
+		for (int b = firstBlock; b < lastBlock; ++b) {
+			if (hitCurveBlock(curveBlocks[b], ray, tMin, tMax, rec)) {
+				rec.object = this;
+				tMax = rec.t;
+				hasHit = true;
+			}
+		}
+		return hasHit;
+	}
+#endif
+	int lastBlock = firstBlock + (count + TRIANGLE_BLOCK_WIDTH - 1) / TRIANGLE_BLOCK_WIDTH;
+	for (int b = firstBlock; b < lastBlock; ++b) {
+		if (hitTriangleBlock(triangleBlocks[b], ray, tMin, tMax, rec)) {
+			rec.object = this;
+			tMax = rec.t;
+			hasHit = true;
+		}
+	}
+	return hasHit;
+}
+
 BVHNode* BVH::findBestMatch(BVHNode* target, std::list<BVHNode*> nodes) {
 	BVHNode* bestMatch;
 	float bestSurfaceArea = INF;
@@ -1165,17 +1957,147 @@ BVHNode* BVH::findBestMatch(BVHNode* target, std::list<BVHNode*> nodes) {
 	return bestMatch;
 }
 
+uint8_t BVH::computeNodeMask(const BVHNode* node) {
+	uint8_t mask = 0;
+	if (node->maxAABBCount.w != 0) {
+		for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
+			mask |= instances[hittableIdxs[i]].visibility;
+		}
+	} else {
+		mask |= computeNodeMask(&this->nodePool[(int)node->minAABBLeftFirst.w]);
+		mask |= computeNodeMask(&this->nodePool[(int)node->minAABBLeftFirst.w + 1]);
+	}
+	nodeMasks[node - nodePool.get()] = mask;
+	return mask;
+}
+
+bool BVH::hitInstance(const BVHInstance& instance, const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+	if (!(instance.visibility & ray.getType())) return false;
+
+	const Ray transformedRay = ray.transformRay(instance.transformInv);
+	if (instanced[instance.bvh]->hit(transformedRay, tMin, tMax, rec)) {
+		rec.p = instance.transform * glm::fvec4(rec.p, 1.0f);
+		rec.setFaceNormal(ray, glm::transpose(instance.transformInv) * glm::fvec4(rec.normal, 0.0));
+		return true;
+	}
+	return false;
+}
+
+void BVH::updateInstanceBBox(BVHInstance& instance) {
+	instance.worldBBox = transformAABB(instanced[instance.bvh]->getWorldAABB(), instance.transform);
+}
+
+bool BVH::updateInstances(float dt) {
+	movedInstances.clear();
+	for (int i = 0; i < instances.size(); ++i) {
+		auto& instance = instances[i];
+		bool moved = instanced[instance.bvh]->hasChanged();
+		if (instance.animation != -1) {
+			auto& animation = animations[instance.animation];
+			animation.update(dt);
+			if (animation.isStarted() && !animation.isEnded()) {
+				auto t = animation.getNextTransform();
+				instance.transform = t.getMatrix();
+				instance.transformInv = t.getInverse();
+				moved = true;
+			}
+		}
+		if (moved) {
+			updateInstanceBBox(instance);
+			movedInstances.push_back(i);
+		}
+	}
+
+	this->changed = !movedInstances.empty();
+	if (!this->changed) return false;
+
+	for (auto i : movedInstances) {
+		refitInstance(i);
+	}
+	if (treeCost() > builtCost * maxRefitDegradation) {
+		constructTopLevelBVH();
+	} else {
+		updateRootAABB();
+	}
+	return true;
+}
+
+void BVH::linkTopLevelNodes(int nodeIdx, int parentIdx) {
+	auto node = &this->nodePool[nodeIdx];
+	nodeParents[nodeIdx] = parentIdx;
+	if (node->maxAABBCount.w != 0) {
+		for (size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i) {
+			instanceNodes[hittableIdxs[i]] = nodeIdx;
+		}
+	} else {
+		treeArea += calculateSurfaceArea({
+			node->minAABBLeftFirst.x, node->minAABBLeftFirst.y, node->minAABBLeftFirst.z,
+			node->maxAABBCount.x, node->maxAABBCount.y, node->maxAABBCount.z });
+		linkTopLevelNodes((int)node->minAABBLeftFirst.w, nodeIdx);
+		linkTopLevelNodes((int)node->minAABBLeftFirst.w + 1, nodeIdx);
+	}
+}
+
+void BVH::refitInstance(int instanceIdx) {
+	// Top level leaves hold a single instance, so its bounds are the leaf's
+	int nodeIdx = instanceNodes[instanceIdx];
+	auto& aabb = instances[instanceIdx].worldBBox;
+	auto leaf = &this->nodePool[nodeIdx];
+	leaf->minAABBLeftFirst = { aabb.minX, aabb.minY, aabb.minZ, leaf->minAABBLeftFirst.w };
+	leaf->maxAABBCount = { aabb.maxX, aabb.maxY, aabb.maxZ, leaf->maxAABBCount.w };
+
+	for (nodeIdx = nodeParents[nodeIdx]; nodeIdx != -1; nodeIdx = nodeParents[nodeIdx]) {
+		auto node = &this->nodePool[nodeIdx];
+		auto left = &this->nodePool[(int)node->minAABBLeftFirst.w];
+		auto right = left + 1;
+		glm::fvec4 newMin = {
+			min(left->minAABBLeftFirst.x, right->minAABBLeftFirst.x),
+			min(left->minAABBLeftFirst.y, right->minAABBLeftFirst.y),
+			min(left->minAABBLeftFirst.z, right->minAABBLeftFirst.z),
+			node->minAABBLeftFirst.w };
+		glm::fvec4 newMax = {
+			max(left->maxAABBCount.x, right->maxAABBCount.x),
+			max(left->maxAABBCount.y, right->maxAABBCount.y),
+			max(left->maxAABBCount.z, right->maxAABBCount.z),
+			node->maxAABBCount.w };
+		// Ancestors only depend on their children: nothing above an unchanged node needs refitting
+		if (newMin == node->minAABBLeftFirst && newMax == node->maxAABBCount) break;
+
+		treeArea -= calculateSurfaceArea({
+			node->minAABBLeftFirst.x, node->minAABBLeftFirst.y, node->minAABBLeftFirst.z,
+			node->maxAABBCount.x, node->maxAABBCount.y, node->maxAABBCount.z });
+		node->minAABBLeftFirst = newMin;
+		node->maxAABBCount = newMax;
+		treeArea += calculateSurfaceArea({
+			newMin.x, newMin.y, newMin.z,
+			newMax.x, newMax.y, newMax.z });
+	}
+}
+
+float BVH::treeCost() const {
+	// SAH cost of the inner nodes, relative to the root so that it doesn't grow just because the scene did
+	float rootArea = calculateSurfaceArea({
+		this->root->minAABBLeftFirst.x, this->root->minAABBLeftFirst.y, this->root->minAABBLeftFirst.z,
+		this->root->maxAABBCount.x, this->root->maxAABBCount.y, this->root->maxAABBCount.z });
+	return rootArea > 0.0f ? treeArea / rootArea : 0.0f;
+}
+
 void BVH::refitNode(BVHNode* node){
 	if(node == nullptr) return;
 	if(node->maxAABBCount.w != 0){ /* Leaf! Refit */
 		computeBounding(node);
 	} else {
+		// Inner nodes don't own primitives: their bounds are the union of the refitted children
 		auto leftNode = &this->nodePool[(int)node->minAABBLeftFirst.w];
 		refitNode(leftNode);
-		computeBounding(leftNode);
 		auto rightNode = &this->nodePool[(int)node->minAABBLeftFirst.w + 1];
 		refitNode(rightNode);
-		computeBounding(rightNode);
+		node->minAABBLeftFirst.x = min(leftNode->minAABBLeftFirst.x, rightNode->minAABBLeftFirst.x);
+		node->minAABBLeftFirst.y = min(leftNode->minAABBLeftFirst.y, rightNode->minAABBLeftFirst.y);
+		node->minAABBLeftFirst.z = min(leftNode->minAABBLeftFirst.z, rightNode->minAABBLeftFirst.z);
+		node->maxAABBCount.x = max(leftNode->maxAABBCount.x, rightNode->maxAABBCount.x);
+		node->maxAABBCount.y = max(leftNode->maxAABBCount.y, rightNode->maxAABBCount.y);
+		node->maxAABBCount.z = max(leftNode->maxAABBCount.z, rightNode->maxAABBCount.z);
 	}
 }
 
@@ -1187,9 +2109,24 @@ void BVH::refit() {
 	} else {
 		++refitCounter;
 		refitNode(this->root);
+		// The instances of this mesh read its bounds to refit the top level BVHs
+		updateRootAABB();
+		packBlocks();
 	}
 }
 
+void BVH::updateRootAABB() {
+	setLocalAABB({
+		this->root->minAABBLeftFirst.x,
+		this->root->minAABBLeftFirst.y,
+		this->root->minAABBLeftFirst.z,
+		this->root->maxAABBCount.x,
+		this->root->maxAABBCount.y,
+		this->root->maxAABBCount.z
+	});
+	this->surfaceArea = calculateSurfaceArea(worldBBox);
+}
+
 bool BVH::update(float dt) {
 	bool ret = false;
 	if(animate){
@@ -1200,9 +2137,12 @@ bool BVH::update(float dt) {
 		}
 	}
 	if(mustRefit) {
+		// Primitives are stepped once per mesh: every instance shares this BVH
+		updateNode(this->root, dt);
 		this->refit();
 		ret = true;
 	}
+	this->changed = ret;
 	return ret;
 }
 
@@ -1210,6 +2150,8 @@ bool BVH::updateNode(BVHNode* node, float dt){
 	if(node == nullptr) return false;
 	bool ret = false;
 	if(node->maxAABBCount.w != 0){ /* Leaf! Updates */
+		// Mesh triangles and curves are static
+		if (mesh || curveMesh) return false;
 		for(size_t i = node->minAABBLeftFirst.w; i < node->minAABBLeftFirst.w + node->maxAABBCount.w; ++i){
 			ret |= hittables[hittableIdxs[i]]->update(dt);
 		}
@@ -1223,24 +2165,5 @@ bool BVH::updateNode(BVHNode* node, float dt){
 }
 
 void BVH::updateWorldBBox() {
-	std::vector<glm::fvec4> localVertices;
-	localVertices.emplace_back( localBBox.minX, localBBox.minY, localBBox.minZ, 1.0f );
-	localVertices.emplace_back( localBBox.minX, localBBox.minY, localBBox.maxZ, 1.0f );
-	localVertices.emplace_back( localBBox.minX, localBBox.maxY, localBBox.minZ, 1.0f );
-	localVertices.emplace_back( localBBox.minX, localBBox.maxY, localBBox.maxZ, 1.0f );
-	localVertices.emplace_back( localBBox.maxX, localBBox.minY, localBBox.minZ, 1.0f );
-	localVertices.emplace_back( localBBox.maxX, localBBox.minY, localBBox.maxZ, 1.0f );
-	localVertices.emplace_back( localBBox.maxX, localBBox.maxY, localBBox.minZ, 1.0f );
-	localVertices.emplace_back( localBBox.maxX, localBBox.maxY, localBBox.maxZ, 1.0f );
-
-	worldBBox = { INF, INF, INF, -INF, -INF, -INF };
-	for (auto vertex : localVertices) {
-		auto tranformedVertex = transform.getMatrix() * vertex;
-		worldBBox.minX = min(tranformedVertex.x, worldBBox.minX);
-		worldBBox.minY = min(tranformedVertex.y, worldBBox.minY);
-		worldBBox.minZ = min(tranformedVertex.z, worldBBox.minZ);
-		worldBBox.maxX = max(tranformedVertex.x, worldBBox.maxX);
-		worldBBox.maxY = max(tranformedVertex.y, worldBBox.maxY);
-		worldBBox.maxZ = max(tranformedVertex.z, worldBBox.maxZ);
-	}
+	worldBBox = transformAABB(localBBox, transform.getMatrix());
 }
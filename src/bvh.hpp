@@ -3,6 +3,10 @@
 
 #include "animation.hpp"
 #include "hittables/hittable.hpp"
+#include "hittables/curve_block.hpp"
+#include "hittables/triangle_block.hpp"
+#include "hittables/triangle_mesh.hpp"
+#include "ray_packet.hpp"
 #include <list>
 
 enum class Heuristic {
@@ -10,11 +14,38 @@ enum class Heuristic {
 	MIDPOINT,
 };
 
+// Relative costs used by the SAH to decide whether splitting a node pays off
+// compared to intersecting all of its primitives in a single leaf.
+struct SAHCost {
+	float traversal = 1.0f;
+	float intersection = 1.0f;
+	int maxLeafSize = 16;
+};
+
 struct BVHNode {
 	glm::fvec4 minAABBLeftFirst = {INF, INF, INF, 0};
 	glm::fvec4 maxAABBCount = {-INF, -INF, -INF, 0};
 };
 
+// Node of a compressed wide BVH: up to 8 children, whose bounds are quantized to 8 bits per plane in a
+// frame fitted to the node (origin at its min corner, power of two scale per axis). Quantization always
+// rounds outwards, so the decoded boxes contain the exact ones.
+// The inner children of a node are stored next to each other from childBase, and the primitives of its
+// leaf children next to each other from primitiveBase, both in child order: a child is found from the
+// counts and the inner mask of the children before it.
+struct CompressedBVHNode {
+	static constexpr int width = 8;
+	static constexpr int maxLeafSize = 255;
+	glm::fvec3 origin;
+	int8_t exponent[3]; // The scale of each axis is 2^exponent
+	uint8_t innerMask; // Bit c is set if child c is an inner node
+	uint32_t childBase;
+	uint32_t primitiveBase;
+	uint8_t count[width]; // Primitives of the leaf children, 0 for the inner ones and the empty slots
+	uint8_t lo[3][width];
+	uint8_t hi[3][width];
+};
+
 struct StackNode
 {
 	BVHNode* node;
@@ -38,20 +69,90 @@ struct BinningJob{
 	std::vector<int> nRight;
 };
 
+// An entry of a top level BVH: a transformed reference to one of the BVHs it instances.
+// Instances are stored by value so that scenes with lots of them don't pay for a whole BVH each.
+struct BVHInstance {
+	glm::mat4 transform;
+	glm::mat4 transformInv;
+	AABB worldBBox;
+	int bvh; // Index in the instanced BVHs of the top level BVH
+	int animation; // Index in the animations of the top level BVH, -1 if the instance is static
+	uint8_t visibility;
+};
+
 class BVH : public Hittable {
 	public:
-		BVH(std::vector<HittablePtr> h, Heuristic heur = Heuristic::SAH, bool _refit = false, bool makeTopLevel = false);
+		BVH(std::vector<HittablePtr> h, Heuristic heur = Heuristic::SAH, bool _refit = false, SAHCost cost = SAHCost());
+		// BVH over the triangles of a mesh, referenced by their index in it; the leaves are tested as triangle blocks
+		BVH(std::shared_ptr<TriangleMesh> m, Heuristic heur = Heuristic::SAH, bool _refit = false, SAHCost cost = SAHCost());
+		// BVH over the segments of a set of curves, referenced by their index in it
+		BVH(std::shared_ptr<CurveMesh> c, Heuristic heur = Heuristic::SAH, bool _refit = false, SAHCost cost = SAHCost());
+		BVH(std::vector<std::shared_ptr<BVH>> instanced, std::vector<BVHInstance> instances, std::vector<Animation> animations);
+		// Prebuilt BVH over a mesh or a set of curves, e.g. with arrays pointing into a mesh file. Without
+		// blocks, the primitives are packed from the nodes.
+		BVH(std::shared_ptr<TriangleMesh> m, std::shared_ptr<CurveMesh> c, MappedArray<BVHNode> nodes, size_t nNodes, MappedArray<int> primitives,
+				MappedArray<TriangleBlock> blocks = MappedArray<TriangleBlock>(), size_t nBlocks = 0, MappedArray<int> leafBlocks = MappedArray<int>());
 		~BVH();
 
 		bool hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const override;
+		// Attributes of the mesh triangles, which have no Hittable to compute them; curve hits are already complete
+		void computeAttributes(const Ray& ray, HitRecord& rec) const override;
+		// Packet version of hit(): rays of mask that find a hit closer than their packet.tMax get it in recs,
+		// their tMax is updated and their bit is set in the returned mask
+		uint64_t hitPacket(RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs, const std::vector<BVHNode*>* startNodes = nullptr) const;
+		// Nodes whose boxes overlap the frustum, nearest first, to start the traversals of the rays inside it
+		// from instead of the root. At most maxFrustumNodes nodes are kept; false if the BVH can't be culled.
+		bool cullFrustum(const Frustum& frustum, uint8_t rayType, std::vector<BVHNode*>& nodes) const;
+		// hit() for a ray inside the frustum given to cullFrustum
+		bool hitFrom(const Ray& ray, float tMin, float tMax, HitRecord& rec, const std::vector<BVHNode*>& startNodes) const;
 		bool update(float dt) override;
+		bool updateInstances(float dt);
+		// True if the bounds of the BVH moved during the last update
+		inline bool hasChanged() const {
+			return changed;
+		}
+		inline size_t primitiveCount() const {
+			return mesh ? mesh->nTriangles : curveMesh ? curveMesh->segmentCount() : hittables.size();
+		}
 		const std::vector<HittablePtr>& getHittable() const {
 			return hittables;
 		};
+		// Arrays of the binary BVH of a mesh or curves, to write it to a mesh file. Only valid if isBinary().
+		inline bool isBinary() const {
+			return !isTopLevel && !isCollapsed && nodePool;
+		}
+		inline size_t nodeCount() const {
+			return poolPtr;
+		}
+		inline const BVHNode* getNodes() const {
+			return nodePool.get();
+		}
+		inline const int* getPrimitiveOrder() const {
+			return hittableIdxs.get();
+		}
+		inline size_t triangleBlockCount() const {
+			return nTriangleBlocks;
+		}
+		inline const TriangleBlock* getTriangleBlocks() const {
+			return triangleBlocks.get();
+		}
+		inline const int* getLeafBlocks() const {
+			return leafBlocks.get();
+		}
 		void collapseBVH();
+		// Replaces the node pool with compressed 8 wide nodes. The BVH can't be refitted afterwards.
+		void compressNodes();
 		void constructTopLevelBVH();
 		void constructSubBVH();
 
+		virtual inline uint8_t getVisibility() const override {
+			// Top level BVHs are only visible to the rays accepted by at least one of their children
+			return nodeMasks.empty() ? visibility : (visibility & nodeMasks[0]);
+		}
+		inline void setVisibility(uint8_t mask) {
+			visibility = mask;
+		}
+
 		void setAnimation(const Animation anim){
 			animate = true;
 			animationManager = anim;
@@ -89,34 +190,102 @@ class BVH : public Hittable {
 
 
 	private:
-		void midpointSplit(BVHNode* node);
+		bool midpointSplit(BVHNode* node);
 		void subdivideBin(BVHNode* node);
-		void partitionBinSingle(BVHNode* node);
-		void partitionBinMulti(BVHNode* node);
+		bool partitionBinSingle(BVHNode* node);
+		bool partitionBinMulti(BVHNode* node);
+		bool shouldSplit(const BVHNode* node, float splitCost);
 		void refit();
 		void refitNode(BVHNode* node);
+		void updateRootAABB();
+		void packBlocks();
+		void packLeafBlocks(const BVHNode* node);
+		bool hitLeafBlocks(const Ray& ray, int first, int count, float tMin, float tMax, HitRecord& rec) const;
 		bool updateNode(BVHNode* node, float dt);
 
 		void subdivideHQ(BVHNode* node);
-		void partitionHQ(BVHNode* node);
+		bool partitionHQ(BVHNode* node);
 
 		bool computeBounding(BVHNode *node);
-		float calculateSurfaceArea(AABB bbox);
+		float calculateSurfaceArea(AABB bbox) const;
 		float calculateBinID(AABB primAABB, float k1, float k0, int longestAxisIdx);
 		bool traverse(const Ray& ray, BVHNode* node, float& tMin, float& tMax, HitRecord& rec) const;
+		void computeHitAttributes(const Ray& ray, HitRecord& rec) const;
+		uint64_t traversePacket(RayPacket& packet, BVHNode* node, uint64_t mask, float tMin, HitRecord* recs) const;
+		uint64_t hitSingleRays(RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs, const std::vector<BVHNode*>* startNodes) const;
+		uint64_t hitInstancePacket(const BVHInstance& instance, RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs) const;
 		bool traverseCollapsed(const Ray& ray, const BVHNode* node, float& tMin, float& tMax, HitRecord& rec) const;
+		struct CompressionChild;
+		void compressNode(const CompressionChild& node, uint32_t idx, std::vector<int>& order, std::vector<int>& orderBlocks);
+		bool traverseCompressed(const Ray& ray, uint32_t node, float tMin, float& tMax, HitRecord& rec) const;
+		uint64_t traversePacketCompressed(RayPacket& packet, uint64_t mask, float tMin, HitRecord* recs) const;
+		uint64_t hitLeafPacket(RayPacket& packet, int first, int count, uint64_t mask, float tMin, HitRecord* recs) const;
 		BVHNode* findBestMatch(BVHNode* target, std::list<BVHNode*> nodes);
+		uint8_t computeNodeMask(const BVHNode* node);
+		bool hitInstance(const BVHInstance& instance, const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+		void updateInstanceBBox(BVHInstance& instance);
+		void linkTopLevelNodes(int nodeIdx, int parentIdx);
+		void refitInstance(int instanceIdx);
+		float treeCost() const;
+		inline AABB getPrimitiveAABB(int idx) const {
+			if (mesh) return mesh->getBounds(idx);
+			if (curveMesh) return curveBounds.empty() ? curveMesh->getBounds(idx) : curveBounds[idx];
+			return hittables[idx]->getWorldAABB();
+		}
+		// Not used for triangle meshes, whose leaves are always tested through their triangle blocks
+		inline bool hitPrimitive(int idx, const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+			if (!curveMesh) return hittables[idx]->hit(ray, tMin, tMax, rec);
+			if (!curveMesh->hit(idx, ray, tMin, tMax, rec)) return false;
+			rec.object = this;
+			rec.primitive = idx;
+			return true;
+		}
+		inline bool isNodeVisible(const BVHNode* node, uint8_t rayType) const {
+			return nodeMasks.empty() || (nodeMasks[node - nodePool.get()] & rayType);
+		}
 
 		std::vector<HittablePtr> hittables;
-		std::vector<int> hittableIdxs;
+		std::shared_ptr<TriangleMesh> mesh; // Set instead of hittables for triangle meshes
+		std::shared_ptr<CurveMesh> curveMesh; // Set instead of hittables for curves
+		std::vector<AABB> curveBounds; // Bounds of the curve segments, only kept while building
+		MappedArray<int> hittableIdxs; // Primitives in leaf order, one per primitive
+		std::vector<uint8_t> nodeMasks; // Only filled for top level BVHs, one visibility mask per node of the pool
+		// Only filled for triangle meshes and sets of curves: the primitives of each leaf packed for the SIMD
+		// kernels. leafBlocks maps the first primitive of a leaf to its first block.
+		MappedArray<TriangleBlock> triangleBlocks;
+		MappedArray<CurveBlock> curveBlocks;
+		MappedArray<int> leafBlocks;
+		size_t nTriangleBlocks = 0;
+		size_t nCurveBlocks = 0;
+
+		// Top level BVHs only
+		bool isTopLevel = false;
+		std::vector<std::shared_ptr<BVH>> instanced;
+		std::vector<BVHInstance> instances;
+		std::vector<Animation> animations;
+		std::vector<int> nodeParents; // Parent of each node of the pool, -1 for the root
+		std::vector<int> instanceNodes; // Leaf holding each instance
+		std::vector<int> movedInstances;
+		float treeArea; // Sum of the surface areas of the inner nodes
+		float builtCost; // treeCost() right after the last full build
+		// Refitting only keeps the moved instances' ancestors tight; once the tree is this much worse
+		// than when it was built, it's cheaper to rebuild it than to keep traversing it.
+		static constexpr float maxRefitDegradation = 1.5f;
+		// Below this many rays a packet is split and the rest of the subtree traced ray by ray
+		static constexpr int minPacketRays = 4;
+		static constexpr size_t maxFrustumNodes = 16;
 
-		BVHNode* nodePool;
+		MappedArray<BVHNode> nodePool;
 		BVHNode* root;
 		size_t poolPtr;
 		float surfaceArea;
 		bool isCollapsed = false;
+		std::vector<CompressedBVHNode> compressedNodes; // Root first; only filled by compressNodes
+		bool changed = false;
+		uint8_t visibility = RAY_ALL;
 
 		Heuristic heuristic;
+		SAHCost sahCost;
 		bool animate;
 		bool mustRefit;
 		int refitCounter;
@@ -45,9 +45,27 @@ Ray Camera::generateCameraRay(float u, float v) {
 	}
 
 	Ray ray(this->position, rayDir);
+	ray.setType(RAY_CAMERA);
 	return ray;
 }
 
+Frustum Camera::getFrustum(float u0, float v0, float u1, float v1) const {
+	const glm::fvec3 corners[4] = {
+		this->llCorner + u0 * this->horizontal + v0 * this->vertical - this->position,
+		this->llCorner + u1 * this->horizontal + v0 * this->vertical - this->position,
+		this->llCorner + u1 * this->horizontal + v1 * this->vertical - this->position,
+		this->llCorner + u0 * this->horizontal + v1 * this->vertical - this->position
+	};
+	const glm::fvec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+	Frustum frustum;
+	frustum.origin = this->position;
+	for (int i = 0; i < 4; ++i) {
+		glm::fvec3 normal = glm::cross(corners[i], corners[(i + 1) % 4]);
+		frustum.normals[i] = glm::dot(normal, center) < 0.0f ? -normal : normal;
+	}
+	return frustum;
+}
+
 void Camera::setPosition(glm::fvec3 pos) {
 	this->position = pos;
 	this->updateVectors();
@@ -3,6 +3,7 @@
 
 #include "glm/vec3.hpp"
 #include "ray.hpp"
+#include "defs.hpp"
 
 #include <memory>
 
@@ -16,6 +17,8 @@ class Camera{
 	public:
 		Camera(glm::fvec3 origin, glm::fvec3 dir, glm::fvec3 up, float fov);
 		Ray generateCameraRay(float u, float v);
+		// Frustum of the normal camera rays with u in [u0, u1] and v in [v0, v1]
+		Frustum getFrustum(float u0, float v0, float u1, float v1) const;
 
 		void setPosition(glm::fvec3 pos);
 		void setDirection(glm::fvec3 dir, bool update = true);
@@ -29,6 +32,7 @@ class Camera{
 		inline float getSensitivity() const { return this->sensitivity; };
 		inline glm::fvec3 getPosition() const { return position; }
 		inline glm::fvec3 getDirection() const { return direction; }
+		inline CameraType getCameraType() const { return cameraType; }
 		bool update(float dt, bool forceUpdate = false);
 
 		glm::fvec2 Distort(float u, float v);
@@ -0,0 +1,47 @@
+#include "chunk_cache.hpp"
+#include "hittables/streamed_chunk.hpp"
+
+#include <algorithm>
+
+namespace Streaming {
+	ChunkCache cache;
+};
+
+void ChunkCache::loaded(const StreamedChunk* chunk) {
+	std::lock_guard<std::mutex> lock(mutex);
+	chunk->touch(++clock);
+	++loads;
+	resident.push_back(chunk);
+	bytes += chunk->size();
+	if (bytes <= budget) return;
+
+	// Rays keep touching the chunks without the lock: sort a snapshot of their last use
+	std::vector<std::pair<uint64_t, const StreamedChunk*>> byUse;
+	byUse.reserve(resident.size());
+	for (auto c : resident) {
+		byUse.emplace_back(c->lastUse(), c);
+	}
+	std::sort(byUse.begin(), byUse.end(), [](const std::pair<uint64_t, const StreamedChunk*>& a, const std::pair<uint64_t, const StreamedChunk*>& b) {
+		return a.first < b.first;
+	});
+	size_t kept = 0;
+	for (auto& use : byUse) {
+		const StreamedChunk* c = use.second;
+		// The chunk just loaded is kept even if it's bigger than the budget on its own
+		if (bytes > budget && c != chunk && c->evict()) {
+			bytes -= c->size();
+			++evictions;
+		} else {
+			resident[kept++] = c;
+		}
+	}
+	resident.resize(kept);
+}
+
+void ChunkCache::remove(const StreamedChunk* chunk) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = std::find(resident.begin(), resident.end(), chunk);
+	if (it == resident.end()) return;
+	bytes -= chunk->size();
+	resident.erase(it);
+}
@@ -0,0 +1,55 @@
+#ifndef __CHUNK_CACHE_HPP__
+#define __CHUNK_CACHE_HPP__
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class StreamedChunk;
+
+// Keeps the mapped size of the streamed chunks (see MeshStream) under a budget, evicting the least
+// recently used ones that no ray is traversing. Recency is measured in loads: the clock only ticks when
+// a chunk is loaded, so that using a chunk only writes to it when it wasn't used since the last load.
+class ChunkCache {
+	public:
+		inline void setBudget(size_t bytes) {
+			std::lock_guard<std::mutex> lock(mutex);
+			budget = bytes;
+		}
+		inline uint64_t now() const {
+			return clock.load(std::memory_order_relaxed);
+		}
+		// Called by a chunk once it has been loaded. Evicts other chunks while over the budget; chunks that
+		// are in use stay, so the budget can be exceeded by the chunks traversed at the same time.
+		void loaded(const StreamedChunk* chunk);
+		// Called by a chunk that is destroyed
+		void remove(const StreamedChunk* chunk);
+
+		inline size_t residentBytes() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return bytes;
+		}
+		inline size_t loadCount() const {
+			return loads.load(std::memory_order_relaxed);
+		}
+		inline size_t evictionCount() const {
+			return evictions.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<const StreamedChunk*> resident;
+		size_t budget = size_t(4096) << 20;
+		size_t bytes = 0;
+		std::atomic<uint64_t> clock{0};
+		std::atomic<size_t> loads{0};
+		std::atomic<size_t> evictions{0};
+};
+
+namespace Streaming {
+	extern ChunkCache cache;
+};
+
+#endif
@@ -5,47 +5,86 @@ namespace Core {
 		return Color{0,0,0};
 	}
 
-	Color traceWhitted(Ray &ray, int bounces, ScenePtr scene, uint32_t &rng) {
+	Color traceWhitted(Ray &ray, int bounces, ScenePtr scene, uint32_t &rng, const std::vector<BVHNode*> *startNodes) {
 		HitRecord hr;
 		hr.p = {INF, INF, INF};
 		if(!scene || bounces <= 0)
 			return Color{1,1,1};
-		if (scene->traverse(ray, 0.001f, INF, hr)) {
-			Ray reflectedRay;
-			MaterialPtr mat = scene->getMaterial(hr.material);
-			Color attenuation = scene->getTextureColor(mat->getAlbedoIdx(), hr.u, hr.v, hr.p);
-			float reflectance = 1.0f;
-
-			if (mat->getType() == Materials::DIFFUSE) {
-				return attenuation * scene->traceLights(hr);
-			} else if (mat->getType() == Materials::MIRROR) {
-
-				mat->reflect(ray, hr, reflectedRay, reflectance);
-				if (reflectance == 1.0f)
-					return attenuation * (Core::traceWhitted(reflectedRay, bounces - 1, scene, rng));
-				else
-					return attenuation * (reflectance * Core::traceWhitted(reflectedRay, bounces - 1, scene, rng) + (1.0f - reflectance) * scene->traceLights(hr));
-			} else if(mat->getType() == Materials::DIELECTRIC) {
-
-				Color refractionColor(0.0f);
-				Color reflectionColor(0.0f);
-				float reflectance;
-				mat->reflect(ray, hr, reflectedRay, reflectance);
-				reflectionColor = Core::traceWhitted(reflectedRay, bounces - 1, scene, rng);
-
-				if(reflectance < 1.0f){
-					Ray refractedRay;
-					float refractance;
-					mat->refract(ray, hr, refractedRay, refractance);
-					refractionColor = Core::traceWhitted(refractedRay, bounces-1, scene, rng);
-				}
-
-				mat->absorb(ray, hr, attenuation);
-
-				return attenuation * (reflectionColor * reflectance + refractionColor * (1 - reflectance));
-			}
-			return Color{1,1,1};
+		if (scene->traverse(ray, 0.001f, INF, hr, startNodes)) {
+			return shadeWhitted(ray, hr, bounces, scene, rng);
 		}
 		return Color(1,1,1);
 	}
+
+	void traceWhittedPacket(RayPacket &packet, uint64_t mask, int bounces, ScenePtr scene, uint32_t &rng, Color *colors, const std::vector<BVHNode*> *startNodes) {
+		for (int i = 0; i < packet.size; ++i) {
+			colors[i] = Color(1, 1, 1);
+		}
+		if(!scene || bounces <= 0)
+			return;
+
+		HitRecord hrs[RayPacket::maxSize];
+		uint64_t hits = scene->traversePacket(packet, mask, 0.001f, hrs, startNodes);
+		// Diffuse hits only need shadow rays, which are as coherent as the primary ones: trace them together
+		uint64_t diffuse = 0;
+		for (int i = 0; i < packet.size; ++i) {
+			if (!(hits & (1ull << i))) continue;
+			if (scene->getMaterial(hrs[i].material)->getType() == Materials::DIFFUSE) {
+				diffuse |= 1ull << i;
+			} else {
+				colors[i] = shadeWhitted(packet.rays[i], hrs[i], bounces, scene, rng);
+			}
+		}
+		if (diffuse == 0)
+			return;
+
+		Color illumination[RayPacket::maxSize];
+		scene->traceLightsPacket(hrs, diffuse, packet.size, illumination);
+		for (int i = 0; i < packet.size; ++i) {
+			if (!(diffuse & (1ull << i))) continue;
+			MaterialPtr mat = scene->getMaterial(hrs[i].material);
+			Color attenuation = scene->getTextureColor(mat->getAlbedoIdx(), hrs[i].u, hrs[i].v, hrs[i].p);
+			colors[i] = attenuation * illumination[i];
+		}
+	}
+
+	Color shadeWhitted(Ray &ray, HitRecord &hr, int bounces, ScenePtr scene, uint32_t &rng) {
+		Ray reflectedRay;
+		MaterialPtr mat = scene->getMaterial(hr.material);
+		Color attenuation = scene->getTextureColor(mat->getAlbedoIdx(), hr.u, hr.v, hr.p);
+		float reflectance = 1.0f;
+
+		if (mat->getType() == Materials::DIFFUSE) {
+			return attenuation * scene->traceLights(hr);
+		} else if (mat->getType() == Materials::MIRROR) {
+
+			mat->reflect(ray, hr, reflectedRay, reflectance);
+			reflectedRay.setType(RAY_REFLECTION);
+			if (reflectance == 1.0f)
+				return attenuation * (Core::traceWhitted(reflectedRay, bounces - 1, scene, rng));
+			else
+				return attenuation * (reflectance * Core::traceWhitted(reflectedRay, bounces - 1, scene, rng) + (1.0f - reflectance) * scene->traceLights(hr));
+		} else if(mat->getType() == Materials::DIELECTRIC) {
+
+			Color refractionColor(0.0f);
+			Color reflectionColor(0.0f);
+			float reflectance;
+			mat->reflect(ray, hr, reflectedRay, reflectance);
+			reflectedRay.setType(RAY_REFLECTION);
+			reflectionColor = Core::traceWhitted(reflectedRay, bounces - 1, scene, rng);
+
+			if(reflectance < 1.0f){
+				Ray refractedRay;
+				float refractance;
+				mat->refract(ray, hr, refractedRay, refractance);
+				refractedRay.setType(RAY_REFLECTION);
+				refractionColor = Core::traceWhitted(refractedRay, bounces-1, scene, rng);
+			}
+
+			mat->absorb(ray, hr, attenuation);
+
+			return attenuation * (reflectionColor * reflectance + refractionColor * (1 - reflectance));
+		}
+		return Color{1,1,1};
+	}
 };
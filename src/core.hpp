@@ -10,7 +10,12 @@ enum class CoreType {
 };
 
 namespace Core {
-	Color traceWhitted(Ray &ray, int bounces, ScenePtr scene, uint32_t &rng);
+	// startNodes: for camera rays, the nodes found by Scene::cullFrustum for a frustum containing the ray
+	Color traceWhitted(Ray &ray, int bounces, ScenePtr scene, uint32_t &rng, const std::vector<BVHNode*> *startNodes = nullptr);
+	// Shading of a hit found by traceWhitted
+	Color shadeWhitted(Ray &ray, HitRecord &hr, int bounces, ScenePtr scene, uint32_t &rng);
+	// traceWhitted for the rays of mask, traced as a packet; colors are written for every ray of the packet
+	void traceWhittedPacket(RayPacket &packet, uint64_t mask, int bounces, ScenePtr scene, uint32_t &rng, Color *colors, const std::vector<BVHNode*> *startNodes = nullptr);
 	Color tracePath(Ray &ray, int bounces, ScenePtr scene, uint32_t &rng);
 };
 
@@ -80,6 +80,20 @@ bool overlaps(AABB& b1, AABB& b2) {
 	bool z = (b1.maxZ >= b2.minZ) && (b1.minZ <= b2.maxZ);
 	return (x && y && z);
 }
+
+bool overlapsFrustum(const Frustum& frustum, const glm::fvec4& minAABB, const glm::fvec4& maxAABB) {
+	for (int i = 0; i < 4; ++i) {
+		const glm::fvec3& n = frustum.normals[i];
+		// The box corner furthest along the normal; if it is outside the plane, the whole box is
+		const glm::fvec3 corner = {
+			n.x >= 0.0f ? maxAABB.x : minAABB.x,
+			n.y >= 0.0f ? maxAABB.y : minAABB.y,
+			n.z >= 0.0f ? maxAABB.z : minAABB.z
+		};
+		if (glm::dot(n, corner - frustum.origin) < 0.0f) return false;
+	}
+	return true;
+}
 void CoordinateSystem(const glm::fvec3 &v1, glm::fvec3 *v2, glm::fvec3 *v3){
 	if (std::abs(v1.x) > std::abs(v1.y))
 		*v2 = glm::fvec3(-v1.z, 0, v1.x) /
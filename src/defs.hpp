@@ -21,6 +21,7 @@ const float EPS = std::numeric_limits<float>::epsilon();
 
 typedef glm::fvec3 Color;
 class Material;
+class Hittable;
 
 struct AABB {
 	float minX;
@@ -31,6 +32,13 @@ struct AABB {
 	float maxZ;
 };
 
+// Pyramid of the rays leaving origin through a screen region: four planes through origin with
+// normals pointing inside
+struct Frustum {
+	glm::fvec3 origin;
+	glm::fvec3 normals[4];
+};
+
 struct HitRecord {
 	bool frontFace;
 	int material;
@@ -39,6 +47,11 @@ struct HitRecord {
 	float t = INF;
 	glm::fvec3 p = glm::fvec3(INF, INF, INF);
 	glm::fvec3 normal;
+	// Set by primitives that only store t and barycentrics in (u, v) while the BVH is traversed.
+	// The owning BVH asks it for the rest of the attributes once the closest hit is known.
+	const Hittable* object = nullptr;
+	// Which of the primitives of object, for objects that store several without a Hittable each
+	int primitive = -1;
 
 	inline void setFaceNormal(const Ray& r, const glm::fvec3& outNormal) {
 		frontFace = dot(r.getDirection(), outNormal) < 0;
@@ -67,6 +80,9 @@ void expandBBox(AABB& bbox, glm::vec3 expandDimensions);
 
 bool overlaps(AABB& b1, AABB& b2);
 
+// Conservative: boxes close to the frustum edges may overlap it without being inside any of its rays
+bool overlapsFrustum(const Frustum& frustum, const glm::fvec4& minAABB, const glm::fvec4& maxAABB);
+
 namespace Random {
 	uint32_t xorshift32( uint32_t& state );
 	float RandomFloat( uint32_t& s ) ;
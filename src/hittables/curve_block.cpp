@@ -0,0 +1,296 @@
+#include "hittables/curve_block.hpp"
+
+void setCurveBlockLane(CurveBlock& block, int lane, int primitive, const CurveMesh& curves) {
+	if (primitive < 0) {
+		for (int k = 0; k < 3; ++k) {
+			block.p0[k][lane] = block.a[k][lane] = block.b[k][lane] = block.c[k][lane] = 0.0f;
+			block.axis[k][lane] = block.oe[k][lane] = 0.0f;
+		}
+		block.width0[lane] = block.width1[lane] = 0.0f;
+		block.radius[lane] = -1.0f;
+		block.materials[lane] = -1;
+		block.primitives[lane] = -1;
+		return;
+	}
+	glm::fvec3 cp[4];
+	curves.getControlPoints(primitive, cp);
+	const Cylinder cylinder = curves.getEnclosingCylinder(primitive);
+	// B'(t) = (a t + b) t + c
+	const glm::fvec3 d[3] = {
+		3.0f * (cp[3] - 3.0f * cp[2] + 3.0f * cp[1] - cp[0]),
+		6.0f * (cp[2] - 2.0f * cp[1] + cp[0]),
+		3.0f * (cp[1] - cp[0])
+	};
+	for (int k = 0; k < 3; ++k) {
+		block.p0[k][lane] = cp[0][k];
+		block.a[k][lane] = d[0][k];
+		block.b[k][lane] = d[1][k];
+		block.c[k][lane] = d[2][k];
+		block.axis[k][lane] = cylinder.axis[k];
+		block.oe[k][lane] = cylinder.oe[k];
+	}
+	curves.getWidths(primitive, block.width0[lane], block.width1[lane]);
+	block.radius[lane] = cylinder.radiusMax + cylinder.de;
+	block.materials[lane] = curves.getMaterial();
+	block.primitives[lane] = primitive;
+}
+
+void fitCurveBlockBox(CurveBlock& block, const CurveMesh& curves) {
+	glm::fvec3 points[4 * CURVE_BLOCK_LANES];
+	float radii[4 * CURVE_BLOCK_LANES];
+	int nPoints = 0;
+	glm::fvec3 u(0.0f);
+	for (int lane = 0; lane < CURVE_BLOCK_LANES; ++lane) {
+		if (block.primitives[lane] < 0) continue;
+		glm::fvec3 cp[4];
+		curves.getControlPoints(block.primitives[lane], cp);
+		const float radius = max(block.width0[lane], block.width1[lane]) * 0.5f;
+		for (int i = 0; i < 4; ++i, ++nPoints) {
+			points[nPoints] = cp[i];
+			radii[nPoints] = radius;
+		}
+		// Segments running the other way still share the axis
+		glm::fvec3 axis = cp[3] - cp[0];
+		u += glm::dot(axis, u) < 0.0f ? -axis : axis;
+	}
+	u = glm::length(u) > 0.0f ? glm::normalize(u) : glm::fvec3(0, 1, 0);
+	const glm::fvec3 v0 = glm::normalize(glm::cross(u, std::fabs(u.x) < 0.5f ? glm::fvec3(1, 0, 0) : glm::fvec3(0, 1, 0)));
+	const glm::fvec3 w0 = glm::cross(u, v0);
+
+	// The strands of a leaf are roughly parallel, but their cross section isn't round: try a few rotations
+	// around the axis and keep the smallest box
+	auto extents = [&](const glm::fvec3& axis, float& lo, float& hi) {
+		lo = INF;
+		hi = -INF;
+		for (int i = 0; i < nPoints; ++i) {
+			float d = glm::dot(points[i], axis);
+			lo = min(lo, d - radii[i]);
+			hi = max(hi, d + radii[i]);
+		}
+	};
+	float uLo, uHi;
+	extents(u, uLo, uHi);
+	float bestArea = INF;
+	for (int r = 0; r < 8; ++r) {
+		const float angle = r * (PI / 16.0f);
+		const glm::fvec3 v = v0 * std::cos(angle) + w0 * std::sin(angle);
+		const glm::fvec3 w = glm::cross(u, v);
+		float lo[3] = { uLo, 0, 0 };
+		float hi[3] = { uHi, 0, 0 };
+		extents(v, lo[1], hi[1]);
+		extents(w, lo[2], hi[2]);
+		const float eu = hi[0] - lo[0];
+		const float ev = hi[1] - lo[1];
+		const float ew = hi[2] - lo[2];
+		const float area = eu * ev + ev * ew + ew * eu;
+		if (area >= bestArea) continue;
+		bestArea = area;
+		const glm::fvec3 axes[3] = { u, v, w };
+		for (int k = 0; k < 3; ++k) {
+			for (int j = 0; j < 3; ++j) block.boxAxes[k][j] = axes[k][j];
+			block.boxCenter[k] = (lo[k] + hi[k]) * 0.5f;
+			block.boxHalf[k] = (hi[k] - lo[k]) * 0.5f;
+		}
+	}
+}
+
+#if defined(SIMD_ENABLED)
+
+using namespace simd;
+
+namespace {
+	bool hitBox(const CurveBlock& block, const glm::fvec3& origin, const glm::fvec3& direction, float tMin, float tMax) {
+		for (int k = 0; k < 3; ++k) {
+			const glm::fvec3 axis(block.boxAxes[k][0], block.boxAxes[k][1], block.boxAxes[k][2]);
+			const float o = glm::dot(axis, origin) - block.boxCenter[k];
+			const float d = glm::dot(axis, direction);
+			if (std::fabs(d) < 1e-12f) {
+				if (std::fabs(o) > block.boxHalf[k]) return false;
+				continue;
+			}
+			const float inv = 1.0f / d;
+			const float t1 = (-block.boxHalf[k] - o) * inv;
+			const float t2 = (block.boxHalf[k] - o) * inv;
+			tMin = max(tMin, min(t1, t2));
+			tMax = min(tMax, max(t1, t2));
+			if (tMin > tMax) return false;
+		}
+		return true;
+	}
+
+	struct vvec3 {
+		vfloat x, y, z;
+	};
+
+	inline vvec3 vload3(const float a[3][CURVE_BLOCK_LANES]) {
+		return { vload(a[0]), vload(a[1]), vload(a[2]) };
+	}
+
+	// Components of v along the axes of the ray frame
+	inline vvec3 toRay(const vvec3& v, const glm::fvec3 frame[3]) {
+		vvec3 r;
+		vfloat* out[3] = { &r.x, &r.y, &r.z };
+		for (int k = 0; k < 3; ++k) {
+			*out[k] = vdot(v.x, v.y, v.z, vset(frame[k].x), vset(frame[k].y), vset(frame[k].z));
+		}
+		return r;
+	}
+}
+
+bool hitCurveBlock(const CurveBlock& block, const Ray& ray, float tMin, float tMax, HitRecord& rec) {
+	const glm::fvec3 origin = ray.getOrigin();
+	const glm::fvec3 direction = ray.getDirection();
+	if (!hitBox(block, origin, direction, tMin, tMax)) return false;
+	const vfloat zero = vset(0.0f);
+	const vfloat one = vset(1.0f);
+
+	// Enclosing cylinders: the distance between the ray and the axis must be within the radius
+	const vfloat dx = vset(direction.x);
+	const vfloat dy = vset(direction.y);
+	const vfloat dz = vset(direction.z);
+	const vvec3 axis = vload3(block.axis);
+	const vfloat nx = vsub(vmul(dy, axis.z), vmul(dz, axis.y));
+	const vfloat ny = vsub(vmul(dz, axis.x), vmul(dx, axis.z));
+	const vfloat nz = vsub(vmul(dx, axis.y), vmul(dy, axis.x));
+	const vfloat ox = vsub(vset(origin.x), vload(block.oe[0]));
+	const vfloat oy = vsub(vset(origin.y), vload(block.oe[1]));
+	const vfloat oz = vsub(vset(origin.z), vload(block.oe[2]));
+	const vfloat dist = vdot(ox, oy, oz, nx, ny, nz);
+	const vfloat radius = vload(block.radius);
+	const vfloat active = vand(vge(radius, zero),
+			vle(vmul(dist, dist), vmul(vmul(radius, radius), vdot(nx, ny, nz, nx, ny, nz))));
+	if (vmask(active) == 0) return false;
+
+	// The cone tests only depend on distances to the ray, so all the lanes share one ray centric frame
+	const float length = glm::length(direction);
+	const glm::fvec3 rz = direction / length;
+	const glm::fvec3 rx = glm::normalize(glm::cross(rz, std::fabs(rz.x) > 0.9f ? glm::fvec3(0, 1, 0) : glm::fvec3(1, 0, 0)));
+	const glm::fvec3 frame[3] = { rx, glm::cross(rz, rx), rz };
+
+	const vvec3 p0 = vload3(block.p0);
+	const vvec3 rayP0 = toRay({ vsub(p0.x, vset(origin.x)), vsub(p0.y, vset(origin.y)), vsub(p0.z, vset(origin.z)) }, frame);
+	const vvec3 rayA = toRay(vload3(block.a), frame);
+	const vvec3 rayB = toRay(vload3(block.b), frame);
+	const vvec3 rayC = toRay(vload3(block.c), frame);
+	// B(t) = p0 + ((a/3 t + b/2) t + c) t
+	const vvec3 rayA3 = { vmul(rayA.x, vset(1.0f / 3.0f)), vmul(rayA.y, vset(1.0f / 3.0f)), vmul(rayA.z, vset(1.0f / 3.0f)) };
+	const vvec3 rayB2 = { vmul(rayB.x, vset(0.5f)), vmul(rayB.y, vset(0.5f)), vmul(rayB.z, vset(0.5f)) };
+
+	const vfloat width0 = vload(block.width0);
+	const vfloat widthDelta = vsub(vload(block.width1), width0);
+	// Start from the end of the segment closer to the ray origin
+	vfloat tStart = vselect(vgt(vdot(axis.x, axis.y, axis.z, dx, dy, dz), zero), zero, one);
+	const vfloat slant = vselect(veq(tStart, zero), widthDelta, vsub(zero, widthDelta));
+	const vfloat invLength = vset(1.0f / length);
+	const vfloat vtMin = vset(tMin);
+	const vfloat vtMax = vset(tMax);
+
+	vfloat found = zero; // Lanes with a hit
+	vfloat capHit = zero; // Lanes hit on the plane of an end rather than on the tube
+	vfloat hitT = zero;
+	vfloat hitU = zero;
+	for (int side = 0; side < 2; ++side) {
+		vfloat lanes = vandnot(found, active); // Lanes still iterating
+		if (vmask(lanes) == 0) break;
+		vfloat t = tStart;
+		vfloat tOld = zero;
+		vfloat dt1 = zero;
+		vfloat dt2 = zero;
+
+		for (int iter = 0; iter < 40; ++iter) {
+			const vfloat c0x = vadd(rayP0.x, vmul(vadd(vmul(vadd(vmul(rayA3.x, t), rayB2.x), t), rayC.x), t));
+			const vfloat c0y = vadd(rayP0.y, vmul(vadd(vmul(vadd(vmul(rayA3.y, t), rayB2.y), t), rayC.y), t));
+			const vfloat c0z = vadd(rayP0.z, vmul(vadd(vmul(vadd(vmul(rayA3.z, t), rayB2.z), t), rayC.z), t));
+			const vfloat cdx = vadd(vmul(vadd(vmul(rayA.x, t), rayB.x), t), rayC.x);
+			const vfloat cdy = vadd(vmul(vadd(vmul(rayA.y, t), rayB.y), t), rayC.y);
+			const vfloat cdz = vadd(vmul(vadd(vmul(rayA.z, t), rayB.z), t), rayC.z);
+			const vfloat rad = vmul(vadd(width0, vmul(widthDelta, t)), vset(0.5f));
+
+			// RayConeIntersection::intersect
+			const vfloat r2 = vmul(rad, rad);
+			const vfloat drr = vmul(rad, slant);
+			const vfloat cdd = vadd(vmul(c0x, cdx), vmul(c0y, cdy));
+			const vfloat cxd = vsub(vmul(c0x, cdy), vmul(c0y, cdx));
+			const vfloat c = vadd(vmul(cdx, cdx), vmul(cdy, cdy));
+			const vfloat b = vmul(cdz, vsub(drr, cdd));
+			const vfloat cdz2 = vmul(cdz, cdz);
+			const vfloat ddd = vadd(c, cdz2);
+			vfloat dp = vadd(vmul(c0x, c0x), vmul(c0y, c0y));
+			const vfloat a = vsub(vadd(vadd(vmul(vmul(vset(2.0f), drr), cdd), vmul(cxd, cxd)), vmul(dp, cdz2)), vmul(ddd, r2));
+			const vfloat det = vsub(vmul(b, b), vmul(a, c));
+			const vfloat s = vdiv(vsub(b, vsqrt(vmax(det, zero))), c);
+			vfloat dt = vdiv(vsub(vmul(s, cdz), cdd), ddd);
+			const vfloat sp = vdiv(cdd, cdz);
+			dp = vadd(dp, vmul(sp, sp));
+
+			// Converged on the tube
+			const vfloat converged = vand(lanes, vand(vgt(det, zero), vlt(vabs(dt), vset(5e-5f))));
+			const vfloat tubeT = vmul(vadd(s, c0z), invLength);
+			const vfloat tubeHit = vand(converged, vand(vge(tubeT, vtMin), vle(tubeT, vtMax)));
+			found = vor(found, tubeHit);
+			hitT = vselect(tubeHit, tubeT, hitT);
+			hitU = vselect(tubeHit, t, hitU);
+			lanes = vandnot(converged, lanes);
+
+			dt = vmax(vmin(dt, vset(0.5f)), vset(-0.5f));
+			dt1 = dt2;
+			dt2 = dt;
+			// Regula falsi once dt changes sign, bisection every 4th iteration
+			const vfloat next = (iter & 3) == 0 ?
+				vmul(vset(0.5f), vadd(t, tOld)) :
+				vdiv(vsub(vmul(dt2, tOld), vmul(dt1, t)), vsub(dt2, dt1));
+			const vfloat nextT = vselect(vlt(vmul(dt1, dt2), zero), next, vadd(t, dt));
+			tOld = t;
+			t = nextT;
+
+			// Left the segment: the ray may still hit the plane of the end
+			const vfloat left = vand(lanes, vor(vlt(t, zero), vgt(t, one)));
+			const vfloat capT = vmul(vadd(sp, c0z), invLength);
+			vfloat cap = vand(left, vlt(dp, r2));
+			cap = vand(cap, veq(tOld, vselect(vlt(cdz, zero), one, zero)));
+			cap = vand(cap, vand(vge(capT, vtMin), vle(capT, vtMax)));
+			found = vor(found, cap);
+			capHit = vor(capHit, cap);
+			hitT = vselect(cap, capT, hitT);
+			lanes = vandnot(left, lanes);
+			if (vmask(lanes) == 0) break;
+		}
+		tStart = vsub(one, tStart);
+	}
+
+	const int lanes = vmask(found);
+	if (lanes == 0) return false;
+
+	alignas(32) float ts[CURVE_BLOCK_LANES];
+	alignas(32) float us[CURVE_BLOCK_LANES];
+	vstore(ts, hitT);
+	vstore(us, hitU);
+	const int caps = vmask(capHit);
+	int best = -1;
+	float closest = tMax;
+	for (int i = 0; i < CURVE_BLOCK_LANES; ++i) {
+		if ((lanes & (1 << i)) && ts[i] <= closest) {
+			closest = ts[i];
+			best = i;
+		}
+	}
+	rec.t = ts[best];
+	rec.p = ray.at(rec.t);
+	rec.u = 0;
+	rec.v = 0;
+	if (caps & (1 << best)) {
+		rec.setFaceNormal(ray, -direction);
+	} else {
+		const float u = us[best];
+		glm::fvec3 curve;
+		for (int k = 0; k < 3; ++k) {
+			curve[k] = block.p0[k][best] + ((block.a[k][best] * (1.0f / 3.0f) * u + block.b[k][best] * 0.5f) * u + block.c[k][best]) * u;
+		}
+		rec.setFaceNormal(ray, rec.p - curve);
+	}
+	rec.material = block.materials[best];
+	rec.primitive = block.primitives[best];
+	return true;
+}
+
+#endif
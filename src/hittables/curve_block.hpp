@@ -0,0 +1,44 @@
+#ifndef __CURVE_BLOCK_HPP__
+#define __CURVE_BLOCK_HPP__
+
+#include "defs.hpp"
+#include "simd.hpp"
+#include "hittables/curve_mesh.hpp"
+
+#define CURVE_BLOCK_LANES SIMD_WIDTH
+
+// Up to CURVE_BLOCK_LANES curve segments of a BVH leaf in SoA form, run through the Phantom iteration
+// together. The arrays are indexed by axis, then lane. Each lane keeps the index of its segment among
+// the BVH primitives; unused lanes have a negative radius and index -1.
+struct alignas(32) CurveBlock {
+	float p0[3][CURVE_BLOCK_LANES];
+	float a[3][CURVE_BLOCK_LANES]; // B'(t) = (a t + b) t + c
+	float b[3][CURVE_BLOCK_LANES];
+	float c[3][CURVE_BLOCK_LANES];
+	float width0[CURVE_BLOCK_LANES];
+	float width1[CURVE_BLOCK_LANES];
+	float axis[3][CURVE_BLOCK_LANES]; // Enclosing cylinder
+	float oe[3][CURVE_BLOCK_LANES];
+	float radius[CURVE_BLOCK_LANES]; // radiusMax + de
+	int materials[CURVE_BLOCK_LANES];
+	int primitives[CURVE_BLOCK_LANES];
+	// Box around all the lanes, aligned to their mean axis: the rows of the rotation to the box frame,
+	// and the center and half extents of the box in that frame
+	float boxAxes[3][3];
+	float boxCenter[3];
+	float boxHalf[3];
+};
+
+// primitive is a segment of curves, -1 for unused lanes
+void setCurveBlockLane(CurveBlock& block, int lane, int primitive, const CurveMesh& curves);
+// Fits the oriented box of the block to the control points of the segments in its lanes
+void fitCurveBlockBox(CurveBlock& block, const CurveMesh& curves);
+
+#if defined(SIMD_ENABLED)
+// CurveMesh::hitPhantom against every lane of the block, with masks for the lanes that converged or left the
+// segment. Rays that miss the oriented box of the block don't reach the lanes. On a hit closer than tMax the
+// record is complete but for rec.object, which the BVH sets.
+bool hitCurveBlock(const CurveBlock& block, const Ray& ray, float tMin, float tMax, HitRecord& rec);
+#endif
+
+#endif
@@ -0,0 +1,444 @@
+﻿#include "hittables/curve_mesh.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+void CurveMesh::reserve(size_t nCurves, size_t nSegments) {
+	curves.reserve(nCurves);
+	segments.reserve(nSegments);
+}
+
+void CurveMesh::addCurve(const glm::fvec3 cp[4], float width0, float width1) {
+	curves.push_back({ { cp[0], cp[1], cp[2], cp[3] }, { width0, width1 } });
+}
+
+BezierCurve* CurveMesh::addCurves(size_t n) {
+	size_t first = curves.size();
+	curves.resize(first + n);
+	return curves.data() + first;
+}
+
+void CurveMesh::addSegment(uint32_t curve, float uMin, float uMax) {
+	if (curve >= curves.size() || !(uMin < uMax)) throw std::invalid_argument("Invalid curve segment");
+	segments.push_back({ curve, uMin, uMax });
+	segmentCache.clear();
+}
+
+void CurveMesh::split(int nSegments) {
+	segments.clear();
+	segmentCache.clear();
+	segments.reserve(curves.size() * nSegments);
+	float segmentSize = 1.0f / (float)nSegments;
+	for (uint32_t curve = 0; curve < curves.size(); ++curve) {
+		for (int j = 0; j < nSegments; j++) {
+			segments.push_back({ curve, j * segmentSize, min((j + 1) * segmentSize, 1.0f) });
+		}
+	}
+}
+
+void CurveMesh::splitAdaptive(float tolerance) {
+	segments.clear();
+	segmentCache.clear();
+	segments.reserve(curves.size());
+	for (uint32_t curve = 0; curve < curves.size(); ++curve) {
+		splitFlat(curve, curves[curve].p, 0.0f, 1.0f, tolerance, 0);
+	}
+}
+
+void CurveMesh::splitFlat(uint32_t curve, const glm::fvec3 cp[4], float uMin, float uMax, float tolerance, int depth) {
+	float L0 = 0;
+	for (int i = 0; i < 2; ++i) {
+		glm::fvec3 d = cp[i] - 2.0f * cp[i + 1] + cp[i + 2];
+		L0 = max(L0, max(max(fabsf(d.x), fabsf(d.y)), fabsf(d.z)));
+	}
+	const float* width = curves[curve].width;
+	float maxWidth = max(lerp(width[0], width[1], uMin), lerp(width[0], width[1], uMax));
+	if (depth == maxAdaptiveDepth || L0 <= tolerance * maxWidth) {
+		segments.push_back({ curve, uMin, uMax });
+		return;
+	}
+	// Each half has a quarter of the second differences
+	float uMid = 0.5f * (uMin + uMax);
+	glm::fvec3 cpSplit[7];
+	SubdivideBezier(cp, cpSplit);
+	splitFlat(curve, &cpSplit[0], uMin, uMid, tolerance, depth + 1);
+	splitFlat(curve, &cpSplit[3], uMid, uMax, tolerance, depth + 1);
+}
+
+void CurveMesh::cacheSegments() {
+	if (segmentCache.size() == segments.size()) return;
+	std::vector<SegmentCache> cache(segments.size());
+	for (size_t i = 0; i < segments.size(); ++i) {
+		getControlPoints(i, cache[i].cp);
+		cache[i].cylinder = getEnclosingCylinder(i);
+	}
+	segmentCache = std::move(cache);
+}
+
+void CurveMesh::clearSegmentCache() {
+	segmentCache.clear();
+	segmentCache.shrink_to_fit();
+}
+
+void CurveMesh::getControlPoints(size_t segment, glm::fvec3 cp[4]) const {
+	if (!segmentCache.empty()) {
+		std::copy(segmentCache[segment].cp, segmentCache[segment].cp + 4, cp);
+		return;
+	}
+	const CurveSegment& s = segments[segment];
+	const glm::fvec3* p = curves[s.curve].p;
+	cp[0] = BlossomBezier(p, s.uMin, s.uMin, s.uMin);
+	cp[1] = BlossomBezier(p, s.uMin, s.uMin, s.uMax);
+	cp[2] = BlossomBezier(p, s.uMin, s.uMax, s.uMax);
+	cp[3] = BlossomBezier(p, s.uMax, s.uMax, s.uMax);
+}
+
+void CurveMesh::getWidths(size_t segment, float& width0, float& width1) const {
+	const CurveSegment& s = segments[segment];
+	const float* width = curves[s.curve].width;
+	width0 = lerp(width[0], width[1], s.uMin);
+	width1 = lerp(width[0], width[1], s.uMax);
+}
+
+AABB CurveMesh::getBounds(size_t segment) const {
+	glm::fvec3 localCPts[4];
+	getControlPoints(segment, localCPts);
+	AABB bounds = { INF, INF, INF, -INF, -INF, -INF };
+	for (int i = 0; i < 4; i++) {
+		bounds.minX = min(bounds.minX, localCPts[i].x);
+		bounds.minY = min(bounds.minY, localCPts[i].y);
+		bounds.minZ = min(bounds.minZ, localCPts[i].z);
+		bounds.maxX = max(bounds.maxX, localCPts[i].x);
+		bounds.maxY = max(bounds.maxY, localCPts[i].y);
+		bounds.maxZ = max(bounds.maxZ, localCPts[i].z);
+	}
+	float localWidths[2];
+	getWidths(segment, localWidths[0], localWidths[1]);
+	expandBBox(bounds, glm::fvec3(max(localWidths[0], localWidths[1]) * 0.5f));
+	return bounds;
+}
+
+Cylinder CurveMesh::getEnclosingCylinder(size_t segment) const {
+	if (!segmentCache.empty()) return segmentCache[segment].cylinder;
+	glm::fvec3 localCPts[4];
+	getControlPoints(segment, localCPts);
+	float localWidths[2];
+	getWidths(segment, localWidths[0], localWidths[1]);
+
+	auto axisDir = localCPts[3] - localCPts[0]; /* Axis direction */
+	auto oe = ((localCPts[3] + localCPts[0])*0.5f
+			+ EvalBezier(localCPts, 0.5, nullptr)) * 0.5f; /* Cylinder passes through this point */
+	float rMax = max(localWidths[0] * 0.5f, localWidths[1] * 0.5f);  /* Radius of the cylinder */
+
+	// We should subdivide the curve a predefinite number of times;
+	glm::fvec3 cpSplit[7];
+	SubdivideBezier(localCPts, cpSplit);
+	float de = -INF;
+	const int ctrlPtsNo = 7;
+	for(int i = 0; i < ctrlPtsNo; ++i){
+		auto dist = glm::length(glm::cross(cpSplit[i] - localCPts[0], axisDir)) / glm::length(axisDir);
+		de = max(dist, de);
+	}
+
+	return Cylinder{
+		axisDir,
+		oe,
+		rMax,
+		de
+	};
+}
+
+glm::fvec3 BlossomBezier(const glm::fvec3 cPts[4], float u0, float u1, float u2) {
+	glm::fvec3 a[3] = { 
+		lerp(cPts[0], cPts[1], u0),
+		lerp(cPts[1], cPts[2], u0),
+		lerp(cPts[2], cPts[3], u0)
+	};
+
+	glm::fvec3 b[2] = {
+		lerp(a[0], a[1], u1),
+		lerp(a[1], a[2], u1) 
+	};
+
+	return lerp(b[0], b[1], u2);
+}
+
+bool CurveMesh::hit(size_t segment, const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+	return intersector == CurveIntersector::PBRT ?
+		hitPBRT(segment, ray, tMin, tMax, rec) :
+		hitPhantom(segment, ray, tMin, tMax, rec);
+}
+
+bool CurveMesh::hitPhantom(size_t segment, const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+	// Early check for enclosing cylinder
+	const Cylinder enclosingCylinder = getEnclosingCylinder(segment);
+	auto n = glm::cross(ray.getDirection(), enclosingCylinder.axis);
+	auto tmp = glm::dot(ray.getOrigin() - enclosingCylinder.oe, n);
+	auto tmpDist = enclosingCylinder.radiusMax + enclosingCylinder.de;
+	if ((tmp * tmp) / (glm::dot(n, n)) > tmpDist * tmpDist) return false;
+
+	glm::fvec3 cp[4];
+	getControlPoints(segment, cp);
+	const glm::fvec3 p0 = cp[0];
+	const glm::fvec3 p3 = cp[3];
+	// B'(t) = (a t + b) t + c
+	const glm::fvec3 d[3] = {
+		3.0f * (cp[3] - 3.0f * cp[2] + 3.0f * cp[1] - cp[0]),
+		6.0f * (cp[2] - 2.0f * cp[1] + cp[0]),
+		3.0f * (cp[1] - cp[0])
+	};
+
+	auto upVec = glm::normalize(glm::cross(p3, ray.getDirection()));
+	const auto objectToRay = glm::lookAt(ray.getOrigin(), ray.getOrigin() - ray.getDirection(), upVec);
+	const glm::mat3 rotation(objectToRay);
+
+	// B(t) = p0 + ((a/3 t + b/2) t + c) t, with the derivative coefficients in ray space
+	const glm::fvec3 rayP0 = objectToRay * glm::vec4(p0, 1);
+	const glm::fvec3 rayD[3] = { rotation * d[0], rotation * d[1], rotation * d[2] };
+	const glm::fvec3 rayA3 = rayD[0] * (1.0f / 3.0f);
+	const glm::fvec3 rayB2 = rayD[1] * 0.5f;
+
+	// Start from the end closer to the ray origin
+	float tStart = glm::dot(p3 - p0, ray.getDirection()) > 0.0f ? 0.0f : 1.0f;
+	bool hit = false;
+	float localWidths[2];
+	getWidths(segment, localWidths[0], localWidths[1]);
+	auto slant = tStart == 0.0f ? localWidths[1] - localWidths[0] : localWidths[0] - localWidths[1];
+
+	for (int side = 0; side < 2; ++side) {
+		float t = tStart;
+		float tOld = 0.0f;
+
+		RayConeIntersection inters;
+
+		float dt1 = 0.0f;
+		float dt2 = 0.0f;
+
+		/* Max number of iterations in the paper for a model was 36 */
+		for (int iter = 0; iter < 40; ++iter) {
+			inters.c0 = rayP0 + ((rayA3 * t + rayB2) * t + rayD[2]) * t;
+			inters.cd = (rayD[0] * t + rayD[1]) * t + rayD[2];
+			auto rad = lerp(localWidths[0], localWidths[1], t) * 0.5f;
+			bool realHit = inters.intersect(rad, slant);
+
+			if (realHit && fabsf(inters.dt) < 5e-5f) { /* Stops at 5e-5 as in the paper */
+				auto hitT = (inters.s + inters.c0.z) / glm::length(ray.getDirection());
+				if (hitT < tMin || hitT > tMax) {
+					break;
+				}
+				// Fill in hit struct and break;
+				rec.t = hitT;
+				rec.p = ray.at(rec.t);
+				rec.u = 0;
+				rec.v = 0;
+				rec.setFaceNormal(ray, rec.p - (p0 + ((d[0] * (1.0f / 3.0f) * t + d[1] * 0.5f) * t + d[2]) * t));
+				rec.material = mat;
+				hit = true;
+				break;
+			}
+
+			inters.dt = min(inters.dt, 0.5f); /* Clamp to 0.5 */
+			inters.dt = max(inters.dt, -0.5f); /* Clamp to -0.5 */
+
+			dt1 = dt2;
+			dt2 = inters.dt;
+
+			if (dt1 * dt2 < 0.0f) { /* Summon the ancient Babylonian gods */
+
+				float next = 0.0f;
+
+				if ((iter & 3) == 0) {
+					next = 0.5f * (t + tOld); /* Bisector method every 4th iteration */
+				} else {
+					next = (dt2 * tOld - dt1 * t) / (dt2 - dt1);
+				}
+				tOld = t;
+				t = next;
+			}
+			else { /* Use the dt computed by the intersection; */
+				tOld = t;
+				t = t + inters.dt;
+			}
+			if (t < 0.0f || t > 1.0f) {
+				if (inters.dp < rad*rad) {
+					// Only the cap of the end facing the ray: t = 1 when the curve runs against the ray, as in the SIMD kernel
+					const float capEnd = inters.cd.z < 0.0f ? 1.0f : 0.0f;
+					if (tOld == capEnd) {
+						auto hitT = (inters.sp + inters.c0.z) / glm::length(ray.getDirection());
+						if (hitT < tMin || hitT > tMax) {
+							break;
+						}
+
+						rec.t = hitT;
+						rec.p = ray.at(rec.t);
+						rec.u = 0;
+						rec.v = 0;
+						rec.setFaceNormal(ray, -ray.getDirection());
+						rec.material = mat;
+						hit = true;
+					}
+				}
+				break;
+			}
+		}
+		if (!hit) tStart = 1.0f - tStart;
+		else break;
+	}
+	return hit;
+}
+
+bool CurveMesh::hitPBRT(size_t segment, const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+	const CurveSegment& s = segments[segment];
+	const BezierCurve& curve = curves[s.curve];
+	glm::fvec3 localCPts[4];
+	getControlPoints(segment, localCPts);
+
+	// Ray space: the ray starts at the origin and goes along +z, z being the distance along it. The frame
+	// (Duff et al. 2017) is orthonormal, so going back to object space only takes its transpose.
+	const float rayLength = glm::length(ray.getDirection());
+	const glm::fvec3 frameZ = ray.getDirection() / rayLength;
+	const float sign = std::copysign(1.0f, frameZ.z);
+	const float a = -1.0f / (sign + frameZ.z);
+	const float b = frameZ.x * frameZ.y * a;
+	const glm::fvec3 frameX(1.0f + sign * frameZ.x * frameZ.x * a, sign * b, -sign * frameZ.x);
+	const glm::fvec3 frameY(b, sign + frameZ.y * frameZ.y * a, -frameZ.y);
+
+	struct Span {
+		glm::fvec3 cp[4];
+		float u0, u1;
+		float zMin;
+		int depth;
+	};
+	glm::fvec3 rayCPts[4];
+	for (int i = 0; i < 4; ++i) {
+		glm::fvec3 d = localCPts[i] - ray.getOrigin();
+		rayCPts[i] = glm::fvec3(glm::dot(d, frameX), glm::dot(d, frameY), glm::dot(d, frameZ));
+	}
+
+	// Depth first, so at most one span per level waits on the stack
+	Span stack[maxPBRTDepth + 1];
+	int top = 0;
+	// Spans whose bounds start past the closest hit found so far are skipped when they are popped
+	float zMax = rayLength * tMax;
+	bool hit = false;
+	float hitU = 0.0f, hitV = 0.0f;
+	glm::fvec3 hitNormal;
+	// Pushed only if its bounds overlap the ray, with the nearest bound in zMin
+	auto push = [&](const glm::fvec3* cp, float u0, float u1, int depth) {
+		float radius = 0.5f * max(lerp(curve.width[0], curve.width[1], u0), lerp(curve.width[0], curve.width[1], u1));
+		glm::fvec3 bMin = cp[0], bMax = cp[0];
+		for (int i = 1; i < 4; ++i) {
+			bMin = glm::min(bMin, cp[i]);
+			bMax = glm::max(bMax, cp[i]);
+		}
+		if (bMin.x - radius > 0.0f || bMax.x + radius < 0.0f || bMin.y - radius > 0.0f || bMax.y + radius < 0.0f ||
+				bMin.z - radius > zMax || bMax.z + radius < 0.0f) {
+			return;
+		}
+		Span& span = stack[top++];
+		std::copy(cp, cp + 4, span.cp);
+		span.u0 = u0;
+		span.u1 = u1;
+		span.zMin = bMin.z - radius;
+		span.depth = depth;
+	};
+
+	push(rayCPts, s.uMin, s.uMax, 0);
+	if (top == 0) return false;
+
+	float L0 = 0;
+	for (int i = 0; i < 2; ++i) {
+		glm::fvec3 d = rayCPts[i] - 2.0f * rayCPts[i + 1] + rayCPts[i + 2];
+		L0 = max(L0, max(max(fabsf(d.x), fabsf(d.y)), fabsf(d.z)));
+	}
+	float eps = max(curve.width[0], curve.width[1]) * .05f; // width / 20
+	float fr0 = L0 > 0.0f ? std::log(1.41421356237f * 12.f * L0 / (8.f * eps)) * 0.7213475108f : 0.0f; // log4
+	stack[0].depth = std::clamp((int)std::round(fr0), 0, maxPBRTDepth);
+
+	while (top > 0) {
+		const Span span = stack[--top];
+		if (span.zMin > zMax) continue;
+		const glm::fvec3* cPts = span.cp;
+
+		if (span.depth > 0) {
+			float uMid = 0.5f * (span.u0 + span.u1);
+			glm::fvec3 cpSplit[7];
+			SubdivideBezier(cPts, cpSplit);
+			// The nearer half is pushed last to be tested first
+			int first = top;
+			push(&cpSplit[0], span.u0, uMid, span.depth - 1);
+			push(&cpSplit[3], uMid, span.u1, span.depth - 1);
+			if (top - first == 2 && stack[top - 1].zMin > stack[top - 2].zMin) std::swap(stack[top - 1], stack[top - 2]);
+			continue;
+		}
+
+		float edge = (cPts[1].y - cPts[0].y) * -cPts[0].y +
+				cPts[0].x * (cPts[0].x - cPts[1].x);
+		if (edge < 0)
+			continue;
+
+		edge = (cPts[2].y - cPts[3].y) * -cPts[3].y +
+			cPts[3].x * (cPts[3].x - cPts[2].x);
+		if (edge < 0)
+			continue;
+
+		glm::fvec2 segmentDirection = glm::fvec2(cPts[3]) - glm::fvec2(cPts[0]);
+		float denom = glm::dot(segmentDirection, segmentDirection);
+		if (denom == 0)
+			continue;
+		float w = glm::dot(-glm::fvec2(cPts[0]), segmentDirection) / denom;
+
+		float u = std::clamp(lerp(span.u0, span.u1, w), span.u0, span.u1);
+		float hitWidth = lerp(curve.width[0], curve.width[1], u);
+
+		glm::fvec3 dpcdw;
+		glm::fvec3 pc = EvalBezier(cPts, std::clamp(w, 0.0f, 1.0f), &dpcdw);
+		float ptCurveDist2 = pc.x * pc.x + pc.y * pc.y;
+		if (ptCurveDist2 > hitWidth * hitWidth * .25f)
+			continue;
+		if (pc.z < 0 || pc.z > zMax || pc.z < tMin * rayLength)
+			continue;
+
+		float ptCurveDist = std::sqrt(ptCurveDist2);
+		float edgeFunc = dpcdw.x * -pc.y + pc.x * dpcdw.y;
+		hitV = (edgeFunc > 0) ? 0.5f + ptCurveDist / hitWidth :
+			0.5f - ptCurveDist / hitWidth;
+		hitU = u;
+		// Normal of the tube on the side facing the ray, without its component along the curve
+		glm::fvec3 n(-pc.x, -pc.y, -std::sqrt(max(hitWidth * hitWidth * .25f - ptCurveDist2, 0.0f)));
+		float tangentLength2 = glm::dot(dpcdw, dpcdw);
+		if (tangentLength2 > 0.0f) n -= dpcdw * (glm::dot(n, dpcdw) / tangentLength2);
+		hitNormal = n;
+		zMax = pc.z;
+		hit = true;
+	}
+
+	if (!hit) return false;
+	rec.t = zMax / rayLength;
+	rec.p = ray.at(rec.t);
+	rec.u = hitU;
+	rec.v = hitV;
+	glm::fvec3 normal = frameX * hitNormal.x + frameY * hitNormal.y + frameZ * hitNormal.z;
+	rec.setFaceNormal(ray, glm::dot(normal, normal) > 0.0f ? normal : -ray.getDirection());
+	rec.material = mat;
+	return true;
+}
+
+void SubdivideBezier(const glm::fvec3 cp[4], glm::fvec3 cpSplit[7]) {
+	cpSplit[0] = cp[0];
+	cpSplit[1] = (cp[0] + cp[1]) / 2.0f;
+	cpSplit[2] = (cp[0] + 2.0f * cp[1] + cp[2]) / 4.0f;
+	cpSplit[3] = (cp[0] + 3.0f * cp[1] + 3.0f * cp[2] + cp[3]) / 8.0f;
+	cpSplit[4] = (cp[1] + 2.0f * cp[2] + cp[3]) / 4.0f;
+	cpSplit[5] = (cp[2] + cp[3]) / 2.0f;
+	cpSplit[6] = cp[3];
+}
+
+glm::fvec3 EvalBezier(const glm::fvec3 cp[4], float u, glm::fvec3* deriv) {
+	glm::fvec3 cp1[3] = { lerp(cp[0], cp[1], u), lerp(cp[1], cp[2], u),
+					   lerp(cp[2], cp[3], u) };
+	glm::fvec3 cp2[2] = { lerp(cp1[0], cp1[1], u), lerp(cp1[1], cp1[2], u) };
+	if (deriv)
+		*deriv = 3.0f * (cp2[1] - cp2[0]);
+	return lerp(cp2[0], cp2[1], u);
+}
@@ -0,0 +1,170 @@
+﻿#ifndef __CURVE_MESH_HPP__
+#define __CURVE_MESH_HPP__
+
+#include "defs.hpp"
+
+#include <memory>
+#include <vector>
+
+struct Cylinder {
+	glm::fvec3 axis;
+	glm::fvec3 oe;
+	float radiusMax;
+	float de;
+};
+
+struct RayConeIntersection { // ray.o = {0,0,0}; ray.d = {0,0,1};
+	inline bool intersect(float r, float dr) {
+		// cone is defined by base center c0 , radius r ,
+		// axis cd , and slant dr
+		float r2 = r * r; // dr could be either positive
+		float drr = r * dr; // or negative (0 for cylinder)
+
+		float ddd 	= cd.x * cd.x + cd.y * cd.y; // all possible
+		dp 			= c0.x * c0.x + c0.y * c0.y; // combinations
+		float cdd 	= c0.x * cd.x + c0.y * cd.y; // of x∗y terms
+		float cxd 	= (c0.x * cd.y) - (c0.y * cd.x); // (c0 × cd)z
+
+		float c = ddd; // compute a, b, c in
+		float b = cd.z * (drr - cdd); // a − 2bs + cs2
+		float cdz2 = cd.z * cd.z; // (s for ray ∩ cone)
+		ddd += cdz2; // now it is cd·cd
+		float a = 2.0f * drr * cdd + cxd * cxd - ddd * r2 + dp * cdz2;
+#if defined(KEEP_DR2) // dr2 adjustments
+		float qs = (dr ∗ dr) / ddd; // ( it does not help
+		a − = qs ∗ cdd∗cdd; // much with neither
+		b − = qs ∗ cd.z ∗cdd; // performance nor
+		c − = qs ∗ cdz2; // accuracy )
+#endif
+
+// We will add c0.z to s and sp latter if needed
+		float det = b * b - a * c; // for a − 2bs + cs2
+		s = (b - (det > 0.0f ? sqrt(det) : 0.0f)) / c; // c > 0
+		dt = (s * cd.z - cdd) / ddd; // wrt t
+		dc = s * s + dp; // | (ray ∩ cone) − c0 | 2
+		sp = cdd / cd.z; // will add c0.z latter
+		dp += sp * sp; // | (ray ∩ plane) − c0 | 2
+
+		return det > 0.0f; // true (real) or false (phantom)
+	}
+
+	glm::fvec3 c0; // curve (t) in RCC (base center)
+	glm::fvec3 cd; // tangent (t) in RCC (cone's axis)
+	float s; // ray.s − c0.z for ray ∩ cone (t)
+	float dt; // dt to the (ray ∩ cone) from t
+	float dp; // | (ray ∩ plane (t)) − curve (t) | 2
+	float dc; // | (ray ∩ cone (t)) − curve (t) | 2
+	float sp; // ray.s − c0.z for ray ∩ plane (t)
+};
+
+
+// A cubic Bezier curve of a curve set, e.g. a span of a hair strand
+struct BezierCurve {
+	glm::fvec3 p[4];
+	float width[2];
+};
+
+// Leaves the elements added by resize uninitialized, so that whoever fills them touches their pages first
+template <typename T>
+struct DefaultInitAllocator : std::allocator<T> {
+	template <typename U> struct rebind { using other = DefaultInitAllocator<U>; };
+	using std::allocator<T>::allocator;
+	template <typename U> void construct(U* p) { ::new (static_cast<void*>(p)) U; }
+	template <typename U, typename... Args> void construct(U* p, Args&&... args) { ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+};
+
+enum class CurveIntersector {
+	PHANTOM, // Reshetov and Luebke 2018, run on the SIMD blocks of the BVH
+	PBRT // Recursive subdivision of pbrt, tested one segment at a time
+};
+
+// Part of a curve, from uMin to uMax, which is the BVH primitive
+struct CurveSegment {
+	uint32_t curve;
+	float uMin, uMax;
+};
+
+// Control points and enclosing cylinder of a segment, kept for the intersectors that test one segment at a time
+struct SegmentCache {
+	glm::fvec3 cp[4];
+	Cylinder cylinder;
+};
+
+// The curves of a hair asset stored once, contiguously, with their segments referenced by index: nothing is
+// stored per segment besides its curve and parameter range. The local control points of a segment are
+// derived when they are needed; the SIMD blocks of the BVH keep them for the hot path, and cacheSegments
+// for the scalar one.
+class CurveMesh {
+	public:
+		CurveMesh(int mat) : mat(mat) {}
+
+		void reserve(size_t nCurves, size_t nSegments);
+		// Curves have no segments until they are split
+		void addCurve(const glm::fvec3 cp[4], float width0, float width1);
+		// Appends n curves for the caller to fill, e.g. from several threads
+		BezierCurve* addCurves(size_t n);
+		void addSegment(uint32_t curve, float uMin, float uMax);
+		// Replace the segments of every curve with nSegments segments of the same parameter range
+		void split(int nSegments);
+		// Replace the segments of every curve by bisecting it until the control polygon of each segment is
+		// flat enough: its largest second difference, the L0 of hitPBRT, is at most tolerance times its width.
+		// Straight strands keep a single segment, curly ones get up to 2^maxAdaptiveDepth.
+		void splitAdaptive(float tolerance);
+
+		inline size_t curveCount() const {
+			return curves.size();
+		}
+		inline size_t segmentCount() const {
+			return segments.size();
+		}
+		inline const BezierCurve& getCurve(size_t c) const {
+			return curves[c];
+		}
+		inline const CurveSegment& getSegment(size_t s) const {
+			return segments[s];
+		}
+		inline int getMaterial() const {
+			return mat;
+		}
+		// Set before building the BVH: only the Phantom intersector is packed in SIMD blocks
+		inline void setIntersector(CurveIntersector i) {
+			intersector = i;
+		}
+		inline CurveIntersector getIntersector() const {
+			return intersector;
+		}
+
+		// Called by the BVH once the segments are final, when its leaves aren't packed in SIMD blocks: the scalar
+		// intersectors then read the control points and the cylinder of a segment instead of deriving them on
+		// every test. Changing the segments clears the cache.
+		void cacheSegments();
+		void clearSegmentCache();
+		void getControlPoints(size_t segment, glm::fvec3 cp[4]) const;
+		void getWidths(size_t segment, float& width0, float& width1) const;
+		AABB getBounds(size_t segment) const;
+		Cylinder getEnclosingCylinder(size_t segment) const;
+
+		bool hit(size_t segment, const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+		bool hitPBRT(size_t segment, const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+		bool hitPhantom(size_t segment, const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+
+		// The Phantom iteration evaluates the curve many times per ray: way more expensive than a triangle
+		static constexpr float intersectionCost = 8.0f;
+		static constexpr int maxAdaptiveDepth = 5;
+		static constexpr int maxPBRTDepth = 10;
+
+	private:
+		void splitFlat(uint32_t curve, const glm::fvec3 cp[4], float uMin, float uMax, float tolerance, int depth);
+
+		std::vector<BezierCurve, DefaultInitAllocator<BezierCurve>> curves;
+		std::vector<CurveSegment> segments;
+		std::vector<SegmentCache> segmentCache; // Empty, or one per segment
+		const int mat;
+		CurveIntersector intersector = CurveIntersector::PHANTOM;
+};
+
+glm::fvec3 BlossomBezier(const glm::fvec3 cPts[4], float u0, float u1, float u2);
+void SubdivideBezier(const glm::fvec3 cp[4], glm::fvec3 cpSplit[7]);
+glm::fvec3 EvalBezier(const glm::fvec3 cp[4], float u, glm::fvec3* deriv = nullptr);
+
+#endif // __CURVE_MESH_HPP__
@@ -13,8 +13,14 @@ public:
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const = 0;
 
+	// Completes a record left with rec.object == this by hit(), in the same space as ray
+	virtual void computeAttributes(const Ray& ray, HitRecord& rec) const {}
+
 	virtual bool update(float dt) { return false; }
 
+	// Bitmask of the RayType that can hit this object
+	virtual inline uint8_t getVisibility() const { return RAY_ALL; }
+
 	virtual inline void translate(glm::fvec3 t){}
 	virtual inline void scale(glm::fvec3 s){}
 	virtual inline void scale(float s){}
@@ -0,0 +1,70 @@
+#include "hittables/streamed_chunk.hpp"
+#include "chunk_cache.hpp"
+#include "mesh_file.hpp"
+
+#include <iostream>
+
+StreamedChunk::StreamedChunk(const std::filesystem::path& p, AABB bounds, size_t size, std::shared_ptr<const std::vector<int>> materials) :
+	Hittable(bounds), path(p), bytes(size), materials(std::move(materials)) {}
+
+StreamedChunk::~StreamedChunk() {
+	Streaming::cache.remove(this);
+}
+
+bool StreamedChunk::hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const {
+	if (failed.load(std::memory_order_relaxed)) return false;
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	// Another load can evict the chunk before the shared lock is taken again
+	while (!bvh) {
+		lock.unlock();
+		bool loaded = false;
+		{
+			std::unique_lock<std::shared_mutex> exclusive(mutex);
+			if (failed.load(std::memory_order_relaxed)) return false;
+			if (!bvh) {
+				bvh = load();
+				if (!bvh) {
+					failed.store(true, std::memory_order_relaxed);
+					return false;
+				}
+				loaded = true;
+			}
+		}
+		if (loaded) Streaming::cache.loaded(this);
+		lock.lock();
+	}
+	touch(Streaming::cache.now());
+	return bvh->hit(ray, tMin, tMax, rec);
+}
+
+bool StreamedChunk::evict() const {
+	std::unique_lock<std::shared_mutex> exclusive(mutex, std::try_to_lock);
+	if (!exclusive.owns_lock()) return false;
+	bvh.reset();
+	return true;
+}
+
+std::shared_ptr<BVH> StreamedChunk::load() const {
+	try {
+		// The index checked the header and the material ranges of the chunk: only check that the file is still the
+		// one it read, rather than reading it again at every load
+		auto file = MappedFile::open(path);
+		if (file->size() != bytes) throw std::invalid_argument(path.string() + " changed since the index was read");
+		const auto& header = MeshFile::getHeader(*file);
+		MeshFile::checkHeader(header, file->size(), path.string());
+		if (header.nTriangles == 0) throw std::invalid_argument(path.string() + " has no triangles");
+		auto mesh = MeshFile::loadTriangleMesh(file, path.stem().string());
+		auto ranges = MeshFile::getSection<MeshFile::MaterialRange>(file, MeshFile::MATERIAL_RANGES);
+		for (uint32_t i = 0; i < header.nMaterialRanges; ++i) {
+			if (ranges[i].material < 0 || ranges[i].material >= (int)materials->size() || ranges[i].firstTriangle > header.nTriangles) throw std::invalid_argument("Invalid material in " + path.string());
+			mesh->setMaterial(ranges[i].firstTriangle, (*materials)[ranges[i].material]);
+		}
+		auto chunkBVH = MeshFile::loadBVH(file, mesh, nullptr);
+		if (!chunkBVH) throw std::invalid_argument(path.string() + " has no BVH");
+		return chunkBVH;
+	} catch (std::invalid_argument& e) {
+		// The file changed since the index was read: rays miss the chunk rather than ending the render
+		std::cout << "Skipping chunk " << path.string() << ": " << e.what() << std::endl;
+		return nullptr;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef __STREAMED_CHUNK_HPP__
+#define __STREAMED_CHUNK_HPP__
+
+#include "hittables/hittable.hpp"
+
+#include <vector>
+#include <atomic>
+#include <filesystem>
+#include <shared_mutex>
+
+class BVH;
+
+// Part of an out of core mesh (see MeshStream): a mesh file holding some of its triangles and their BVH.
+// The file is mapped when a ray first reaches the bounds of the chunk, and unmapped when the ChunkCache
+// evicts it. Rays hold the chunk while they traverse it, and get their hit with all its attributes, so
+// nothing refers to the chunk once hit() returns.
+class StreamedChunk : public Hittable {
+	public:
+		// materials maps the materials of the file to the ones of the scene; it's only read when loading
+		StreamedChunk(const std::filesystem::path& p, AABB bounds, size_t size, std::shared_ptr<const std::vector<int>> materials);
+		~StreamedChunk();
+
+		bool hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const override;
+
+		inline size_t size() const {
+			return bytes;
+		}
+		inline uint64_t lastUse() const {
+			return used.load(std::memory_order_relaxed);
+		}
+		inline void touch(uint64_t time) const {
+			if (used.load(std::memory_order_relaxed) != time) used.store(time, std::memory_order_relaxed);
+		}
+		// Unmaps the chunk, unless a ray is traversing it. Only called by the ChunkCache.
+		bool evict() const;
+
+	private:
+		// Null if the file can't be loaded, which is logged
+		std::shared_ptr<BVH> load() const;
+
+		const std::filesystem::path path;
+		const size_t bytes;
+		std::shared_ptr<const std::vector<int>> materials;
+		mutable std::shared_mutex mutex;
+		mutable std::shared_ptr<BVH> bvh; // Null while the chunk isn't resident
+		mutable std::atomic<uint64_t> used{0};
+		mutable std::atomic<bool> failed{false}; // Set once load fails: rays then miss the chunk
+};
+
+#endif
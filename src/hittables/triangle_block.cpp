@@ -0,0 +1,117 @@
+#include "hittables/triangle_block.hpp"
+
+void setTriangleBlockLane(TriangleBlock& block, int lane, int primitive, const glm::fvec3& v0, const glm::fvec3& v1, const glm::fvec3& v2) {
+	const glm::fvec3 e1 = v1 - v0;
+	const glm::fvec3 e2 = v2 - v0;
+	block.v0x[lane] = v0.x;
+	block.v0y[lane] = v0.y;
+	block.v0z[lane] = v0.z;
+	block.e1x[lane] = e1.x;
+	block.e1y[lane] = e1.y;
+	block.e1z[lane] = e1.z;
+	block.e2x[lane] = e2.x;
+	block.e2y[lane] = e2.y;
+	block.e2z[lane] = e2.z;
+	block.primitives[lane] = primitive;
+}
+
+#if defined(SIMD_ENABLED)
+
+using namespace simd;
+
+bool hitTriangleBlock(const TriangleBlock& block, const Ray& ray, float tMin, float tMax, HitRecord& rec) {
+	const glm::fvec3 origin = ray.getOrigin();
+	const glm::fvec3 direction = ray.getDirection();
+	const vfloat dx = vset(direction.x);
+	const vfloat dy = vset(direction.y);
+	const vfloat dz = vset(direction.z);
+	const vfloat e1x = vload(block.e1x);
+	const vfloat e1y = vload(block.e1y);
+	const vfloat e1z = vload(block.e1z);
+	const vfloat e2x = vload(block.e2x);
+	const vfloat e2y = vload(block.e2y);
+	const vfloat e2z = vload(block.e2z);
+
+	// p = d x e2
+	const vfloat px = vsub(vmul(dy, e2z), vmul(dz, e2y));
+	const vfloat py = vsub(vmul(dz, e2x), vmul(dx, e2z));
+	const vfloat pz = vsub(vmul(dx, e2y), vmul(dy, e2x));
+	const vfloat det = vdot(e1x, e1y, e1z, px, py, pz);
+	const vfloat inv = vdiv(vset(1.0f), det);
+
+	const vfloat tx = vsub(vset(origin.x), vload(block.v0x));
+	const vfloat ty = vsub(vset(origin.y), vload(block.v0y));
+	const vfloat tz = vsub(vset(origin.z), vload(block.v0z));
+	const vfloat u = vmul(vdot(tx, ty, tz, px, py, pz), inv);
+
+	// q = t x e1
+	const vfloat qx = vsub(vmul(ty, e1z), vmul(tz, e1y));
+	const vfloat qy = vsub(vmul(tz, e1x), vmul(tx, e1z));
+	const vfloat qz = vsub(vmul(tx, e1y), vmul(ty, e1x));
+	const vfloat v = vmul(vdot(dx, dy, dz, qx, qy, qz), inv);
+	const vfloat t = vmul(vdot(e2x, e2y, e2z, qx, qy, qz), inv);
+
+	vfloat mask = vge(vabs(det), vset(EPS));
+	mask = vand(mask, vge(u, vset(0.0f)));
+	mask = vand(mask, vge(v, vset(0.0f)));
+	mask = vand(mask, vle(vadd(u, v), vset(1.0f)));
+	mask = vand(mask, vgt(t, vset(tMin)));
+	mask = vand(mask, vlt(t, vset(tMax)));
+	int lanes = vmask(mask);
+	if (lanes == 0) return false;
+
+	alignas(32) float ts[TRIANGLE_BLOCK_WIDTH];
+	alignas(32) float us[TRIANGLE_BLOCK_WIDTH];
+	alignas(32) float vs[TRIANGLE_BLOCK_WIDTH];
+	vstore(ts, t);
+	vstore(us, u);
+	vstore(vs, v);
+	int best = -1;
+	float closest = tMax;
+	for (int i = 0; i < TRIANGLE_BLOCK_WIDTH; ++i) {
+		if ((lanes & (1 << i)) && ts[i] < closest) {
+			closest = ts[i];
+			best = i;
+		}
+	}
+	rec.t = ts[best];
+	rec.u = us[best];
+	rec.v = vs[best];
+	rec.primitive = block.primitives[best];
+	return true;
+}
+
+#else
+
+bool hitTriangleBlock(const TriangleBlock& block, const Ray& ray, float tMin, float tMax, HitRecord& rec) {
+	const glm::fvec3 origin = ray.getOrigin();
+	const glm::fvec3 direction = ray.getDirection();
+	bool hasHit = false;
+	for (int i = 0; i < TRIANGLE_BLOCK_WIDTH; ++i) {
+		const glm::fvec3 e1 = { block.e1x[i], block.e1y[i], block.e1z[i] };
+		const glm::fvec3 e2 = { block.e2x[i], block.e2y[i], block.e2z[i] };
+		const glm::fvec3 p = glm::cross(direction, e2);
+		const float det = glm::dot(e1, p);
+		if (std::fabs(det) < EPS) continue;
+		const float inv = 1.0f / det;
+
+		const glm::fvec3 tv = origin - glm::fvec3(block.v0x[i], block.v0y[i], block.v0z[i]);
+		const float u = glm::dot(tv, p) * inv;
+		if (u < 0.0f) continue;
+		const glm::fvec3 q = glm::cross(tv, e1);
+		const float v = glm::dot(direction, q) * inv;
+		if (v < 0.0f || u + v > 1.0f) continue;
+		const float t = glm::dot(e2, q) * inv;
+		if (t <= tMin || t >= tMax) continue;
+
+		tMax = t;
+		rec.t = t;
+		rec.u = u;
+		rec.v = v;
+		rec.primitive = block.primitives[i];
+		hasHit = true;
+	}
+	return hasHit;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __TRIANGLE_BLOCK_HPP__
+#define __TRIANGLE_BLOCK_HPP__
+
+#include "defs.hpp"
+#include "simd.hpp"
+
+#define TRIANGLE_BLOCK_WIDTH SIMD_WIDTH
+
+// Up to TRIANGLE_BLOCK_WIDTH triangles of a BVH leaf in SoA form, tested together by the SIMD kernel.
+// Each lane keeps the index of its triangle among the BVH primitives; unused lanes are degenerate
+// (null edges) and have index -1.
+struct alignas(32) TriangleBlock {
+	float v0x[TRIANGLE_BLOCK_WIDTH];
+	float v0y[TRIANGLE_BLOCK_WIDTH];
+	float v0z[TRIANGLE_BLOCK_WIDTH];
+	float e1x[TRIANGLE_BLOCK_WIDTH];
+	float e1y[TRIANGLE_BLOCK_WIDTH];
+	float e1z[TRIANGLE_BLOCK_WIDTH];
+	float e2x[TRIANGLE_BLOCK_WIDTH];
+	float e2y[TRIANGLE_BLOCK_WIDTH];
+	float e2z[TRIANGLE_BLOCK_WIDTH];
+	int primitives[TRIANGLE_BLOCK_WIDTH];
+};
+
+void setTriangleBlockLane(TriangleBlock& block, int lane, int primitive, const glm::fvec3& v0, const glm::fvec3& v1, const glm::fvec3& v2);
+
+// Moller-Trumbore against every lane of the block. On a hit closer than tMax the record only gets t,
+// the barycentrics and rec.primitive; the BVH sets rec.object.
+bool hitTriangleBlock(const TriangleBlock& block, const Ray& ray, float tMin, float tMax, HitRecord& rec);
+
+#endif
@@ -1,22 +1,148 @@
 #include "triangle_mesh.hpp"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include <algorithm>
+#include <cmath>
 
 TriangleMesh::TriangleMesh(const std::string &name, unsigned int nTri, unsigned int nVerts, const unsigned int *vertexIndices, const glm::vec3 *P, const glm::vec3 *N, const glm::vec2 *UV) : 
-	nTriangles{nTri}, nVertices{nVerts}, name{name},
-	vertexIndices(vertexIndices, vertexIndices + 3 * nTri) {
-	p.reset(new glm::vec3[nVertices]);
+	nTriangles{nTri}, nVertices{nVerts}, name{name} {
+	this->vertexIndices.allocate(3 * nTri);
+	std::copy(vertexIndices, vertexIndices + 3 * nTri, this->vertexIndices.get());
+	p.allocate(nVertices);
 	for(int i = 0; i < nVertices; ++i){
 		p[i] = P[i];
 	}
 	if(UV){
-		uv.reset(new glm::vec2[nVertices]);
+		uv.allocate(nVertices);
 		for(int i = 0; i < nVertices; ++i){
 			uv[i] = UV[i];
 		}
 	}
 	if(N){
-		n.reset(new glm::vec3[nVertices]);
+		n.allocate(nVertices);
 		for(int i = 0; i < nVertices; ++i){
 			n[i] = N[i];
 		}
 	}
 }
+
+TriangleMesh::TriangleMesh(const std::string &name, unsigned int nTri, unsigned int nVerts, MappedArray<unsigned int> vertexIndices, MappedArray<glm::vec3> P, MappedArray<glm::vec3> N, MappedArray<glm::vec2> UV) : 
+	nTriangles{nTri}, nVertices{nVerts}, name{name}, vertexIndices(std::move(vertexIndices)),
+	p(std::move(P)), n(std::move(N)), uv(std::move(UV)) {}
+
+AABB TriangleMesh::getBounds(unsigned int tri) const {
+	glm::vec3 v0, v1, v2;
+	getVertices(tri, v0, v1, v2);
+	const glm::vec3 lo = glm::min(glm::min(v0, v1), v2);
+	const glm::vec3 hi = glm::max(glm::max(v0, v1), v2);
+	AABB bbox = { lo.x, lo.y, lo.z, hi.x, hi.y, hi.z };
+	if(bbox.minX == bbox.maxX){
+		bbox.minX -= 0.0001f;
+		bbox.maxX += 0.0001f;
+	}
+	if(bbox.minY == bbox.maxY){
+		bbox.minY -= 0.0001f;
+		bbox.maxY += 0.0001f;
+	}
+	if(bbox.minZ == bbox.maxZ){
+		bbox.minZ -= 0.0001f;
+		bbox.maxZ += 0.0001f;
+	}
+	return bbox;
+}
+
+void TriangleMesh::computeAttributes(unsigned int tri, const Ray& ray, HitRecord& rec) const {
+	const float u = rec.u;
+	const float v = rec.v;
+	const unsigned int *vIdx = &vertexIndices[tri * 3];
+
+	glm::fvec3 hitNormal = u * getNormal(vIdx[1]) + v * getNormal(vIdx[2]) + (1.0f - u - v) * getNormal(vIdx[0]);
+	rec.setFaceNormal(ray, hitNormal);
+
+	glm::fvec2 uvs[3] = { {0, 0}, {1, 0}, {1, 1} };
+	if(this->uv || this->quv){
+		uvs[0] = getUV(vIdx[0]);
+		uvs[1] = getUV(vIdx[1]);
+		uvs[2] = getUV(vIdx[2]);
+	}
+	glm::fvec2 hitUV = u * uvs[1] + v * uvs[2] + (1.0f - u - v) * uvs[0];
+
+	rec.u = hitUV.x;
+	rec.v = hitUV.y;
+	rec.material = getMaterial(tri);
+	rec.p = ray.at(rec.t);
+}
+
+void TriangleMesh::setMaterial(unsigned int firstTriangle, int material) {
+	materials.emplace_back(firstTriangle, material);
+}
+
+int TriangleMesh::getMaterial(unsigned int tri) const {
+	auto it = std::upper_bound(materials.begin(), materials.end(), tri, [](unsigned int t, const std::pair<unsigned int, int>& m) {
+		return t < m.first;
+	});
+	return it == materials.begin() ? -1 : std::prev(it)->second;
+}
+
+namespace {
+	inline uint16_t quantize(float x) {
+		return static_cast<uint16_t>(std::round(glm::clamp(x, 0.0f, 1.0f) * 65535.0f));
+	}
+
+	// Octahedral mapping: the unit sphere is projected on the |x| + |y| + |z| = 1 octahedron,
+	// whose lower half is folded over the upper one, and stored as two 16 bit unorms.
+	uint32_t encodeNormal(const glm::vec3& normal) {
+		float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+		if(l1 == 0.0f) return encodeNormal(glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::vec2 e = glm::vec2(normal.x, normal.y) / l1;
+		if(normal.z < 0.0f){
+			e = glm::vec2((1.0f - std::fabs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::fabs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f));
+		}
+		return quantize(e.x * 0.5f + 0.5f) | (static_cast<uint32_t>(quantize(e.y * 0.5f + 0.5f)) << 16);
+	}
+
+	glm::vec3 decodeNormal(uint32_t packed) {
+		glm::vec2 e = glm::vec2(packed & 0xFFFF, packed >> 16) / 65535.0f * 2.0f - 1.0f;
+		glm::vec3 normal(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+		float t = glm::clamp(-normal.z, 0.0f, 1.0f);
+		normal.x += normal.x >= 0.0f ? -t : t;
+		normal.y += normal.y >= 0.0f ? -t : t;
+		return glm::normalize(normal);
+	}
+}
+
+glm::vec3 TriangleMesh::getNormal(unsigned int v) const {
+	return qn ? decodeNormal(qn[v]) : n[v];
+}
+
+glm::vec2 TriangleMesh::getUV(unsigned int v) const {
+	if(!quv) return uv[v];
+	return uvMin + uvScale * glm::vec2(quv[v * 2], quv[v * 2 + 1]);
+}
+
+void TriangleMesh::compressAttributes() {
+	if(n){
+		qn.allocate(nVertices);
+		for(unsigned int i = 0; i < nVertices; ++i){
+			qn[i] = encodeNormal(n[i]);
+		}
+		n.reset();
+	}
+	if(uv){
+		// UVs can tile outside of [0, 1]: quantize them in their own bounds
+		glm::vec2 lo(INF), hi(-INF);
+		for(unsigned int i = 0; i < nVertices; ++i){
+			lo = glm::min(lo, uv[i]);
+			hi = glm::max(hi, uv[i]);
+		}
+		const glm::vec2 extent = glm::max(hi - lo, glm::vec2(EPS));
+		quv.allocate(nVertices * 2);
+		for(unsigned int i = 0; i < nVertices; ++i){
+			quv[i * 2] = quantize((uv[i].x - lo.x) / extent.x);
+			quv[i * 2 + 1] = quantize((uv[i].y - lo.y) / extent.y);
+		}
+		uvMin = lo;
+		uvScale = extent / 65535.0f;
+		uv.reset();
+	}
+}
@@ -4,19 +4,59 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <cstdint>
 #include "glm/vec3.hpp"
 #include "glm/vec2.hpp"
+#include "defs.hpp"
+#include "mapped_file.hpp"
 
 class TriangleMesh {
 	public:
 		TriangleMesh(const std::string& name, unsigned int nTri, unsigned int nVerts, const unsigned int *vertexIndices, const glm::vec3 *p, const glm::vec3 *n, const glm::vec2 *uv);
+		// Takes over the arrays instead of copying them, so they can be loaded buffers or point into a
+		// mapped mesh file. n and uv may be empty.
+		TriangleMesh(const std::string& name, unsigned int nTri, unsigned int nVerts, MappedArray<unsigned int> vertexIndices, MappedArray<glm::vec3> p, MappedArray<glm::vec3> n, MappedArray<glm::vec2> uv);
+
+		// Triangles are addressed by their index in the mesh: nothing is stored per triangle besides
+		// the vertex indices. Rays test them through the triangle blocks of the BVH, which then call
+		// computeAttributes for the closest hit.
+		inline void getVertices(unsigned int tri, glm::vec3& v0, glm::vec3& v1, glm::vec3& v2) const {
+			v0 = p[vertexIndices[tri * 3]];
+			v1 = p[vertexIndices[tri * 3 + 1]];
+			v2 = p[vertexIndices[tri * 3 + 2]];
+		}
+		AABB getBounds(unsigned int tri) const;
+		void computeAttributes(unsigned int tri, const Ray& ray, HitRecord& rec) const;
+		// Triangles from firstTriangle onwards use material, up to the next call
+		void setMaterial(unsigned int firstTriangle, int material);
+		int getMaterial(unsigned int tri) const;
+		// Replaces normals and UVs with octahedral 2x16 bit normals and 16 bit UVs; n and uv are released.
+		// Positions stay as they are, since the triangle blocks of the BVH keep their own copy anyway.
+		void compressAttributes();
+		inline bool isCompressed() const {
+			return qn || quv;
+		}
+
+		// Cost of a single ray/triangle test relative to a BVH node traversal
+		static constexpr float intersectionCost = 1.0f;
 
 		const unsigned int nTriangles, nVertices;
-		std::vector<unsigned int> vertexIndices;
-		std::unique_ptr<glm::vec3[]> p;
-		std::unique_ptr<glm::vec3[]> n;
-		std::unique_ptr<glm::vec2[]> uv;
+		MappedArray<unsigned int> vertexIndices;
+		MappedArray<glm::vec3> p;
+		MappedArray<glm::vec3> n;
+		MappedArray<glm::vec2> uv;
 		const std::string name;
+
+	private:
+		glm::vec3 getNormal(unsigned int v) const;
+		glm::vec2 getUV(unsigned int v) const;
+
+		// Compressed attributes, set instead of n and uv by compressAttributes
+		MappedArray<uint32_t> qn;
+		MappedArray<uint16_t> quv;
+		glm::vec2 uvMin, uvScale;
+
+		std::vector<std::pair<unsigned int, int>> materials; // First triangle and material, sorted
 };
 
 #endif
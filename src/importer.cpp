@@ -1,147 +1,768 @@
 #include "importer.hpp"
 
-#include "hittables/curve.hpp"
+#include "options_manager.hpp"
+#include "mapped_file.hpp"
 #include "glm/vec3.hpp"
+#include "glm/geometric.hpp"
 
+#include <algorithm>
 #include <fstream>
-#include <sstream>
 #include <iostream>
 #include <cstring>
+#include <charconv>
+#include <string_view>
+#include <array>
+#include <unordered_map>
 
-// Num. Curves
-// width0 width1
-// ct1_c0[x] ct1_c0[y] ct1_c0[z]
-// ct2_c0[x] ct2_c0[y] ct2_c0[z]
-// ct3_c0[x] ct3_c0[y] ct3_c0[z]
-// ct4_c0[x] ct4_c0[y] ct4_c0[z]
+namespace {
+	// Strands of a BCC file converted by one task
+	struct BCCChunk {
+		const char* begin;
+		size_t nStrands;
+		size_t firstCurve;
+	};
 
-#define CLOSE_RETURN(X, Y) fclose((X)); return (Y);
+	// Catmull-Rom spans of the strands to Bezier curves
+	void convertBCCChunk(const BCCChunk& chunk, BezierCurve* curves) {
+		const char* c = chunk.begin;
+		BezierCurve* curve = curves + chunk.firstCurve;
+		for (size_t i = 0; i < chunk.nStrands; ++i) {
+			int nPoints;
+			memcpy(&nPoints, c, sizeof(int));
+			nPoints = abs(nPoints); // Negative for closed strands
+			const glm::fvec3* controlPoints = reinterpret_cast<const glm::fvec3*>(c + sizeof(int));
+			for (int pIdx = 1; pIdx + 2 < nPoints; pIdx++) {
+				auto p0 = controlPoints[pIdx - 1];
+				auto p1 = controlPoints[pIdx];
+				auto p2 = controlPoints[pIdx + 1];
+				auto p3 = controlPoints[pIdx + 2];
+				curve->p[0] = p1;
+				curve->p[1] = p1+(p2-p0)/(6.0f * 0.1f);
+				curve->p[2] = p2+(p3-p1)/(6.0f * 0.1f);
+				curve->p[3] = p2;
+				curve->width[0] = 0.2f;
+				curve->width[1] = 0.2f;
+				curve++;
+			}
+			c += sizeof(int) + nPoints * sizeof(glm::fvec3);
+		}
+	}
+}
 
-bool Importer::importBCC(std::filesystem::path p, std::vector<HittablePtr> &curves, int mat, int numSegments){
+bool Importer::importBCC(std::filesystem::path p, CurveMesh &curves){
+	std::shared_ptr<MappedFile> file;
+	try {
+		file = MappedFile::open(p);
+	} catch (std::invalid_argument&) {
+		return false;
+	}
+	if (file->size() < sizeof(BCCHeader)) return false;
 	BCCHeader header;
-	FILE *pFile = fopen(p.string().c_str(), "rb");
-	fread(&header, sizeof(header), 1, pFile);
+	memcpy(&header, file->data(), sizeof(header));
 
-	if ( header.sign[0] != 'B' ) {CLOSE_RETURN(pFile, false);} 		// Invalid file signature
-	if ( header.sign[1] != 'C' ) {CLOSE_RETURN(pFile, false);} 		// Invalid file signature
-	if ( header.sign[2] != 'C' ) {CLOSE_RETURN(pFile, false);} 		// Invalid file signature
-	if ( header.byteCount != 0x44 ) {CLOSE_RETURN(pFile, false);} 	// Only supporting 4-byte integers and floats
+	if ( header.sign[0] != 'B' ) return false; 		// Invalid file signature
+	if ( header.sign[1] != 'C' ) return false; 		// Invalid file signature
+	if ( header.sign[2] != 'C' ) return false; 		// Invalid file signature
+	if ( header.byteCount != 0x44 ) return false; 	// Only supporting 4-byte integers and floats
 
-	if ( header.curveType[0] != 'C' ) {CLOSE_RETURN(pFile, false);} // Not a Catmull-Rom curve
-	if ( header.curveType[1] != '0' ) {CLOSE_RETURN(pFile, false);} // Not uniform parameterization
-	if ( header.dimensions != 3 ) {CLOSE_RETURN(pFile, false);} 	// Only curves in 3D
+	if ( header.curveType[0] != 'C' ) return false; // Not a Catmull-Rom curve
+	if ( header.curveType[1] != '0' ) return false; // Not uniform parameterization
+	if ( header.dimensions != 3 ) return false; 	// Only curves in 3D
 
-	int totalCount = 0;
 	std::cout << "CatmullRom curves: " << header.curveCount << std::endl;
-	for ( uint64_t i=0; i<header.curveCount; i++ ) {
-		int curveControlPointCount;
-		bool isClosed = false;
-		fread(&curveControlPointCount, sizeof(int), 1, pFile);
-		isClosed = curveControlPointCount < 0;
-		if ( curveControlPointCount < 0 ) curveControlPointCount = -curveControlPointCount;
-		std::vector<glm::fvec3> controlPoints(curveControlPointCount);
-		for(uint64_t j = 0; j < curveControlPointCount; ++j){
-			float cpx, cpy, cpz;
-			fread(&cpx, sizeof(float), 1, pFile);
-			fread(&cpy, sizeof(float), 1, pFile);
-			fread(&cpz, sizeof(float), 1, pFile);
-			controlPoints[j] = glm::fvec3{cpx, cpy, cpz};
-		}
-		for(uint64_t pIdx = 1; pIdx <= curveControlPointCount - 3; pIdx++){
-			auto p0 = controlPoints[pIdx - 1];
-			auto p1 = controlPoints[pIdx];
-			auto p2 = controlPoints[pIdx + 1];
-			auto p3 = controlPoints[pIdx + 2];
-			glm::fvec3 cp[4];
-			cp[0] = p1;
-			cp[1] = p1+(p2-p0)/(6.0f * 0.1f);
-			cp[2] = p2+(p3-p1)/(6.0f * 0.1f);
-			cp[3] = p2;
-			auto common = std::make_shared<CurveCommon>(cp, 0.2, 0.2);
-			for (int k = 0; k < numSegments; k++) {
-				totalCount++;
-				float segmentSize = 1.0f / (float)numSegments;
-				float uMin = k * segmentSize;
-				float uMax = min((k + 1) * segmentSize, 1.0f);
-				curves.push_back(
-						std::make_shared<Curve>(
-							uMin, uMax,
-							false,
-							mat,
-							common
-							)
-						);
+	// Strands have different lengths: a first pass only hops from one point count to the next to find
+	// where each chunk starts and how many spans come before it, then the chunks are converted in parallel
+	const char* c = file->data() + sizeof(BCCHeader);
+	const char* end = file->data() + file->size();
+	size_t nChunks = max<size_t>(1, min<size_t>(OptionsMap::Instance()->getOption(Options::THREADS) * 4, header.curveCount >> 10));
+	size_t chunkStrands = (header.curveCount + nChunks - 1) / nChunks;
+	std::vector<BCCChunk> chunks;
+	size_t nCurves = 0;
+	for (uint64_t i = 0; i < header.curveCount; i++) {
+		if (i % chunkStrands == 0) chunks.push_back({ c, 0, nCurves });
+		if (end - c < (ptrdiff_t)sizeof(int)) return false;
+		int nPoints;
+		memcpy(&nPoints, c, sizeof(int));
+		nPoints = abs(nPoints);
+		c += sizeof(int);
+		if ((size_t)(end - c) < nPoints * sizeof(glm::fvec3)) return false;
+		c += nPoints * sizeof(glm::fvec3);
+		nCurves += max(nPoints - 3, 0);
+		chunks.back().nStrands++;
+	}
+
+	BezierCurve* converted = curves.addCurves(nCurves);
+	std::vector<std::future<void>> futures;
+	for (auto& chunk : chunks) {
+		futures.push_back(Threading::pool.queue([&chunk, converted](uint32_t &rng) { convertBCCChunk(chunk, converted); }));
+	}
+	Threading::pool.wait(futures);
+	std::cout << "N. curves: " << nCurves << std::endl;
+	return true;
+}
+
+namespace {
+	inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+	inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	inline const char* skipBlanks(const char* c, const char* end) {
+		while (c < end && isBlank(*c)) ++c;
+		return c;
+	}
+
+	inline const char* lineEnd(const char* c, const char* end) {
+		const char* e = static_cast<const char*>(memchr(c, '\n', end - c));
+		return e ? e : end;
+	}
+
+	inline bool startsWith(const char* c, const char* end, const char* keyword) {
+		size_t len = strlen(keyword);
+		return end - c > (ptrdiff_t)len && strncmp(c, keyword, len) == 0 && isBlank(c[len]);
+	}
+
+	// Rest of the line without the surrounding blanks
+	inline std::string lineArgument(const char* c, const char* end) {
+		c = skipBlanks(c, end);
+		while (end > c && isBlank(end[-1])) --end;
+		return std::string(c, end);
+	}
+
+	template <typename T>
+	bool parseNumber(const char*& c, const char* end, T& value) {
+		c = skipBlanks(c, end);
+		if (c < end && *c == '+') ++c;
+		auto result = std::from_chars(c, end, value);
+		if (result.ec != std::errc()) return false;
+		c = result.ptr;
+		return true;
+	}
+
+	int parseInt(const char*& c, const char* end) {
+		bool negative = false;
+		if (c < end && (*c == '-' || *c == '+')) negative = *c++ == '-';
+		int value = 0;
+		while (c < end && isDigit(*c)) value = value * 10 + (*c++ - '0');
+		return negative ? -value : value;
+	}
+
+	struct OBJCorner {
+		int v;
+		int vt; // -1 if absent
+		int vn; // -1 if absent
+		bool operator==(const OBJCorner& o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+	};
+
+	struct OBJCornerHash {
+		size_t operator()(const OBJCorner& c) const {
+			return (size_t)c.v * 73856093u ^ (size_t)c.vt * 19349663u ^ (size_t)c.vn * 83492791u;
+		}
+	};
+
+	// A range of whole lines of the file, parsed by one task
+	struct OBJChunk {
+		const char* begin;
+		const char* end;
+		// Counted by the first pass
+		size_t nV = 0, nVT = 0, nVN = 0, nTri = 0;
+		std::vector<std::pair<size_t, std::string>> materials; // usemtl: first local triangle and name
+		std::vector<std::string> libraries;
+		// Offsets of the chunk in the whole file, from the counts of the previous chunks
+		size_t firstV = 0, firstVT = 0, firstVN = 0, firstTri = 0;
+		bool valid = true;
+	};
+
+	int countCorners(const char* c, const char* end) {
+		int corners = 0;
+		while (true) {
+			c = skipBlanks(c, end);
+			if (c >= end || *c == '#') break;
+			++corners;
+			while (c < end && !isBlank(*c)) ++c;
+		}
+		return corners;
+	}
+
+	void countOBJChunk(OBJChunk& chunk) {
+		for (const char* line = chunk.begin; line < chunk.end;) {
+			const char* end = lineEnd(line, chunk.end);
+			const char* c = skipBlanks(line, end);
+			if (end - c > 1) {
+				if (c[0] == 'v' && isBlank(c[1])) chunk.nV++;
+				else if (c[0] == 'v' && c[1] == 't' && end - c > 2 && isBlank(c[2])) chunk.nVT++;
+				else if (c[0] == 'v' && c[1] == 'n' && end - c > 2 && isBlank(c[2])) chunk.nVN++;
+				else if (c[0] == 'f' && isBlank(c[1])) chunk.nTri += max(countCorners(c + 1, end) - 2, 0);
+				else if (startsWith(c, end, "usemtl")) chunk.materials.emplace_back(chunk.nTri, lineArgument(c + 6, end));
+				else if (startsWith(c, end, "mtllib")) chunk.libraries.push_back(lineArgument(c + 6, end));
 			}
+			line = end + 1;
 		}
 	}
-	std::cout << "N. curves: " << totalCount << std::endl;
-	CLOSE_RETURN(pFile, true);
-}
 
-bool Importer::importBEZ(std::filesystem::path p, std::vector<HittablePtr> &curves, int mat, int numSegments) {
-	std::ifstream file(p);
-	if (file.is_open()) {
+	void parseOBJChunk(OBJChunk& chunk, glm::vec3* positions, glm::vec2* uvs, glm::vec3* normals, OBJCorner* corners) {
+		size_t v = chunk.firstV, vt = chunk.firstVT, vn = chunk.firstVN, tri = chunk.firstTri;
+		std::vector<OBJCorner> face;
+		// OBJ indices start from 1; negative ones count backwards from the last element defined
+		auto resolve = [](int idx, size_t count) { return idx > 0 ? idx - 1 : (int)count + idx; };
+		for (const char* line = chunk.begin; line < chunk.end;) {
+			const char* end = lineEnd(line, chunk.end);
+			const char* c = skipBlanks(line, end);
+			if (end - c > 1) {
+				if (c[0] == 'v' && isBlank(c[1])) {
+					c += 1;
+					glm::vec3 position(0.0f);
+					parseNumber(c, end, position.x);
+					parseNumber(c, end, position.y);
+					parseNumber(c, end, position.z);
+					positions[v++] = position;
+				} else if (c[0] == 'v' && c[1] == 't' && end - c > 2 && isBlank(c[2])) {
+					c += 2;
+					// A missing coordinate stays 0, as the second one is optional
+					glm::vec2 uv(0.0f);
+					parseNumber(c, end, uv.x);
+					parseNumber(c, end, uv.y);
+					uvs[vt++] = uv;
+				} else if (c[0] == 'v' && c[1] == 'n' && end - c > 2 && isBlank(c[2])) {
+					c += 2;
+					glm::vec3 normal(0.0f);
+					parseNumber(c, end, normal.x);
+					parseNumber(c, end, normal.y);
+					parseNumber(c, end, normal.z);
+					normals[vn++] = normal;
+				} else if (c[0] == 'f' && isBlank(c[1])) {
+					c += 1;
+					face.clear();
+					while (true) {
+						c = skipBlanks(c, end);
+						if (c >= end || *c == '#') break;
+						OBJCorner corner = { resolve(parseInt(c, end), v), -1, -1 };
+						if (c < end && *c == '/') {
+							++c;
+							if (c < end && *c != '/') corner.vt = resolve(parseInt(c, end), vt);
+							if (c < end && *c == '/') {
+								++c;
+								corner.vn = resolve(parseInt(c, end), vn);
+							}
+						}
+						if (c < end && !isBlank(*c)) {
+							chunk.valid = false;
+							return;
+						}
+						face.push_back(corner);
+					}
+					// Polygons are triangulated as fans
+					for (size_t k = 2; k < face.size(); ++k) {
+						corners[tri * 3] = face[0];
+						corners[tri * 3 + 1] = face[k - 1];
+						corners[tri * 3 + 2] = face[k];
+						tri++;
+					}
+				}
+			}
+			line = end + 1;
+		}
+	}
+
+	void importMTL(const std::filesystem::path& p, std::vector<Importer::OBJMaterial>& materials) {
+		std::ifstream file(p);
+		if (!file.is_open()) {
+			std::cout << "Cannot open material library " << p << std::endl;
+			return;
+		}
 		std::string line;
-		std::getline(file, line);
-		int nCurves = std::stoi(line);
-		std::cout << "N. curves: " << nCurves << std::endl;
-		int i = 0;
-		while(i < nCurves){
-			int k = 0;
-			glm::fvec3 ctrlPts[4];
- 			// width0 width1
-			std::getline(file, line);
-			std::istringstream wiss(line);
-			float width0, width1;
-			wiss >> width0 >> width1;
-
-			float tmp1, tmp2, tmp3;
-			std::getline(file, line);
-			std::istringstream c0iss(line);
-			c0iss.str(line);
-			c0iss >> tmp1 >> tmp2 >> tmp3;
-			ctrlPts[k++] = (glm::fvec3{tmp1, tmp2, tmp3});
-
-			std::getline(file, line);
-			std::istringstream c1iss(line);
-			c1iss.str(line);
-			c1iss >> tmp1 >> tmp2 >> tmp3;
-			ctrlPts[k++] = (glm::fvec3{tmp1, tmp2, tmp3});
-
-			std::getline(file, line);
-			std::istringstream c2iss(line);
-			c2iss.str(line);
-			c2iss >> tmp1 >> tmp2 >> tmp3;
-			ctrlPts[k++] = (glm::fvec3{tmp1, tmp2, tmp3});
-
-			std::getline(file, line);
-			std::istringstream c3iss(line);
-			c3iss.str(line);
-			c3iss >> tmp1 >> tmp2 >> tmp3;
-			ctrlPts[k++] = (glm::fvec3{tmp1, tmp2, tmp3});
-
-			auto common = std::make_shared<CurveCommon>(ctrlPts, width0, width1);
-
-			for (int j = 0; j < numSegments; j++) {
-				float segmentSize = 1.0f / (float)numSegments;
-				float uMin = j * segmentSize;
-				float uMax = min((j + 1) * segmentSize, 1.0f);
-				curves.push_back(
-					std::make_shared<Curve>(
-						uMin, uMax,
-						false,
-						mat,
-						common
-					)
-				);
+		while (std::getline(file, line)) {
+			const char* c = skipBlanks(line.data(), line.data() + line.size());
+			const char* end = line.data() + line.size();
+			if (startsWith(c, end, "newmtl")) {
+				materials.emplace_back();
+				materials.back().name = lineArgument(c + 6, end);
+			} else if (!materials.empty() && startsWith(c, end, "Kd")) {
+				c += 2;
+				glm::fvec3 diffuse(0.0f);
+				parseNumber(c, end, diffuse.r);
+				parseNumber(c, end, diffuse.g);
+				parseNumber(c, end, diffuse.b);
+				materials.back().diffuse = diffuse;
+			} else if (!materials.empty() && startsWith(c, end, "map_Kd")) {
+				// Options may precede the file name, which is the last argument
+				std::string args = lineArgument(c + 6, end);
+				size_t space = args.find_last_of(" \t");
+				materials.back().diffuseTexture = space == std::string::npos ? args : args.substr(space + 1);
+			}
+		}
+	}
+}
+
+void Importer::computeNormals(const glm::vec3* p, unsigned int nVertices, const unsigned int* indices, unsigned int nTriangles, glm::vec3* n) {
+	for (unsigned int i = 0; i < nVertices; ++i) {
+		n[i] = glm::vec3(0.0f);
+	}
+	for (unsigned int t = 0; t < nTriangles; ++t) {
+		const unsigned int* idx = &indices[t * 3];
+		// The cross product is weighted by the area of the triangle
+		glm::vec3 faceNormal = glm::cross(p[idx[1]] - p[idx[0]], p[idx[2]] - p[idx[0]]);
+		n[idx[0]] += faceNormal;
+		n[idx[1]] += faceNormal;
+		n[idx[2]] += faceNormal;
+	}
+	for (unsigned int i = 0; i < nVertices; ++i) {
+		float length = glm::length(n[i]);
+		n[i] = length > 0.0f ? n[i] / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+}
+
+bool Importer::importOBJ(std::filesystem::path p, OBJMesh &mesh) {
+	std::ifstream file(p, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) return false;
+	std::string text(file.tellg(), '\0');
+	file.seekg(0);
+	file.read(&text[0], text.size());
+	file.close();
+
+	// Chunks end on line boundaries; each is counted, then parsed at the offsets of the elements before it
+	const char* begin = text.data();
+	const char* end = text.data() + text.size();
+	int nChunks = max(1, min(OptionsMap::Instance()->getOption(Options::THREADS) * 4, (int)(text.size() >> 16)));
+	std::vector<OBJChunk> chunks;
+	for (int i = 0; i < nChunks && begin < end; ++i) {
+		const char* chunkEnd = (i == nChunks - 1) ? end : min(end, lineEnd(min(end, begin + text.size() / nChunks), end) + 1);
+		chunks.emplace_back();
+		chunks.back().begin = begin;
+		chunks.back().end = chunkEnd;
+		begin = chunkEnd;
+	}
+
+	std::vector<std::future<void>> futures;
+	for (auto& chunk : chunks) {
+		futures.push_back(Threading::pool.queue([&chunk](uint32_t &rng) { countOBJChunk(chunk); }));
+	}
+	Threading::pool.wait(futures);
+
+	size_t nV = 0, nVT = 0, nVN = 0, nTri = 0;
+	for (auto& chunk : chunks) {
+		chunk.firstV = nV;
+		chunk.firstVT = nVT;
+		chunk.firstVN = nVN;
+		chunk.firstTri = nTri;
+		nV += chunk.nV;
+		nVT += chunk.nVT;
+		nVN += chunk.nVN;
+		nTri += chunk.nTri;
+	}
+	if (nTri == 0 || nV == 0) return false;
+
+	// Positions go straight to the buffer of the mesh when the file allows it, see below
+	std::unique_ptr<glm::vec3[]> positions(new glm::vec3[nV]);
+	std::vector<glm::vec2> uvs(nVT);
+	std::vector<glm::vec3> normals(nVN);
+	std::vector<OBJCorner> corners(nTri * 3);
+	for (auto& chunk : chunks) {
+		futures.push_back(Threading::pool.queue([&](uint32_t &rng) {
+			parseOBJChunk(chunk, positions.get(), uvs.data(), normals.data(), corners.data());
+		}));
+	}
+	Threading::pool.wait(futures);
+	for (auto& chunk : chunks) {
+		if (!chunk.valid) return false;
+	}
+
+	bool hasNormals = true;
+	for (auto& corner : corners) {
+		if (corner.v < 0 || corner.v >= (int)nV || corner.vt >= (int)nVT || corner.vn >= (int)nVN) return false;
+		hasNormals &= corner.vn >= 0;
+	}
+
+	// Each distinct (position, uv, normal) corner becomes a vertex. The positions are split in ranges that separate
+	// tasks deduplicate, in the order of the corners: the first combination of a position is kept in arrays indexed
+	// by the position, and only the others, at uv seams and hard edges, go through a map. Usually every position is
+	// always used with the same uv and normal: the positions are then the vertices of the mesh as they are.
+	const int nTasks = (int)min<size_t>(OptionsMap::Instance()->getOption(Options::THREADS) * 4, nV);
+	auto taskOf = [nV, nTasks](int v) { return (int)((uint64_t)v * nTasks / nV); };
+	auto forEachTask = [&futures, nTasks](auto f) {
+		for (int t = 0; t < nTasks; ++t) {
+			futures.push_back(Threading::pool.queue([t, &f](uint32_t &rng) { f(t); }));
+		}
+		Threading::pool.wait(futures);
+	};
+	// Corners of each range of positions, by range of corners so that they can be sorted in parallel
+	std::vector<std::vector<std::vector<unsigned int>>> cornersOf(nTasks, std::vector<std::vector<unsigned int>>(nTasks));
+	forEachTask([&](int t) {
+		for (size_t i = corners.size() * t / nTasks; i < corners.size() * (t + 1) / nTasks; ++i) {
+			cornersOf[taskOf(corners[i].v)][t].push_back(i);
+		}
+	});
+
+	mesh.nTriangles = nTri;
+	mesh.indices.reset(new unsigned int[nTri * 3]);
+	std::vector<int> vtOf(nV, -2);
+	std::vector<int> vnOf(nV, -2);
+	std::vector<unsigned int> vertexOf(nV);
+	std::vector<std::vector<OBJCorner>> vertices(nTasks); // Of each range of positions, indexed from 0
+	std::vector<char> shared(nTasks);
+	forEachTask([&](int t) {
+		std::unordered_map<OBJCorner, unsigned int, OBJCornerHash> others;
+		for (auto& range : cornersOf[t]) {
+			for (unsigned int i : range) {
+				OBJCorner key = corners[i];
+				if (!hasNormals) key.vn = -1;
+				if (vtOf[key.v] == -2) {
+					vtOf[key.v] = key.vt;
+					vnOf[key.v] = key.vn;
+					vertexOf[key.v] = vertices[t].size();
+					vertices[t].push_back(key);
+				} else if (vtOf[key.v] != key.vt || vnOf[key.v] != key.vn) {
+					auto it = others.emplace(key, (unsigned int)vertices[t].size());
+					if (it.second) vertices[t].push_back(key);
+					mesh.indices[i] = it.first->second;
+					continue;
+				}
+				mesh.indices[i] = vertexOf[key.v];
 			}
+		}
+		shared[t] = others.empty();
+	});
 
-			i++;
+	if (std::all_of(shared.begin(), shared.end(), [](char s) { return s; })) {
+		mesh.nVertices = nV;
+		mesh.p = std::move(positions);
+		for (size_t i = 0; i < corners.size(); ++i) {
+			mesh.indices[i] = corners[i].v;
 		}
 	} else {
-		file.close();
+		std::vector<unsigned int> firstVertex(nTasks);
+		mesh.nVertices = 0;
+		for (int t = 0; t < nTasks; ++t) {
+			firstVertex[t] = mesh.nVertices;
+			mesh.nVertices += vertices[t].size();
+		}
+		mesh.p.reset(new glm::vec3[mesh.nVertices]);
+		// vtOf and vnOf are indexed by vertex from here on
+		std::vector<int> vertexVT(mesh.nVertices), vertexVN(mesh.nVertices);
+		forEachTask([&](int t) {
+			for (auto& range : cornersOf[t]) {
+				for (unsigned int i : range) mesh.indices[i] += firstVertex[t];
+			}
+			for (size_t k = 0; k < vertices[t].size(); ++k) {
+				const OBJCorner& vertex = vertices[t][k];
+				mesh.p[firstVertex[t] + k] = positions[vertex.v];
+				vertexVT[firstVertex[t] + k] = vertex.vt;
+				vertexVN[firstVertex[t] + k] = vertex.vn;
+			}
+		});
+		vtOf = std::move(vertexVT);
+		vnOf = std::move(vertexVN);
+	}
+
+	if (nVT > 0) {
+		mesh.uv.reset(new glm::vec2[mesh.nVertices]);
+		for (size_t i = 0; i < mesh.nVertices; ++i) {
+			mesh.uv[i] = vtOf[i] >= 0 ? uvs[vtOf[i]] : glm::vec2(0.0f);
+		}
+	}
+	mesh.n.reset(new glm::vec3[mesh.nVertices]);
+	if (hasNormals) {
+		for (size_t i = 0; i < mesh.nVertices; ++i) {
+			mesh.n[i] = vnOf[i] >= 0 ? normals[vnOf[i]] : glm::vec3(0.0f, 0.0f, 1.0f);
+		}
+	} else {
+		computeNormals(mesh.p.get(), mesh.nVertices, mesh.indices.get(), nTri, mesh.n.get());
+	}
+
+	// Materials: the libraries first, then one entry per name used by usemtl and missing from them
+	for (auto& chunk : chunks) {
+		for (auto& library : chunk.libraries) {
+			importMTL(p.parent_path() / library, mesh.materials);
+		}
+	}
+	auto findMaterial = [&mesh](const std::string& name) {
+		for (int i = 0; i < mesh.materials.size(); ++i) {
+			if (mesh.materials[i].name == name) return i;
+		}
+		mesh.materials.emplace_back();
+		mesh.materials.back().name = name;
+		return (int)mesh.materials.size() - 1;
+	};
+	for (auto& chunk : chunks) {
+		for (auto& material : chunk.materials) {
+			unsigned int first = chunk.firstTri + material.first;
+			if (!mesh.materialRanges.empty() && mesh.materialRanges.back().first == first) {
+				mesh.materialRanges.pop_back();
+			}
+			mesh.materialRanges.emplace_back(first, findMaterial(material.second));
+		}
+	}
+	if (mesh.materialRanges.empty() || mesh.materialRanges.front().first != 0) {
+		mesh.materialRanges.insert(mesh.materialRanges.begin(), std::make_pair(0u, findMaterial("DefaultMaterial")));
+	}
+	return true;
+}
+
+namespace {
+	// Whole lines of a text file, parsed by one task
+	struct TextChunk {
+		const char* begin;
+		const char* end;
+		size_t firstLine = 0; // Lines of the file before the chunk
+		std::vector<BezierCurve> curves;
+		size_t firstCurve = 0;
+		size_t skipped = 0;
+		uint32_t ignored = 0; // Bit i set if the chunk has an ignoredPBRTDirectives[i] statement
+		bool valid = true;
+	};
+
+	std::vector<TextChunk> splitText(const char* begin, const char* end) {
+		size_t size = end - begin;
+		int nChunks = max(1, min(OptionsMap::Instance()->getOption(Options::THREADS) * 4, (int)(size >> 16)));
+		std::vector<TextChunk> chunks;
+		for (int i = 0; i < nChunks && begin < end; ++i) {
+			const char* chunkEnd = (i == nChunks - 1) ? end : min(end, lineEnd(min(end, begin + size / nChunks), end) + 1);
+			chunks.emplace_back();
+			chunks.back().begin = begin;
+			chunks.back().end = chunkEnd;
+			begin = chunkEnd;
+		}
+		return chunks;
+	}
+
+	template <typename F>
+	void forEachChunk(std::vector<TextChunk>& chunks, F f) {
+		std::vector<std::future<void>> futures;
+		for (auto& chunk : chunks) {
+			futures.push_back(Threading::pool.queue([&chunk, &f](uint32_t &rng) { f(chunk); }));
+		}
+		Threading::pool.wait(futures);
+	}
+
+	// Num. Curves
+	// width0 width1
+	// ct1_c0[x] ct1_c0[y] ct1_c0[z]
+	// ct2_c0[x] ct2_c0[y] ct2_c0[z]
+	// ct3_c0[x] ct3_c0[y] ct3_c0[z]
+	// ct4_c0[x] ct4_c0[y] ct4_c0[z]
+	// Every line fills its own field of a curve, so chunks don't need to start on a curve
+	void parseBEZChunk(TextChunk& chunk, size_t nCurves, BezierCurve* curves) {
+		size_t lineIdx = chunk.firstLine;
+		for (const char* line = chunk.begin; line < chunk.end; ++lineIdx) {
+			const char* end = lineEnd(line, chunk.end);
+			const char* c = line;
+			line = end + 1;
+			if (lineIdx == 0) continue;
+			size_t curve = (lineIdx - 1) / 5;
+			size_t field = (lineIdx - 1) % 5;
+			if (curve >= nCurves) break;
+			bool ok = field == 0 ?
+				parseNumber(c, end, curves[curve].width[0]) && parseNumber(c, end, curves[curve].width[1]) :
+				parseNumber(c, end, curves[curve].p[field - 1].x) && parseNumber(c, end, curves[curve].p[field - 1].y) && parseNumber(c, end, curves[curve].p[field - 1].z);
+			if (!ok) {
+				chunk.valid = false;
+				return;
+			}
+		}
+	}
+
+	struct PBRTToken {
+		std::string_view text; // Without the quotes
+		bool quoted = false;
+		inline bool is(const char* s) const { return !quoted && text == s; }
+	};
+
+	PBRTToken nextToken(const char*& c, const char* end) {
+		while (c < end) {
+			if (*c == '#') c = lineEnd(c, end);
+			else if (isBlank(*c) || *c == '\n') ++c;
+			else break;
+		}
+		if (c >= end) return {};
+		const char* start = c;
+		if (*c == '"') {
+			const char* close = static_cast<const char*>(memchr(c + 1, '"', end - c - 1));
+			c = close ? close + 1 : end;
+			return { std::string_view(start + 1, (close ? close : end) - start - 1), true };
+		}
+		if (*c == '[' || *c == ']') return { std::string_view(c++, 1) };
+		while (c < end && !isBlank(*c) && *c != '\n' && *c != '"' && *c != '[' && *c != ']' && *c != '#') ++c;
+		return { std::string_view(start, c - start) };
+	}
+
+	// Chunks move forward to the next line starting with a directive, so that no statement is split
+	bool startsStatement(const char* c, const char* end) {
+		c = skipBlanks(c, end);
+		return c < end && *c >= 'A' && *c <= 'Z';
+	}
+
+	// Bezier spans of the points of a curve, in order; false for bases or degrees pbrt doesn't have
+	bool toBezierSpans(const std::vector<float>& P, std::string_view basis, int degree, std::vector<std::array<glm::fvec3, 4>>& spans) {
+		size_t n = P.size() / 3;
+		auto point = [&P](size_t i) { return glm::fvec3(P[i * 3], P[i * 3 + 1], P[i * 3 + 2]); };
+		// Quadratic spans are elevated to cubic ones
+		auto addQuadratic = [&spans](glm::fvec3 q0, glm::fvec3 q1, glm::fvec3 q2) {
+			spans.push_back({ q0, q0 + 2.0f / 3.0f * (q1 - q0), q2 + 2.0f / 3.0f * (q1 - q2), q2 });
+		};
+		if (basis == "bezier" && degree == 3 && n >= 4 && (n - 1) % 3 == 0) {
+			for (size_t i = 0; i + 3 < n; i += 3) spans.push_back({ point(i), point(i + 1), point(i + 2), point(i + 3) });
+		} else if (basis == "bezier" && degree == 2 && n >= 3 && (n - 1) % 2 == 0) {
+			for (size_t i = 0; i + 2 < n; i += 2) addQuadratic(point(i), point(i + 1), point(i + 2));
+		} else if (basis == "bspline" && degree == 3 && n >= 4) {
+			for (size_t i = 0; i + 3 < n; ++i) {
+				glm::fvec3 p0 = point(i), p1 = point(i + 1), p2 = point(i + 2), p3 = point(i + 3);
+				spans.push_back({ (p0 + 4.0f * p1 + p2) / 6.0f, (2.0f * p1 + p2) / 3.0f, (p1 + 2.0f * p2) / 3.0f, (p1 + 4.0f * p2 + p3) / 6.0f });
+			}
+		} else if (basis == "bspline" && degree == 2 && n >= 3) {
+			for (size_t i = 0; i + 2 < n; ++i) addQuadratic((point(i) + point(i + 1)) * 0.5f, point(i + 1), (point(i + 1) + point(i + 2)) * 0.5f);
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// Reads the parameters of a Shape "curve" and returns the token after them
+	PBRTToken parsePBRTCurve(const char*& c, const char* end, TextChunk& chunk) {
+		std::vector<float> P;
+		float width = 1.0f, width0 = -1.0f, width1 = -1.0f;
+		std::string_view basis = "bezier";
+		int degree = 3;
+		PBRTToken token = nextToken(c, end);
+		// Parameters are a quoted "type name" followed by a value or a bracketed list of values
+		while (token.quoted) {
+			std::string_view name = token.text.substr(token.text.find_last_of(' ') + 1);
+			std::vector<float> numbers;
+			std::string_view string;
+			token = nextToken(c, end);
+			bool list = token.is("[");
+			if (list) token = nextToken(c, end);
+			while (!token.text.empty() && !token.is("]")) {
+				if (token.quoted) {
+					string = token.text;
+				} else {
+					const char* n = token.text.data();
+					float value;
+					if (parseNumber(n, token.text.data() + token.text.size(), value)) numbers.push_back(value);
+				}
+				token = nextToken(c, end);
+				if (!list) break;
+			}
+			if (list) token = nextToken(c, end);
+			if (name == "P") P = std::move(numbers);
+			else if (name == "width" && !numbers.empty()) width = numbers[0];
+			else if (name == "width0" && !numbers.empty()) width0 = numbers[0];
+			else if (name == "width1" && !numbers.empty()) width1 = numbers[0];
+			else if (name == "basis") basis = string;
+			else if (name == "degree" && !numbers.empty()) degree = (int)numbers[0];
+		}
+		if (width0 < 0.0f) width0 = width;
+		if (width1 < 0.0f) width1 = width;
+
+		std::vector<std::array<glm::fvec3, 4>> spans;
+		if (P.size() % 3 != 0 || !toBezierSpans(P, basis, degree, spans)) {
+			chunk.skipped++;
+			return token;
+		}
+		// As pbrt, the widths go from width0 to width1 along the whole curve
+		for (size_t i = 0; i < spans.size(); ++i) {
+			BezierCurve curve;
+			std::copy(spans[i].begin(), spans[i].end(), curve.p);
+			curve.width[0] = lerp(width0, width1, (float)i / spans.size());
+			curve.width[1] = lerp(width0, width1, (float)(i + 1) / spans.size());
+			chunk.curves.push_back(curve);
+		}
+		return token;
+	}
+
+	// Directives that would change which curves the file has or where they are, but aren't supported
+	const char* const ignoredPBRTDirectives[] = { "Transform", "ConcatTransform", "Translate", "Rotate", "Scale", "Include", "Import" };
+
+	void parsePBRTChunk(TextChunk& chunk) {
+		const char* c = chunk.begin;
+		PBRTToken token = nextToken(c, chunk.end);
+		while (!token.text.empty()) {
+			for (size_t i = 0; i < std::size(ignoredPBRTDirectives); ++i) {
+				if (token.is(ignoredPBRTDirectives[i])) chunk.ignored |= 1u << i;
+			}
+			if (token.is("Shape")) {
+				token = nextToken(c, chunk.end);
+				if (token.quoted && token.text == "curve") {
+					token = parsePBRTCurve(c, chunk.end, chunk);
+					continue;
+				}
+			}
+			token = nextToken(c, chunk.end);
+		}
+	}
+}
+
+bool Importer::importBEZ(std::filesystem::path p, CurveMesh &curves) {
+	std::shared_ptr<MappedFile> file;
+	try {
+		file = MappedFile::open(p);
+	} catch (std::invalid_argument&) {
 		return false;
 	}
-	file.close();
+	const char* begin = file->data();
+	const char* end = file->data() + file->size();
+	size_t nCurves;
+	const char* c = begin;
+	if (!parseNumber(c, lineEnd(begin, end), nCurves)) return false;
+	std::cout << "N. curves: " << nCurves << std::endl;
+
+	// Lines are counted in parallel to know the first one of each chunk, then the chunks are parsed
+	std::vector<TextChunk> chunks = splitText(begin, end);
+	std::vector<size_t> lines(chunks.size());
+	forEachChunk(chunks, [&chunks, &lines](TextChunk& chunk) {
+		size_t n = 0;
+		for (const char* line = chunk.begin; line < chunk.end; line = lineEnd(line, chunk.end) + 1) n++;
+		lines[&chunk - chunks.data()] = n;
+	});
+	size_t nLines = 0;
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		chunks[i].firstLine = nLines;
+		nLines += lines[i];
+	}
+	if (nLines < 1 + nCurves * 5) return false;
+
+	BezierCurve* parsed = curves.addCurves(nCurves);
+	forEachChunk(chunks, [nCurves, parsed](TextChunk& chunk) { parseBEZChunk(chunk, nCurves, parsed); });
+	for (auto& chunk : chunks) {
+		if (!chunk.valid) return false;
+	}
+	return true;
+}
+
+bool Importer::importPBRT(std::filesystem::path p, CurveMesh &curves) {
+	std::shared_ptr<MappedFile> file;
+	try {
+		file = MappedFile::open(p);
+	} catch (std::invalid_argument&) {
+		return false;
+	}
+	const char* end = file->data() + file->size();
+	std::vector<TextChunk> chunks = splitText(file->data(), end);
+	for (size_t i = 1; i < chunks.size(); ++i) {
+		const char* c = chunks[i].begin;
+		while (c < end && !startsStatement(c, end)) c = lineEnd(c, end) + 1;
+		c = min(c, end);
+		chunks[i - 1].end = c;
+		chunks[i].begin = max(c, chunks[i].begin);
+		chunks[i].end = max(chunks[i].begin, chunks[i].end);
+	}
+	forEachChunk(chunks, parsePBRTChunk);
+
+	size_t nCurves = 0, skipped = 0;
+	uint32_t ignored = 0;
+	for (auto& chunk : chunks) {
+		chunk.firstCurve = nCurves;
+		nCurves += chunk.curves.size();
+		skipped += chunk.skipped;
+		ignored |= chunk.ignored;
+	}
+	BezierCurve* parsed = curves.addCurves(nCurves);
+	forEachChunk(chunks, [parsed](TextChunk& chunk) { std::copy(chunk.curves.begin(), chunk.curves.end(), parsed + chunk.firstCurve); });
+	if (skipped > 0) std::cout << "Skipped " << skipped << " curves with an unsupported basis or degree" << std::endl;
+	if (ignored) {
+		std::cout << "Ignored the";
+		for (size_t i = 0; i < std::size(ignoredPBRTDirectives); ++i) {
+			if (ignored & (1u << i)) std::cout << " " << ignoredPBRTDirectives[i];
+		}
+		std::cout << " statements of " << p.string() << ": its curves are imported untransformed, without the included files" << std::endl;
+	}
+	std::cout << "N. curves: " << nCurves << std::endl;
 	return true;
 }
@@ -2,6 +2,10 @@
 #define __IMPORTER_HPP__
 
 #include "hittables/hittable.hpp"
+#include "hittables/curve_mesh.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include <memory>
 #include <string>
 #include <vector>
 #include <filesystem>
@@ -18,8 +22,37 @@ namespace Importer {
 		char fileInfo[40];
 	};
 
-	bool importBCC(std::filesystem::path p, std::vector<HittablePtr> &curves, int mat, int numSegments);
-	bool importBEZ(std::filesystem::path p, std::vector<HittablePtr> &curves, int mat, int numSegments = 1);
+	struct OBJMaterial {
+		std::string name;
+		glm::fvec3 diffuse = glm::fvec3(0.6f);
+		std::string diffuseTexture; // Path relative to the obj file, empty if none
+	};
+
+	// Triangles of an obj file, laid out as the buffers of a TriangleMesh. Normals are generated
+	// (smooth, area weighted) when the file doesn't have them for every face; uv is null if the
+	// file has no texture coordinates.
+	struct OBJMesh {
+		unsigned int nTriangles = 0;
+		unsigned int nVertices = 0;
+		std::unique_ptr<unsigned int[]> indices;
+		std::unique_ptr<glm::vec3[]> p;
+		std::unique_ptr<glm::vec3[]> n;
+		std::unique_ptr<glm::vec2[]> uv;
+		std::vector<OBJMaterial> materials;
+		std::vector<std::pair<unsigned int, int>> materialRanges; // First triangle and index in materials
+	};
+
+	// Smooth, area weighted vertex normals of the triangles; vertices without triangles get +z
+	void computeNormals(const glm::vec3* p, unsigned int nVertices, const unsigned int* indices, unsigned int nTriangles, glm::vec3* n);
+	// Parses the file in parallel chunks on the thread pool
+	bool importOBJ(std::filesystem::path p, OBJMesh &mesh);
+	// Add the curves of the file to curves, without segments: the caller splits them. The text formats are
+	// parsed in parallel chunks on the thread pool.
+	bool importBCC(std::filesystem::path p, CurveMesh &curves);
+	bool importBEZ(std::filesystem::path p, CurveMesh &curves);
+	// The Shape "curve" statements of a PBRT file (Bezier or B-spline, quadratic or cubic), without their
+	// transforms: the file is expected to hold the curves of one asset, as the files included by hair scenes
+	bool importPBRT(std::filesystem::path p, CurveMesh &curves);
 };
 
 #endif
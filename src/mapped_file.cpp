@@ -0,0 +1,65 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& p) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+	file->fileHandle = CreateFileW(p.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file->fileHandle == INVALID_HANDLE_VALUE) {
+		file->fileHandle = nullptr;
+		throw std::invalid_argument("Cannot open " + p.string());
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file->fileHandle, &size);
+	file->length = size.QuadPart;
+	if (file->length == 0) throw std::invalid_argument(p.string() + " is empty");
+	file->mappingHandle = CreateFileMappingW(file->fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!file->mappingHandle) throw std::invalid_argument("Cannot map " + p.string());
+	file->base = static_cast<char*>(MapViewOfFile(file->mappingHandle, FILE_MAP_COPY, 0, 0, 0));
+	if (!file->base) throw std::invalid_argument("Cannot map " + p.string());
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (base) UnmapViewOfFile(base);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle) CloseHandle(fileHandle);
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& p) {
+	int fd = ::open(p.c_str(), O_RDONLY);
+	if (fd < 0) throw std::invalid_argument("Cannot open " + p.string());
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		throw std::invalid_argument(p.string() + " is empty");
+	}
+	void* base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid once the descriptor is closed
+	close(fd);
+	if (base == MAP_FAILED) throw std::invalid_argument("Cannot map " + p.string());
+	std::shared_ptr<MappedFile> file(new MappedFile());
+	file->base = static_cast<char*>(base);
+	file->length = st.st_size;
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (base) munmap(base, length);
+}
+
+#endif
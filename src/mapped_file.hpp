@@ -0,0 +1,75 @@
+#ifndef __MAPPED_FILE_HPP__
+#define __MAPPED_FILE_HPP__
+
+#include <memory>
+#include <filesystem>
+#include <cstddef>
+
+// A whole file mapped in memory. The mapping is private and copy on write: it can be written to
+// without changing the file. Pages are only read from disk when they are first touched.
+class MappedFile {
+	public:
+		// Throws std::invalid_argument if the file can't be mapped
+		static std::shared_ptr<MappedFile> open(const std::filesystem::path& p);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		inline char* data() const { return base; }
+		inline size_t size() const { return length; }
+
+	private:
+		MappedFile() : base(nullptr), length(0) {}
+
+		char* base;
+		size_t length;
+#if defined(_WIN32)
+		void* fileHandle = nullptr;
+		void* mappingHandle = nullptr;
+#endif
+};
+
+// An array that either owns its elements or points into a MappedFile, which it keeps alive.
+// The size is kept by the owner of the array, as with the unique_ptr arrays it replaces.
+template <typename T>
+class MappedArray {
+	public:
+		MappedArray() = default;
+		MappedArray(std::unique_ptr<T[]> owned) : storage(std::move(owned)), ptr(storage.get()) {}
+		MappedArray(std::shared_ptr<MappedFile> f, size_t offset) : file(std::move(f)), ptr(reinterpret_cast<T*>(file->data() + offset)) {}
+
+		MappedArray(MappedArray&& o) : storage(std::move(o.storage)), file(std::move(o.file)), ptr(o.ptr) {
+			o.ptr = nullptr;
+		}
+		MappedArray& operator=(MappedArray&& o) {
+			storage = std::move(o.storage);
+			file = std::move(o.file);
+			ptr = o.ptr;
+			o.ptr = nullptr;
+			return *this;
+		}
+
+		inline void allocate(size_t n) {
+			storage.reset(new T[n]);
+			file.reset();
+			ptr = storage.get();
+		}
+		inline void reset() {
+			storage.reset();
+			file.reset();
+			ptr = nullptr;
+		}
+
+		inline T& operator[](size_t i) const { return ptr[i]; }
+		inline T* get() const { return ptr; }
+		inline explicit operator bool() const { return ptr != nullptr; }
+		inline bool isMapped() const { return file != nullptr; }
+
+	private:
+		std::unique_ptr<T[]> storage;
+		std::shared_ptr<MappedFile> file;
+		T* ptr = nullptr;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "mesh_file.hpp"
+#include "mesh_stream.hpp"
+#include "importer.hpp"
+#include "options_manager.hpp"
+#include "hittables/curve_mesh.hpp"
+
+#include <cstring>
+#include <chrono>
+#include <iostream>
+
+// Converts .obj, .bez, .bcc and .pbrt curve files to .tmesh files, which the scene parser maps instead of parsing them,
+// or .obj files to out of core .tstream meshes. check= reads a converted file whole and checks the indices it stores.
+
+void printHelp(char *name){
+	printf("USAGE:\n%s in=<mesh.obj|.bez|.bcc|.pbrt> out=<mesh.tmesh|.tstream> [segments=<segments per curve>|tolerance=<flatness per width>] [bvh=SAH|MIDPOINT|NONE] [chunk=<triangles per chunk>] [threads=<n>]\n       %s check=<mesh.tmesh|.tstream>\n", name, name);
+}
+
+// Throws std::invalid_argument if a .tmesh file or a chunk of a .tstream mesh is invalid
+void checkFile(const std::filesystem::path& p){
+	std::vector<std::filesystem::path> files;
+	if(p.extension() == ".tstream"){
+		MeshStream::Index index = MeshStream::readIndex(p);
+		for(auto& chunk : index.chunks){
+			files.push_back(p.parent_path() / chunk.file);
+		}
+	} else {
+		files.push_back(p);
+	}
+	for(auto& file : files){
+		MeshFile::validate(*MeshFile::open(file), file.string());
+	}
+}
+
+void copyString(char* dst, size_t size, const std::string& src, const char* what){
+	if(src.size() >= size) throw std::invalid_argument(std::string(what) + " too long: " + src);
+	strncpy(dst, src.c_str(), size);
+}
+
+int main(int argc, char *args[]){
+	std::filesystem::path inPath;
+	std::filesystem::path outPath;
+	std::filesystem::path checkPath;
+	int numSegments = 4;
+	float tolerance = 0.0f;
+	std::string bvhType = "SAH";
+	size_t chunkTriangles = 1 << 18;
+	int nThreads = std::thread::hardware_concurrency();
+	for(int i = 1; i < argc; i++){
+		if(strncmp("in=", args[i], strlen("in=")) == 0){
+			inPath = (&args[i][strlen("in=")]);
+		}
+		if(strncmp("out=", args[i], strlen("out=")) == 0){
+			outPath = (&args[i][strlen("out=")]);
+		}
+		if(strncmp("check=", args[i], strlen("check=")) == 0){
+			checkPath = (&args[i][strlen("check=")]);
+		}
+		if(strncmp("segments=", args[i], strlen("segments=")) == 0){
+			numSegments = std::stoi(&args[i][strlen("segments=")]);
+		}
+		if(strncmp("tolerance=", args[i], strlen("tolerance=")) == 0){
+			tolerance = std::stof(&args[i][strlen("tolerance=")]);
+		}
+		if(strncmp("bvh=", args[i], strlen("bvh=")) == 0){
+			bvhType = (&args[i][strlen("bvh=")]);
+		}
+		if(strncmp("chunk=", args[i], strlen("chunk=")) == 0){
+			chunkTriangles = std::stoul(&args[i][strlen("chunk=")]);
+		}
+		if(strncmp("threads=", args[i], strlen("threads=")) == 0){
+			nThreads = std::stoi(&args[i][strlen("threads=")]);
+		}
+	}
+	if(!checkPath.empty()){
+		try{
+			checkFile(checkPath);
+		} catch(std::exception &e){
+			std::cout << "Failed checking " << checkPath.string() << ": " << e.what() << std::endl;
+			return 1;
+		}
+		std::cout << checkPath.string() << " is valid" << std::endl;
+		return 0;
+	}
+	if(inPath.empty() || outPath.empty() || numSegments < 1 || tolerance < 0.0f || (bvhType != "SAH" && bvhType != "MIDPOINT" && bvhType != "NONE") || chunkTriangles < 1){
+		printHelp(args[0]);
+		return 1;
+	}
+	OptionsMap::Instance()->setOption(Options::THREADS, nThreads > 0 ? nThreads : 1);
+	Threading::pool.init(OptionsMap::Instance()->getOption(Options::THREADS));
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	try{
+		std::shared_ptr<TriangleMesh> mesh;
+		std::shared_ptr<CurveMesh> curves;
+		std::vector<MeshFile::Material> materials;
+		std::vector<MeshFile::MaterialRange> ranges;
+		if(inPath.extension() == ".obj"){
+			Importer::OBJMesh obj;
+			if(!Importer::importOBJ(inPath, obj)) throw std::invalid_argument("Failed parsing the obj file");
+			for(auto& m : obj.materials){
+				MeshFile::Material material = {};
+				copyString(material.name, sizeof(material.name), m.name, "Material name");
+				copyString(material.diffuseTexture, sizeof(material.diffuseTexture), m.diffuseTexture, "Texture path");
+				material.diffuse[0] = m.diffuse.r;
+				material.diffuse[1] = m.diffuse.g;
+				material.diffuse[2] = m.diffuse.b;
+				materials.push_back(material);
+			}
+			for(auto& r : obj.materialRanges){
+				ranges.push_back({ r.first, r.second });
+			}
+			mesh = std::make_shared<TriangleMesh>(inPath.stem().string(), obj.nTriangles, obj.nVertices, std::move(obj.indices), std::move(obj.p), std::move(obj.n), std::move(obj.uv));
+		} else if(inPath.extension() == ".bez" || inPath.extension() == ".bcc" || inPath.extension() == ".pbrt"){
+			curves = std::make_shared<CurveMesh>(0);
+			bool ok = inPath.extension() == ".bez" ? Importer::importBEZ(inPath, *curves) :
+				inPath.extension() == ".bcc" ? Importer::importBCC(inPath, *curves) :
+				Importer::importPBRT(inPath, *curves);
+			if(!ok || curves->curveCount() == 0) throw std::invalid_argument("Failed parsing the curve file");
+			if(tolerance > 0.0f) curves->splitAdaptive(tolerance);
+			else curves->split(numSegments);
+		} else {
+			throw std::invalid_argument("Unsupported mesh format " + inPath.extension().string());
+		}
+
+		SAHCost sahCost;
+		sahCost.intersection = mesh ? TriangleMesh::intersectionCost : CurveMesh::intersectionCost;
+		Heuristic heuristic = bvhType == "MIDPOINT" ? Heuristic::MIDPOINT : Heuristic::SAH;
+		if(outPath.extension() == ".tstream"){
+			// Every chunk needs its BVH
+			if(!mesh) throw std::invalid_argument("Only triangle meshes can be streamed");
+			if(bvhType == "NONE") throw std::invalid_argument("Streamed meshes need a BVH");
+			MeshStream::write(outPath, *mesh, materials, ranges, chunkTriangles, heuristic, sahCost);
+		} else {
+			BVHPtr bvh;
+			if(bvhType != "NONE"){
+				bvh = mesh ?
+					std::make_shared<BVH>(mesh, heuristic, false, sahCost) :
+					std::make_shared<BVH>(curves, heuristic, false, sahCost);
+			}
+			MeshFile::write(outPath, mesh.get(), materials, ranges, curves.get(), bvh.get());
+		}
+	} catch(std::exception &e){
+		std::cout << "Failed converting " << inPath.string() << ": " << e.what() << std::endl;
+		return 1;
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+	auto ms_int = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
+	std::cout << "Converted " << inPath.string() << " to " << outPath.string() << " in " << ms_int.count() << "ms" << std::endl;
+	return 0;
+}
@@ -0,0 +1,251 @@
+#include "mesh_file.hpp"
+#include "hittables/curve_mesh.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+namespace {
+	size_t primitiveCount(const MeshFile::Header& header) {
+		return header.nTriangles ? header.nTriangles : header.nCurveSegments;
+	}
+
+	// Expected size of each section, 0 if it can't be checked
+	size_t sectionSize(const MeshFile::Header& header, int section) {
+		switch (section) {
+			case MeshFile::POSITIONS: return header.nVertices * sizeof(glm::vec3);
+			case MeshFile::NORMALS: return header.nVertices * sizeof(glm::vec3);
+			case MeshFile::UVS: return header.nVertices * sizeof(glm::vec2);
+			case MeshFile::INDICES: return header.nTriangles * 3 * sizeof(unsigned int);
+			case MeshFile::MATERIAL_RANGES: return header.nMaterialRanges * sizeof(MeshFile::MaterialRange);
+			case MeshFile::MATERIALS: return header.nMaterials * sizeof(MeshFile::Material);
+			case MeshFile::CURVES: return header.nCurves * sizeof(MeshFile::Curve);
+			case MeshFile::CURVE_SEGMENTS: return header.nCurveSegments * sizeof(MeshFile::Segment);
+			case MeshFile::BVH_NODES: return header.nNodes * sizeof(BVHNode);
+			case MeshFile::BVH_PRIMITIVES: return primitiveCount(header) * sizeof(int);
+			case MeshFile::BVH_BLOCKS: return header.blockWidth == TRIANGLE_BLOCK_WIDTH ? header.nBlocks * sizeof(TriangleBlock) : 0;
+			case MeshFile::BVH_LEAF_BLOCKS: return primitiveCount(header) * sizeof(int);
+		}
+		return 0;
+	}
+
+	template <typename T>
+	const T* section(const MappedFile& file, MeshFile::Section s) {
+		uint64_t offset = MeshFile::getHeader(file).offsets[s];
+		return offset ? reinterpret_cast<const T*>(file.data() + offset) : nullptr;
+	}
+
+	// Whether a float of a BVH node holds an index in [0, size)
+	bool isIndex(float f, uint64_t size) {
+		return f >= 0.0f && f < (float)size && f == (float)(uint64_t)f;
+	}
+
+	void writeSection(std::ofstream& file, MeshFile::Header& header, MeshFile::Section section, const void* data, size_t size) {
+		if (!data || size == 0) return;
+		size_t offset = file.tellp();
+		static const char zeros[MeshFile::sectionAlignment] = {};
+		size_t padding = (MeshFile::sectionAlignment - offset % MeshFile::sectionAlignment) % MeshFile::sectionAlignment;
+		file.write(zeros, padding);
+		header.offsets[section] = offset + padding;
+		file.write(static_cast<const char*>(data), size);
+	}
+}
+
+void MeshFile::write(const std::filesystem::path& p, const TriangleMesh* mesh, const std::vector<Material>& materials,
+		const std::vector<MaterialRange>& ranges, const CurveMesh* curves, const BVH* bvh) {
+	std::ofstream file(p, std::ios::binary);
+	if (!file.is_open()) throw std::invalid_argument("Cannot write " + p.string());
+
+	Header header = {};
+	memcpy(header.sign, "TRMF", 4);
+	header.version = version;
+	header.blockWidth = TRIANGLE_BLOCK_WIDTH;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	if (mesh) {
+		if (mesh->isCompressed()) throw std::invalid_argument("Compressed meshes can't be written");
+		header.nTriangles = mesh->nTriangles;
+		header.nVertices = mesh->nVertices;
+		writeSection(file, header, POSITIONS, mesh->p.get(), sectionSize(header, POSITIONS));
+		writeSection(file, header, NORMALS, mesh->n.get(), sectionSize(header, NORMALS));
+		writeSection(file, header, UVS, mesh->uv.get(), sectionSize(header, UVS));
+		writeSection(file, header, INDICES, mesh->vertexIndices.get(), sectionSize(header, INDICES));
+		header.nMaterials = materials.size();
+		header.nMaterialRanges = ranges.size();
+		writeSection(file, header, MATERIAL_RANGES, ranges.data(), sectionSize(header, MATERIAL_RANGES));
+		writeSection(file, header, MATERIALS, materials.data(), sectionSize(header, MATERIALS));
+	} else if (curves) {
+		std::vector<Curve> curveRecords(curves->curveCount());
+		for (size_t i = 0; i < curveRecords.size(); ++i) {
+			const BezierCurve& curve = curves->getCurve(i);
+			for (int k = 0; k < 4; ++k) {
+				curveRecords[i].controlPoints[k][0] = curve.p[k].x;
+				curveRecords[i].controlPoints[k][1] = curve.p[k].y;
+				curveRecords[i].controlPoints[k][2] = curve.p[k].z;
+			}
+			curveRecords[i].width[0] = curve.width[0];
+			curveRecords[i].width[1] = curve.width[1];
+		}
+		std::vector<Segment> segmentRecords(curves->segmentCount());
+		for (size_t i = 0; i < segmentRecords.size(); ++i) {
+			const CurveSegment& segment = curves->getSegment(i);
+			segmentRecords[i] = { segment.curve, segment.uMin, segment.uMax };
+		}
+		header.nCurves = curveRecords.size();
+		header.nCurveSegments = segmentRecords.size();
+		writeSection(file, header, CURVES, curveRecords.data(), sectionSize(header, CURVES));
+		writeSection(file, header, CURVE_SEGMENTS, segmentRecords.data(), sectionSize(header, CURVE_SEGMENTS));
+	}
+
+	if (bvh) {
+		if (!bvh->isBinary() || bvh->primitiveCount() != primitiveCount(header))
+			throw std::invalid_argument("The BVH doesn't match the mesh");
+		header.nNodes = bvh->nodeCount();
+		header.nBlocks = bvh->triangleBlockCount();
+		writeSection(file, header, BVH_NODES, bvh->getNodes(), sectionSize(header, BVH_NODES));
+		writeSection(file, header, BVH_PRIMITIVES, bvh->getPrimitiveOrder(), sectionSize(header, BVH_PRIMITIVES));
+		if (header.nBlocks > 0) {
+			writeSection(file, header, BVH_BLOCKS, bvh->getTriangleBlocks(), sectionSize(header, BVH_BLOCKS));
+			writeSection(file, header, BVH_LEAF_BLOCKS, bvh->getLeafBlocks(), sectionSize(header, BVH_LEAF_BLOCKS));
+		}
+	}
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!file.good()) throw std::invalid_argument("Failed writing " + p.string());
+}
+
+void MeshFile::checkHeader(const Header& header, uint64_t fileSize, const std::string& name) {
+	if (memcmp(header.sign, "TRMF", 4) != 0) throw std::invalid_argument(name + " is not a mesh file");
+	if (header.version != version) throw std::invalid_argument(name + " has an unsupported version");
+	if ((header.nTriangles == 0) == (header.nCurves == 0)) throw std::invalid_argument(name + " has neither triangles nor curves");
+	// The 64 bit counts could overflow the size of their sections
+	if (header.nNodes > fileSize / sizeof(BVHNode) || header.nBlocks > fileSize / sizeof(TriangleBlock))
+		throw std::invalid_argument(name + " is truncated");
+	for (int s = 0; s < SECTION_COUNT; ++s) {
+		uint64_t offset = header.offsets[s];
+		if (offset == 0) continue;
+		if (offset % sectionAlignment != 0 || offset > fileSize || sectionSize(header, s) > fileSize - offset)
+			throw std::invalid_argument(name + " is truncated");
+	}
+	if (header.nTriangles && (!header.offsets[POSITIONS] || !header.offsets[INDICES]))
+		throw std::invalid_argument(name + " has no vertices");
+	if (header.nCurves && (!header.offsets[CURVES] || !header.offsets[CURVE_SEGMENTS]))
+		throw std::invalid_argument(name + " has no curve segments");
+	if ((header.nMaterialRanges && !header.offsets[MATERIAL_RANGES]) || (header.nMaterials && !header.offsets[MATERIALS]))
+		throw std::invalid_argument(name + " has no materials");
+	if (header.offsets[BVH_NODES] && header.nNodes == 0) throw std::invalid_argument(name + " has an empty BVH");
+}
+
+void MeshFile::checkMaterialRanges(const Header& header, const MaterialRange* ranges, const std::string& name) {
+	for (uint32_t i = 0; i < header.nMaterialRanges; ++i) {
+		if (ranges[i].firstTriangle > header.nTriangles || (i > 0 && ranges[i].firstTriangle < ranges[i - 1].firstTriangle))
+			throw std::invalid_argument(name + " has material ranges out of order");
+		if (ranges[i].material < 0 || ranges[i].material >= (int64_t)header.nMaterials)
+			throw std::invalid_argument(name + " has an invalid material");
+	}
+}
+
+std::shared_ptr<MappedFile> MeshFile::open(const std::filesystem::path& p) {
+	auto file = MappedFile::open(p);
+	if (file->size() < sizeof(Header)) throw std::invalid_argument(p.string() + " is not a mesh file");
+	const Header& header = getHeader(*file);
+	checkHeader(header, file->size(), p.string());
+	checkMaterialRanges(header, section<MaterialRange>(*file, MATERIAL_RANGES), p.string());
+	return file;
+}
+
+void MeshFile::validate(const MappedFile& file, const std::string& name) {
+	const Header& header = getHeader(file);
+	if (const unsigned int* indices = section<unsigned int>(file, INDICES)) {
+		for (uint64_t i = 0; i < uint64_t(header.nTriangles) * 3; ++i) {
+			if (indices[i] >= header.nVertices) throw std::invalid_argument(name + " has a vertex index out of range");
+		}
+	}
+
+	const BVHNode* nodes = section<BVHNode>(file, BVH_NODES);
+	const int* primitives = section<int>(file, BVH_PRIMITIVES);
+	if (!nodes || !primitives) return;
+	const uint64_t nPrimitives = primitiveCount(header);
+	for (uint64_t i = 0; i < nPrimitives; ++i) {
+		if (primitives[i] < 0 || (uint64_t)primitives[i] >= nPrimitives) throw std::invalid_argument(name + " has a BVH primitive out of range");
+	}
+	// As loadBVH, blocks of another width are ignored
+	const TriangleBlock* blocks = header.blockWidth == TRIANGLE_BLOCK_WIDTH ? section<TriangleBlock>(file, BVH_BLOCKS) : nullptr;
+	const int* leafBlocks = section<int>(file, BVH_LEAF_BLOCKS);
+	if (blocks && leafBlocks) {
+		for (uint64_t b = 0; b < header.nBlocks; ++b) {
+			for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; ++lane) {
+				int primitive = blocks[b].primitives[lane];
+				if (primitive < -1 || primitive >= (int64_t)nPrimitives) throw std::invalid_argument(name + " has a BVH block primitive out of range");
+			}
+		}
+	}
+	// Walks the tree from the root. Every node must be reached once: nodes shared by two parents would make
+	// the walk, and traversal, exponential.
+	std::vector<bool> visited(header.nNodes, false);
+	std::vector<uint64_t> stack = { 0 };
+	while (!stack.empty()) {
+		uint64_t n = stack.back();
+		stack.pop_back();
+		if (visited[n]) throw std::invalid_argument(name + " has a BVH node with two parents");
+		visited[n] = true;
+		const BVHNode& node = nodes[n];
+		if (node.maxAABBCount.w != 0) {
+			if (!isIndex(node.minAABBLeftFirst.w, nPrimitives) || !isIndex(node.maxAABBCount.w - 1.0f, nPrimitives - (uint64_t)node.minAABBLeftFirst.w))
+				throw std::invalid_argument(name + " has a BVH leaf out of range");
+			if (blocks && leafBlocks) {
+				int first = leafBlocks[(uint64_t)node.minAABBLeftFirst.w];
+				uint64_t count = ((uint64_t)node.maxAABBCount.w + TRIANGLE_BLOCK_WIDTH - 1) / TRIANGLE_BLOCK_WIDTH;
+				if (first < 0 || first + count > header.nBlocks) throw std::invalid_argument(name + " has a BVH leaf block out of range");
+			}
+			continue;
+		}
+		if (!isIndex(node.minAABBLeftFirst.w, header.nNodes - 1) || (uint64_t)node.minAABBLeftFirst.w <= n)
+			throw std::invalid_argument(name + " has a BVH child out of range");
+		stack.push_back((uint64_t)node.minAABBLeftFirst.w);
+		stack.push_back((uint64_t)node.minAABBLeftFirst.w + 1);
+	}
+}
+
+std::shared_ptr<TriangleMesh> MeshFile::loadTriangleMesh(const std::shared_ptr<MappedFile>& file, const std::string& name) {
+	const Header& header = getHeader(*file);
+	return std::make_shared<TriangleMesh>(name, header.nTriangles, header.nVertices,
+			getSection<unsigned int>(file, INDICES),
+			getSection<glm::vec3>(file, POSITIONS),
+			getSection<glm::vec3>(file, NORMALS),
+			getSection<glm::vec2>(file, UVS));
+}
+
+std::shared_ptr<CurveMesh> MeshFile::loadCurves(const std::shared_ptr<MappedFile>& file, int mat) {
+	const Header& header = getHeader(*file);
+	auto records = getSection<Curve>(file, CURVES);
+	auto segments = getSection<Segment>(file, CURVE_SEGMENTS);
+	auto curves = std::make_shared<CurveMesh>(mat);
+	curves->reserve(header.nCurves, header.nCurveSegments);
+	for (uint32_t i = 0; i < header.nCurves; ++i) {
+		const Curve& record = records[i];
+		glm::fvec3 ctrlPts[4];
+		for (int k = 0; k < 4; ++k) {
+			ctrlPts[k] = glm::fvec3(record.controlPoints[k][0], record.controlPoints[k][1], record.controlPoints[k][2]);
+		}
+		curves->addCurve(ctrlPts, record.width[0], record.width[1]);
+	}
+	for (uint32_t i = 0; i < header.nCurveSegments; ++i) {
+		curves->addSegment(segments[i].curve, segments[i].uMin, segments[i].uMax);
+	}
+	return curves;
+}
+
+BVHPtr MeshFile::loadBVH(const std::shared_ptr<MappedFile>& file, std::shared_ptr<TriangleMesh> mesh, std::shared_ptr<CurveMesh> curves) {
+	const Header& header = getHeader(*file);
+	if (!header.offsets[BVH_NODES] || !header.offsets[BVH_PRIMITIVES]) return nullptr;
+	// Blocks written for another SIMD width are packed again
+	bool useBlocks = header.offsets[BVH_BLOCKS] && header.offsets[BVH_LEAF_BLOCKS] && header.blockWidth == TRIANGLE_BLOCK_WIDTH;
+	return std::make_shared<BVH>(mesh, curves,
+			getSection<BVHNode>(file, BVH_NODES), header.nNodes,
+			getSection<int>(file, BVH_PRIMITIVES),
+			useBlocks ? getSection<TriangleBlock>(file, BVH_BLOCKS) : MappedArray<TriangleBlock>(),
+			useBlocks ? header.nBlocks : 0,
+			useBlocks ? getSection<int>(file, BVH_LEAF_BLOCKS) : MappedArray<int>());
+}
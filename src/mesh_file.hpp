@@ -0,0 +1,107 @@
+#ifndef __MESH_FILE_HPP__
+#define __MESH_FILE_HPP__
+
+#include "bvh.hpp"
+#include "mapped_file.hpp"
+#include "hittables/triangle_mesh.hpp"
+
+#include <vector>
+#include <string>
+#include <filesystem>
+
+// Binary mesh container (.tmesh): a triangle mesh or a set of Bezier curves, and optionally the binary
+// BVH built over them. The sections are laid out as the arrays of TriangleMesh and BVH and aligned so
+// that a private mapping of the file is used in place: loading only reads the header and the material
+// ranges, and the pages of the other sections are read when the renderer first touches them.
+// Sections start on 64 byte boundaries; absent ones have offset 0. Files are little endian.
+namespace MeshFile {
+	constexpr uint32_t version = 3;
+	constexpr size_t sectionAlignment = 64;
+
+	enum Section {
+		POSITIONS, // glm::vec3 per vertex
+		NORMALS, // glm::vec3 per vertex
+		UVS, // glm::vec2 per vertex
+		INDICES, // 3 unsigned int per triangle
+		MATERIAL_RANGES, // MaterialRange per material change, sorted
+		MATERIALS, // Material per material
+		CURVES, // Curve per Bezier curve
+		CURVE_SEGMENTS, // Segment per BVH primitive of the curves
+		BVH_NODES, // BVHNode per node, root first
+		BVH_PRIMITIVES, // int per primitive, in leaf order
+		BVH_BLOCKS, // TriangleBlock of blockWidth lanes per block
+		BVH_LEAF_BLOCKS, // int per primitive
+		SECTION_COUNT
+	};
+
+	struct Header {
+		char sign[4]; // "TRMF"
+		uint32_t version;
+		uint32_t nTriangles;
+		uint32_t nVertices;
+		uint32_t nMaterials;
+		uint32_t nMaterialRanges;
+		uint32_t nCurves;
+		uint32_t nCurveSegments;
+		uint32_t blockWidth; // TRIANGLE_BLOCK_WIDTH of the writer; blocks are ignored if it differs
+		uint32_t padding;
+		uint64_t nNodes;
+		uint64_t nBlocks;
+		uint64_t offsets[SECTION_COUNT];
+	};
+
+	struct Material {
+		char name[64];
+		float diffuse[3];
+		char diffuseTexture[256]; // Relative to the mesh file, empty if none
+	};
+
+	struct MaterialRange {
+		uint32_t firstTriangle;
+		int32_t material; // Index in the materials of the file
+	};
+
+	struct Curve {
+		float controlPoints[4][3];
+		float width[2];
+	};
+
+	struct Segment {
+		uint32_t curve; // Index in the curves of the file
+		float uMin, uMax;
+	};
+
+	// Throws std::invalid_argument on failure. Either mesh or curves is set; bvh may be null, else it must
+	// be a binary BVH built over it.
+	void write(const std::filesystem::path& p, const TriangleMesh* mesh, const std::vector<Material>& materials,
+			const std::vector<MaterialRange>& ranges, const CurveMesh* curves, const BVH* bvh);
+
+	// Maps the file and checks its header, the bounds of its sections and its material ranges, without reading
+	// the other sections. Throws std::invalid_argument if it isn't valid.
+	std::shared_ptr<MappedFile> open(const std::filesystem::path& p);
+	// Checks that the indices stored in an opened file (vertices, BVH nodes, primitives and blocks) are in range,
+	// reading all of it. Throws std::invalid_argument if they aren't.
+	void validate(const MappedFile& file, const std::string& name);
+	// The checks of open that only need the header, or the header and the material ranges. name is used
+	// in the messages of the std::invalid_argument they throw.
+	void checkHeader(const Header& header, uint64_t fileSize, const std::string& name);
+	void checkMaterialRanges(const Header& header, const MaterialRange* ranges, const std::string& name);
+	inline const Header& getHeader(const MappedFile& file) {
+		return *reinterpret_cast<const Header*>(file.data());
+	}
+	// Empty if the file doesn't have the section
+	template <typename T>
+	MappedArray<T> getSection(const std::shared_ptr<MappedFile>& file, Section section) {
+		uint64_t offset = getHeader(*file).offsets[section];
+		return offset ? MappedArray<T>(file, offset) : MappedArray<T>();
+	}
+
+	// The mesh uses the arrays of the file in place. Its materials aren't set: the ranges of the file index
+	// the materials of the file, which the caller maps to the materials of the scene.
+	std::shared_ptr<TriangleMesh> loadTriangleMesh(const std::shared_ptr<MappedFile>& file, const std::string& name);
+	std::shared_ptr<CurveMesh> loadCurves(const std::shared_ptr<MappedFile>& file, int mat);
+	// The BVH stored in the file for the mesh or the curves loaded from it, null if there is none
+	BVHPtr loadBVH(const std::shared_ptr<MappedFile>& file, std::shared_ptr<TriangleMesh> mesh, std::shared_ptr<CurveMesh> curves);
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "mesh_stream.hpp"
+#include "hittables/streamed_chunk.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+	// Writes the triangles of mesh in order as a mesh file, grouped by material, and returns its bounds
+	AABB writeChunk(const std::filesystem::path& p, const TriangleMesh& mesh, std::vector<unsigned int>& order, const std::vector<int>& triMaterials,
+			const std::vector<MeshFile::Material>& materials, Heuristic heuristic, SAHCost cost) {
+		std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+			return triMaterials[a] < triMaterials[b];
+		});
+		std::unordered_map<unsigned int, unsigned int> vertices;
+		std::vector<unsigned int> indices;
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> uvs;
+		std::vector<MeshFile::MaterialRange> ranges;
+		indices.reserve(order.size() * 3);
+		for (size_t i = 0; i < order.size(); ++i) {
+			unsigned int tri = order[i];
+			if (ranges.empty() || ranges.back().material != triMaterials[tri]) {
+				ranges.push_back({ (uint32_t)i, triMaterials[tri] });
+			}
+			for (int k = 0; k < 3; ++k) {
+				unsigned int v = mesh.vertexIndices[tri * 3 + k];
+				auto it = vertices.emplace(v, (unsigned int)positions.size());
+				if (it.second) {
+					positions.push_back(mesh.p[v]);
+					if (mesh.n) normals.push_back(mesh.n[v]);
+					if (mesh.uv) uvs.push_back(mesh.uv[v]);
+				}
+				indices.push_back(it.first->second);
+			}
+		}
+		auto chunkMesh = std::make_shared<TriangleMesh>(p.stem().string(), order.size(), positions.size(), indices.data(), positions.data(),
+				mesh.n ? normals.data() : nullptr, mesh.uv ? uvs.data() : nullptr);
+		BVH bvh(chunkMesh, heuristic, false, cost);
+		MeshFile::write(p, chunkMesh.get(), materials, ranges, nullptr, &bvh);
+		return bvh.getLocalAABB();
+	}
+}
+
+void MeshStream::write(const std::filesystem::path& p, const TriangleMesh& mesh, const std::vector<MeshFile::Material>& materials,
+		const std::vector<MeshFile::MaterialRange>& ranges, size_t chunkTriangles, Heuristic heuristic, SAHCost cost) {
+	if (chunkTriangles == 0) throw std::invalid_argument("Chunks need at least one triangle");
+	if (mesh.isCompressed()) throw std::invalid_argument("Compressed meshes can't be streamed");
+
+	std::vector<int> triMaterials(mesh.nTriangles, 0);
+	for (size_t r = 0; r < ranges.size(); ++r) {
+		uint32_t end = r + 1 < ranges.size() ? ranges[r + 1].firstTriangle : mesh.nTriangles;
+		for (uint32_t t = ranges[r].firstTriangle; t < end && t < mesh.nTriangles; ++t) triMaterials[t] = ranges[r].material;
+	}
+	std::vector<glm::vec3> centroids(mesh.nTriangles);
+	std::vector<unsigned int> order(mesh.nTriangles);
+	for (unsigned int t = 0; t < mesh.nTriangles; ++t) {
+		glm::vec3 v0, v1, v2;
+		mesh.getVertices(t, v0, v1, v2);
+		centroids[t] = (v0 + v1 + v2) / 3.0f;
+		order[t] = t;
+	}
+
+	// Ranges of order that become chunks
+	std::vector<std::pair<size_t, size_t>> chunkRanges;
+	std::vector<std::pair<size_t, size_t>> stack = { { 0, order.size() } };
+	while (!stack.empty()) {
+		auto range = stack.back();
+		stack.pop_back();
+		if (range.second - range.first <= chunkTriangles) {
+			chunkRanges.push_back(range);
+			continue;
+		}
+		glm::vec3 cMin(INF), cMax(-INF);
+		for (size_t i = range.first; i < range.second; ++i) {
+			cMin = glm::min(cMin, centroids[order[i]]);
+			cMax = glm::max(cMax, centroids[order[i]]);
+		}
+		glm::vec3 extent = cMax - cMin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		size_t mid = range.first + (range.second - range.first) / 2;
+		std::nth_element(order.begin() + range.first, order.begin() + mid, order.begin() + range.second, [&](unsigned int a, unsigned int b) {
+			return centroids[a][axis] < centroids[b][axis];
+		});
+		stack.push_back({ mid, range.second });
+		stack.push_back({ range.first, mid });
+	}
+
+	std::vector<Chunk> chunks(chunkRanges.size());
+	std::vector<std::future<void>> futures;
+	for (size_t c = 0; c < chunkRanges.size(); ++c) {
+		futures.push_back(Threading::pool.queue([&, c](uint32_t &rng) {
+			std::string name = p.stem().string() + "." + std::to_string(c) + ".tmesh";
+			if (name.size() >= sizeof(chunks[c].file)) throw std::invalid_argument("Chunk file name too long: " + name);
+			std::filesystem::path chunkPath = p.parent_path() / name;
+			std::vector<unsigned int> chunkOrder(order.begin() + chunkRanges[c].first, order.begin() + chunkRanges[c].second);
+			AABB bounds = writeChunk(chunkPath, mesh, chunkOrder, triMaterials, materials, heuristic, cost);
+			Chunk& chunk = chunks[c];
+			chunk = {};
+			chunk.bounds[0] = bounds.minX;
+			chunk.bounds[1] = bounds.minY;
+			chunk.bounds[2] = bounds.minZ;
+			chunk.bounds[3] = bounds.maxX;
+			chunk.bounds[4] = bounds.maxY;
+			chunk.bounds[5] = bounds.maxZ;
+			chunk.nTriangles = chunkOrder.size();
+			chunk.size = std::filesystem::file_size(chunkPath);
+			strncpy(chunk.file, name.c_str(), sizeof(chunk.file));
+		}));
+	}
+	Threading::pool.wait(futures);
+
+	std::ofstream file(p, std::ios::binary);
+	if (!file.is_open()) throw std::invalid_argument("Cannot write " + p.string());
+	Header header = {};
+	memcpy(header.sign, "TRMS", 4);
+	header.version = version;
+	header.nChunks = chunks.size();
+	header.nMaterials = materials.size();
+	header.nTriangles = mesh.nTriangles;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(materials.data()), materials.size() * sizeof(MeshFile::Material));
+	file.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(Chunk));
+	if (!file.good()) throw std::invalid_argument("Failed writing " + p.string());
+}
+
+MeshStream::Index MeshStream::readIndex(const std::filesystem::path& p) {
+	std::ifstream file(p, std::ios::binary);
+	if (!file.is_open()) throw std::invalid_argument("Cannot open " + p.string());
+	Index index;
+	if (!file.read(reinterpret_cast<char*>(&index.header), sizeof(Header)) || memcmp(index.header.sign, "TRMS", 4) != 0)
+		throw std::invalid_argument(p.string() + " is not a mesh stream");
+	if (index.header.version != version) throw std::invalid_argument(p.string() + " has an unsupported version");
+	if (index.header.nChunks == 0) throw std::invalid_argument(p.string() + " has no chunks");
+	index.materials.resize(index.header.nMaterials);
+	index.chunks.resize(index.header.nChunks);
+	file.read(reinterpret_cast<char*>(index.materials.data()), index.materials.size() * sizeof(MeshFile::Material));
+	file.read(reinterpret_cast<char*>(index.chunks.data()), index.chunks.size() * sizeof(Chunk));
+	if (!file) throw std::invalid_argument(p.string() + " is truncated");
+	// Chunks are loaded while rendering, where a failure can only be skipped: check what can be checked
+	// without mapping them now. Loading a chunk only checks that its header is unchanged; TraceyConvert check=
+	// checks the indices stored in its other sections.
+	for (auto& chunk : index.chunks) {
+		chunk.file[sizeof(chunk.file) - 1] = '\0';
+		std::filesystem::path chunkPath = p.parent_path() / chunk.file;
+		std::ifstream chunkFile(chunkPath, std::ios::binary);
+		if (!chunkFile.is_open()) throw std::invalid_argument("Missing chunk " + std::string(chunk.file) + " of " + p.string());
+		MeshFile::Header header;
+		if (!chunkFile.read(reinterpret_cast<char*>(&header), sizeof(header))) throw std::invalid_argument(chunkPath.string() + " is not a mesh file");
+		MeshFile::checkHeader(header, std::filesystem::file_size(chunkPath), chunkPath.string());
+		if (header.nTriangles == 0 || header.nTriangles != chunk.nTriangles || std::filesystem::file_size(chunkPath) != chunk.size)
+			throw std::invalid_argument(chunkPath.string() + " doesn't match the index " + p.string());
+		if (header.nMaterials != index.header.nMaterials) throw std::invalid_argument(chunkPath.string() + " has other materials than the index");
+		if (!header.offsets[MeshFile::BVH_NODES] || !header.offsets[MeshFile::BVH_PRIMITIVES]) throw std::invalid_argument(chunkPath.string() + " has no BVH");
+		std::vector<MeshFile::MaterialRange> ranges(header.nMaterialRanges);
+		chunkFile.seekg(header.offsets[MeshFile::MATERIAL_RANGES]);
+		if (!chunkFile.read(reinterpret_cast<char*>(ranges.data()), ranges.size() * sizeof(MeshFile::MaterialRange)))
+			throw std::invalid_argument(chunkPath.string() + " is truncated");
+		MeshFile::checkMaterialRanges(header, ranges.data(), chunkPath.string());
+	}
+	return index;
+}
+
+BVHPtr MeshStream::load(const std::filesystem::path& p, const Index& index, std::shared_ptr<const std::vector<int>> materials) {
+	std::vector<HittablePtr> chunks;
+	for (auto& chunk : index.chunks) {
+		AABB bounds = { chunk.bounds[0], chunk.bounds[1], chunk.bounds[2], chunk.bounds[3], chunk.bounds[4], chunk.bounds[5] };
+		chunks.push_back(std::make_shared<StreamedChunk>(p.parent_path() / chunk.file, bounds, chunk.size, materials));
+	}
+	// Chunks are expensive to test (and possibly to load): give each its own leaf
+	SAHCost cost;
+	cost.maxLeafSize = 1;
+	return std::make_shared<BVH>(chunks, Heuristic::SAH, false, cost);
+}
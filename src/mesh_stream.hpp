@@ -0,0 +1,57 @@
+#ifndef __MESH_STREAM_HPP__
+#define __MESH_STREAM_HPP__
+
+#include "bvh.hpp"
+#include "mesh_file.hpp"
+
+#include <vector>
+#include <string>
+#include <filesystem>
+
+// Out of core meshes (.tstream). The triangles of a mesh are split spatially in chunks, each written as a
+// mesh file with its own BVH next to the index. Loading a scene only reads the index (the materials and
+// the bounds of the chunks) and builds a BVH over the chunks; a chunk is mapped the first time a ray
+// reaches its bounds, and unmapped again by the ChunkCache when the mapped chunks exceed its budget.
+// The index is a Header, followed by nMaterials MeshFile::Material and nChunks Chunk.
+namespace MeshStream {
+	constexpr uint32_t version = 1;
+
+	struct Header {
+		char sign[4]; // "TRMS"
+		uint32_t version;
+		uint32_t nChunks;
+		uint32_t nMaterials;
+		uint64_t nTriangles;
+	};
+
+	struct Chunk {
+		float bounds[6];
+		uint32_t nTriangles;
+		uint32_t padding;
+		uint64_t size; // Bytes of the chunk file
+		char file[256]; // Relative to the index
+	};
+
+	struct Index {
+		Header header;
+		std::vector<MeshFile::Material> materials;
+		std::vector<Chunk> chunks;
+	};
+
+	// Splits the mesh in chunks of at most chunkTriangles triangles, by halving the triangles along the longest
+	// axis of their centroids, and writes them with their BVH and the index at p. Every chunk file has all
+	// the materials, so that it can also be loaded as a mesh file on its own.
+	// Throws std::invalid_argument on failure.
+	void write(const std::filesystem::path& p, const TriangleMesh& mesh, const std::vector<MeshFile::Material>& materials,
+			const std::vector<MeshFile::MaterialRange>& ranges, size_t chunkTriangles, Heuristic heuristic, SAHCost cost);
+
+	// Throws std::invalid_argument if the index isn't valid, or a chunk file is missing or its header or material
+	// ranges aren't valid
+	Index readIndex(const std::filesystem::path& p);
+
+	// BVH over the chunks of the index, which are loaded on demand. materials maps the materials of the index
+	// to the ones of the scene; it can be filled until rendering starts.
+	BVHPtr load(const std::filesystem::path& p, const Index& index, std::shared_ptr<const std::vector<int>> materials);
+};
+
+#endif
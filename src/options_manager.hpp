@@ -15,6 +15,8 @@ enum class Options {
 	W_HEIGHT,
 	THREADS,
 	SCALING,
+	PACKET_SIZE,
+	STREAM_BUDGET,
 };
 
 class OptionsMap{
@@ -48,6 +50,8 @@ class OptionsMap{
 			std::cout << "TILE_WIDTH: \t\t" << opts[Options::TILE_WIDTH] << std::endl;
 			std::cout << "TILE_HEIGHT: \t\t" << opts[Options::TILE_HEIGHT] << std::endl;
 			std::cout << "THREADS: \t\t" << opts[Options::THREADS] << std::endl;
+			std::cout << "PACKET_SIZE: \t\t" << opts[Options::PACKET_SIZE] << std::endl;
+			std::cout << "STREAM_BUDGET: \t\t" << opts[Options::STREAM_BUDGET] << std::endl;
 		}
 
 
@@ -64,6 +68,8 @@ class OptionsMap{
 			opts[Options::TILE_HEIGHT] = 16;
 			opts[Options::SCALING] = 1;
 			opts[Options::THREADS] = 1;
+			opts[Options::PACKET_SIZE] = 8;
+			opts[Options::STREAM_BUDGET] = 4096; // MB
 		};
 
 		~OptionsMap(){
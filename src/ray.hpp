@@ -3,6 +3,15 @@
 
 #include "glm/vec3.hpp"
 #include "glm/gtx/norm.hpp"
+#include <cstdint>
+
+// What kind of query a ray is answering; objects use the same bits to say which rays can see them.
+enum RayType : uint8_t {
+	RAY_CAMERA = 1 << 0,
+	RAY_SHADOW = 1 << 1,
+	RAY_REFLECTION = 1 << 2, // Every secondary ray spawned by a material, refractions included
+	RAY_ALL = RAY_CAMERA | RAY_SHADOW | RAY_REFLECTION
+};
 
 class Ray{
 	public:
@@ -28,6 +37,12 @@ class Ray{
 		inline void setCurrentRefraction(const float idx) {
 			this->currentRefraction = idx;
 		}
+		inline uint8_t getType() const {
+			return this->type;
+		}
+		inline void setType(const uint8_t t) {
+			this->type = t;
+		}
 
 		inline Ray transformRay(glm::fmat4x4 transform) const {
 			auto newDir = transform * glm::fvec4(direction, 0);
@@ -36,6 +51,7 @@ class Ray{
 			ret.origin = newOg;
 			ret.direction = newDir;
 			ret.directionInv = 1.0f/ret.direction;
+			ret.type = type;
 			return ret;
 		}
 
@@ -45,6 +61,7 @@ class Ray{
 		glm::fvec3 direction;
 		glm::fvec3 directionInv;
 		float currentRefraction;
+		uint8_t type = RAY_ALL;
 };
 
 #endif
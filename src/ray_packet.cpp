@@ -0,0 +1,124 @@
+#include "ray_packet.hpp"
+
+void RayPacket::setRay(int i, const Ray& ray, float rayTMax) {
+	rays[i] = ray;
+	tMax[i] = rayTMax;
+}
+
+void RayPacket::finalize(uint64_t mask) {
+	coherent = mask != 0;
+	originMin = glm::fvec3(INF);
+	originMax = glm::fvec3(-INF);
+	inverseMin = glm::fvec3(INF);
+	inverseMax = glm::fvec3(-INF);
+	maxTMax = -INF;
+	bool first = true;
+	for (int i = 0; i < size; ++i) {
+		if (!(mask & (1ull << i))) continue;
+		const glm::fvec3 origin = rays[i].getOrigin();
+		const glm::fvec3 direction = rays[i].getDirection();
+		const glm::fvec3 inverse = rays[i].getInverseDirection();
+		ox[i] = origin.x;
+		oy[i] = origin.y;
+		oz[i] = origin.z;
+		idx[i] = inverse.x;
+		idy[i] = inverse.y;
+		idz[i] = inverse.z;
+
+		for (int a = 0; a < 3; ++a) {
+			// Axis aligned directions have infinite inverses, which the interval bounds can't handle
+			if (direction[a] == 0.0f) coherent = false;
+			bool neg = direction[a] < 0.0f;
+			if (first) negative[a] = neg;
+			else if (negative[a] != neg) coherent = false;
+			originMin[a] = min(originMin[a], origin[a]);
+			originMax[a] = max(originMax[a], origin[a]);
+			inverseMin[a] = min(inverseMin[a], inverse[a]);
+			inverseMax[a] = max(inverseMax[a], inverse[a]);
+		}
+		maxTMax = max(maxTMax, tMax[i]);
+		first = false;
+	}
+}
+
+void RayPacket::transform(const glm::mat4& m, uint64_t mask, RayPacket& out) const {
+	out.size = size;
+	out.type = type;
+	for (int i = 0; i < size; ++i) {
+		if (!(mask & (1ull << i))) continue;
+		out.rays[i] = rays[i].transformRay(m);
+		out.tMax[i] = tMax[i];
+	}
+	out.finalize(mask);
+}
+
+bool RayPacket::mayHitAABB(const glm::fvec4& minAABB, const glm::fvec4& maxAABB) const {
+	float tEnter = 0.0f;
+	float tExit = INF;
+	for (int a = 0; a < 3; ++a) {
+		// Every ray enters the slab through the same plane since they share the octant
+		const float nearPlane = negative[a] ? maxAABB[a] : minAABB[a];
+		const float farPlane = negative[a] ? minAABB[a] : maxAABB[a];
+		const float n0 = nearPlane - originMin[a];
+		const float n1 = nearPlane - originMax[a];
+		const float f0 = farPlane - originMin[a];
+		const float f1 = farPlane - originMax[a];
+		const float nearLo = min(min(n0 * inverseMin[a], n0 * inverseMax[a]), min(n1 * inverseMin[a], n1 * inverseMax[a]));
+		const float farHi = max(max(f0 * inverseMin[a], f0 * inverseMax[a]), max(f1 * inverseMin[a], f1 * inverseMax[a]));
+		tEnter = max(tEnter, nearLo);
+		tExit = min(tExit, farHi);
+	}
+	return tEnter <= tExit && tEnter <= maxTMax;
+}
+
+#if defined(SIMD_ENABLED)
+
+using namespace simd;
+
+uint64_t RayPacket::hitAABB(const glm::fvec4& minAABB, const glm::fvec4& maxAABB, uint64_t mask) const {
+	const uint64_t laneBits = (1ull << SIMD_WIDTH) - 1;
+	const vfloat minX = vset(minAABB.x);
+	const vfloat minY = vset(minAABB.y);
+	const vfloat minZ = vset(minAABB.z);
+	const vfloat maxX = vset(maxAABB.x);
+	const vfloat maxY = vset(maxAABB.y);
+	const vfloat maxZ = vset(maxAABB.z);
+	uint64_t hits = 0;
+	for (int i = 0; i < size; i += SIMD_WIDTH) {
+		if (((mask >> i) & laneBits) == 0) continue;
+		const vfloat x = vload(ox + i);
+		const vfloat y = vload(oy + i);
+		const vfloat z = vload(oz + i);
+		const vfloat ix = vload(idx + i);
+		const vfloat iy = vload(idy + i);
+		const vfloat iz = vload(idz + i);
+		const vfloat tx1 = vmul(vsub(minX, x), ix);
+		const vfloat tx2 = vmul(vsub(maxX, x), ix);
+		const vfloat ty1 = vmul(vsub(minY, y), iy);
+		const vfloat ty2 = vmul(vsub(maxY, y), iy);
+		const vfloat tz1 = vmul(vsub(minZ, z), iz);
+		const vfloat tz2 = vmul(vsub(maxZ, z), iz);
+		vfloat tNear = vmax(vmax(vmin(tx1, tx2), vmin(ty1, ty2)), vmin(tz1, tz2));
+		const vfloat tFar = vmin(vmin(vmax(tx1, tx2), vmax(ty1, ty2)), vmax(tz1, tz2));
+		tNear = vmax(tNear, vset(0.0f));
+		const vfloat hit = vand(vge(tFar, tNear), vlt(tNear, vload(tMax + i)));
+		hits |= (uint64_t)vmask(hit) << i;
+	}
+	return hits & mask;
+}
+
+#else
+
+uint64_t RayPacket::hitAABB(const glm::fvec4& minAABB, const glm::fvec4& maxAABB, uint64_t mask) const {
+	uint64_t hits = 0;
+	for (int i = 0; i < size; ++i) {
+		if (!(mask & (1ull << i))) continue;
+		float distance;
+		if (::hitAABB(rays[i], minAABB, maxAABB, distance) && distance < tMax[i]) {
+			hits |= 1ull << i;
+		}
+	}
+	return hits;
+}
+
+#endif
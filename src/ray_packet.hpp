@@ -0,0 +1,55 @@
+#ifndef __RAY_PACKET_HPP__
+#define __RAY_PACKET_HPP__
+
+#include "defs.hpp"
+#include "simd.hpp"
+#include "glm/mat4x4.hpp"
+#include <cstdint>
+
+// Up to 8x8 coherent rays traced together through the BVHs. Rays are kept as Ray objects for the
+// primitives and for the single ray fallback, and as SoA arrays for the SIMD box tests.
+// Active rays are selected by a bitmask, bit i being rays[i].
+class RayPacket {
+	public:
+		static constexpr int maxSize = 64;
+
+		RayPacket() : size(0), type(RAY_ALL), coherent(false) {}
+
+		void setRay(int i, const Ray& ray, float rayTMax);
+		// Must be called once the rays are set: recomputes the SoA arrays and the packet bounds
+		void finalize(uint64_t mask);
+		// The rays in mask moved to another space. Directions are not renormalized, so t and tMax are unchanged.
+		void transform(const glm::mat4& m, uint64_t mask, RayPacket& out) const;
+
+		// Interval arithmetic over the whole packet: false only if none of its rays can hit the box
+		bool mayHitAABB(const glm::fvec4& minAABB, const glm::fvec4& maxAABB) const;
+		// Per ray slab tests: the rays of mask that hit the box before their tMax
+		uint64_t hitAABB(const glm::fvec4& minAABB, const glm::fvec4& maxAABB, uint64_t mask) const;
+
+		// Coherent packets have all the directions in the same octant; the others are traced ray by ray
+		inline bool isCoherent() const { return coherent; }
+		inline bool isNegative(int axis) const { return negative[axis]; }
+
+		int size;
+		uint8_t type;
+		Ray rays[maxSize];
+		alignas(32) float tMax[maxSize];
+
+	private:
+		alignas(32) float ox[maxSize];
+		alignas(32) float oy[maxSize];
+		alignas(32) float oz[maxSize];
+		alignas(32) float idx[maxSize];
+		alignas(32) float idy[maxSize];
+		alignas(32) float idz[maxSize];
+
+		bool coherent;
+		bool negative[3];
+		glm::fvec3 originMin;
+		glm::fvec3 originMax;
+		glm::fvec3 inverseMin;
+		glm::fvec3 inverseMax;
+		float maxTMax;
+};
+
+#endif
@@ -0,0 +1,534 @@
+#include "bvh.hpp"
+#include "importer.hpp"
+#include "options_manager.hpp"
+#include "thread_pool.hpp"
+#include "hittables/curve_block.hpp"
+#include "hittables/curve_mesh.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Checks the fast intersection paths against their reference on random scenes, printing the time taken by both.
+// Returns 1 if any check finds different hits; run by ctest.
+
+namespace {
+	struct Timer {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		float ms() const {
+			return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+	};
+
+	bool sameHit(bool hitA, float tA, bool hitB, float tB, float tolerance) {
+		return hitA == hitB && (!hitA || std::fabs(tA - tB) <= tolerance * max(tA, tB));
+	}
+
+	// Mismatches up to allowed out of n rays pass, for the iterations that may converge to a slightly different point
+	bool report(const char* name, int mismatches, int allowed, size_t n, int hits, float fastMs, float referenceMs) {
+		bool passed = mismatches <= allowed;
+		std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << mismatches << " different hits out of " << n << " rays (" << hits
+			<< " hits), " << fastMs << "ms instead of " << referenceMs << "ms" << std::endl;
+		return passed;
+	}
+
+	// Scalar Moller-Trumbore, with the tests of the triangle blocks
+	bool hitTriangle(const TriangleMesh& mesh, unsigned int triangle, const Ray& ray, float tMin, float tMax, float& t) {
+		glm::vec3 v0, v1, v2;
+		mesh.getVertices(triangle, v0, v1, v2);
+		const glm::fvec3 e1 = v1 - v0;
+		const glm::fvec3 e2 = v2 - v0;
+		const glm::fvec3 p = glm::cross(ray.getDirection(), e2);
+		const float det = glm::dot(e1, p);
+		if (std::fabs(det) < EPS) return false;
+		const float inv = 1.0f / det;
+		const glm::fvec3 tv = ray.getOrigin() - v0;
+		const float u = glm::dot(tv, p) * inv;
+		const glm::fvec3 q = glm::cross(tv, e1);
+		const float v = glm::dot(ray.getDirection(), q) * inv;
+		if (u < 0.0f || v < 0.0f || u + v > 1.0f) return false;
+		t = glm::dot(e2, q) * inv;
+		return t > tMin && t < tMax;
+	}
+
+	// Mesh BVHs, whose leaves are only tested through their triangle blocks, against every triangle of the mesh:
+	// single rays and packets, through the binary and the compressed nodes
+	bool checkTriangleBlocks() {
+		std::mt19937 rng(33);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const unsigned int nTriangles = 4000;
+		std::vector<glm::vec3> p(3 * nTriangles);
+		std::vector<glm::vec3> n(3 * nTriangles, glm::vec3(0.0f, 0.0f, 1.0f));
+		std::vector<unsigned int> indices(3 * nTriangles);
+		for (unsigned int i = 0; i < 3 * nTriangles; ++i) {
+			glm::vec3 center = i % 3 == 0 ? glm::vec3(unit(rng), unit(rng), unit(rng)) : p[i - i % 3];
+			p[i] = center + (glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * 0.1f;
+			indices[i] = i;
+		}
+		auto mesh = std::make_shared<TriangleMesh>("check", nTriangles, 3 * nTriangles, indices.data(), p.data(), n.data(), nullptr);
+		BVH binary(mesh);
+		BVH compressed(mesh);
+		compressed.compressNodes();
+
+		// Packets of 8x8 rays from the same origin, towards a random point of the cube
+		const int nPackets = 32;
+		std::vector<RayPacket> packets(nPackets);
+		for (auto& packet : packets) {
+			glm::fvec3 origin = glm::fvec3(0.5f) + 2.0f * glm::normalize(glm::fvec3(unit(rng), unit(rng), unit(rng)) - 0.5f);
+			glm::fvec3 direction = glm::normalize(glm::fvec3(unit(rng), unit(rng), unit(rng)) - origin);
+			glm::fvec3 x = glm::normalize(glm::cross(direction, glm::fvec3(0.0f, 1.0f, 0.0f)));
+			glm::fvec3 y = glm::cross(direction, x);
+			packet.size = RayPacket::maxSize;
+			packet.type = RAY_CAMERA;
+			for (int i = 0; i < packet.size; ++i) {
+				Ray ray(origin, glm::normalize(direction + 0.02f * ((i % 8 - 3.5f) * x + (i / 8 - 3.5f) * y)));
+				ray.setType(RAY_CAMERA);
+				packet.setRay(i, ray, INF);
+			}
+			packet.finalize(~0ull);
+		}
+
+		const size_t nRays = nPackets * RayPacket::maxSize;
+		std::vector<float> singleT(nRays, INF), packetT(nRays, INF), compressedT(nRays, INF);
+		Timer fastTimer;
+		for (int k = 0; k < nPackets; ++k) {
+			HitRecord recs[RayPacket::maxSize];
+			for (int i = 0; i < RayPacket::maxSize; ++i) {
+				if (binary.hit(packets[k].rays[i], EPS, INF, recs[i])) singleT[k * RayPacket::maxSize + i] = recs[i].t;
+			}
+			RayPacket packet = packets[k];
+			uint64_t hits = binary.hitPacket(packet, ~0ull, EPS, recs);
+			for (int i = 0; i < RayPacket::maxSize; ++i) {
+				if (hits & (1ull << i)) packetT[k * RayPacket::maxSize + i] = recs[i].t;
+			}
+			packet = packets[k];
+			hits = compressed.hitPacket(packet, ~0ull, EPS, recs);
+			for (int i = 0; i < RayPacket::maxSize; ++i) {
+				if (hits & (1ull << i)) compressedT[k * RayPacket::maxSize + i] = recs[i].t;
+			}
+		}
+		float fastMs = fastTimer.ms();
+
+		int mismatches = 0;
+		int hits = 0;
+		Timer referenceTimer;
+		for (size_t r = 0; r < nRays; ++r) {
+			const Ray& ray = packets[r / RayPacket::maxSize].rays[r % RayPacket::maxSize];
+			float referenceT = INF;
+			for (unsigned int i = 0; i < nTriangles; ++i) {
+				float t;
+				if (hitTriangle(*mesh, i, ray, EPS, referenceT, t)) referenceT = t;
+			}
+			hits += referenceT < INF;
+			if (!sameHit(singleT[r] < INF, singleT[r], referenceT < INF, referenceT, 1e-5f) ||
+					!sameHit(packetT[r] < INF, packetT[r], referenceT < INF, referenceT, 1e-5f) ||
+					!sameHit(compressedT[r] < INF, compressedT[r], referenceT < INF, referenceT, 1e-5f)) {
+				++mismatches;
+			}
+		}
+		return report("Triangle blocks of binary and compressed BVHs against every triangle", mismatches, 0, nRays, hits,
+			fastMs, referenceTimer.ms());
+	}
+
+	// Strands of 4 segments random Bezier curves in the unit cube
+	std::shared_ptr<CurveMesh> randomCurves(std::mt19937& rng, int nCurves) {
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		auto curves = std::make_shared<CurveMesh>(0);
+		for (int c = 0; c < nCurves; ++c) {
+			glm::fvec3 cp[4];
+			cp[0] = glm::fvec3(unit(rng), unit(rng), unit(rng));
+			for (int i = 1; i < 4; ++i) {
+				cp[i] = cp[i - 1] + (glm::fvec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * 0.1f;
+			}
+			curves->addCurve(cp, 0.002f + 0.008f * unit(rng), 0.002f + 0.008f * unit(rng));
+		}
+		curves->split(4);
+		return curves;
+	}
+
+	// Rays from every direction aimed close to a random point of a random curve, so that most of them hit one
+	std::vector<Ray> curveRays(std::mt19937& rng, const CurveMesh& curves, int nRays) {
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::uniform_int_distribution<size_t> curve(0, curves.curveCount() - 1);
+		std::vector<Ray> rays;
+		for (int i = 0; i < nRays; ++i) {
+			const BezierCurve& c = curves.getCurve(curve(rng));
+			float u = unit(rng);
+			glm::fvec3 target = EvalBezier(c.p, u) + (glm::fvec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * lerp(c.width[0], c.width[1], u);
+			glm::fvec3 direction = glm::normalize(glm::fvec3(unit(rng), unit(rng), unit(rng)) - 0.5f);
+			rays.emplace_back(target - 2.0f * direction, direction);
+		}
+		return rays;
+	}
+
+	// pbrt's recursive intersection in the ray frame of hitPBRT, to the same depth and with the same tests, but
+	// visiting every span that overlaps the ray: what hitPBRT computed before walking the spans with a stack.
+	struct RecursivePBRT {
+		const BezierCurve& curve;
+		float tMin;
+		float rayLength;
+		float zMax;
+		bool hit = false;
+
+		void intersect(const glm::fvec3 cp[4], float u0, float u1, int depth) {
+			float radius = 0.5f * max(lerp(curve.width[0], curve.width[1], u0), lerp(curve.width[0], curve.width[1], u1));
+			glm::fvec3 bMin = cp[0], bMax = cp[0];
+			for (int i = 1; i < 4; ++i) {
+				bMin = glm::min(bMin, cp[i]);
+				bMax = glm::max(bMax, cp[i]);
+			}
+			if (bMin.x - radius > 0.0f || bMax.x + radius < 0.0f || bMin.y - radius > 0.0f || bMax.y + radius < 0.0f ||
+					bMin.z - radius > zMax || bMax.z + radius < 0.0f) {
+				return;
+			}
+			if (depth > 0) {
+				glm::fvec3 cpSplit[7];
+				SubdivideBezier(cp, cpSplit);
+				float uMid = 0.5f * (u0 + u1);
+				intersect(&cpSplit[0], u0, uMid, depth - 1);
+				intersect(&cpSplit[3], uMid, u1, depth - 1);
+				return;
+			}
+			if ((cp[1].y - cp[0].y) * -cp[0].y + cp[0].x * (cp[0].x - cp[1].x) < 0) return;
+			if ((cp[2].y - cp[3].y) * -cp[3].y + cp[3].x * (cp[3].x - cp[2].x) < 0) return;
+			glm::fvec2 segmentDirection = glm::fvec2(cp[3]) - glm::fvec2(cp[0]);
+			float denom = glm::dot(segmentDirection, segmentDirection);
+			if (denom == 0) return;
+			float w = glm::dot(-glm::fvec2(cp[0]), segmentDirection) / denom;
+			float u = std::clamp(lerp(u0, u1, w), u0, u1);
+			float hitWidth = lerp(curve.width[0], curve.width[1], u);
+			glm::fvec3 pc = EvalBezier(cp, std::clamp(w, 0.0f, 1.0f));
+			if (pc.x * pc.x + pc.y * pc.y > hitWidth * hitWidth * .25f) return;
+			if (pc.z < 0 || pc.z > zMax || pc.z < tMin * rayLength) return;
+			zMax = pc.z;
+			hit = true;
+		}
+	};
+
+	bool hitPBRTRecursive(const CurveMesh& curves, size_t segment, const Ray& ray, float tMin, float tMax, float& t) {
+		const CurveSegment& s = curves.getSegment(segment);
+		const BezierCurve& curve = curves.getCurve(s.curve);
+		glm::fvec3 localCPts[4];
+		curves.getControlPoints(segment, localCPts);
+		const float rayLength = glm::length(ray.getDirection());
+		const glm::fvec3 frameZ = ray.getDirection() / rayLength;
+		const float sign = std::copysign(1.0f, frameZ.z);
+		const float a = -1.0f / (sign + frameZ.z);
+		const float b = frameZ.x * frameZ.y * a;
+		const glm::fvec3 frameX(1.0f + sign * frameZ.x * frameZ.x * a, sign * b, -sign * frameZ.x);
+		const glm::fvec3 frameY(b, sign + frameZ.y * frameZ.y * a, -frameZ.y);
+		glm::fvec3 rayCPts[4];
+		for (int i = 0; i < 4; ++i) {
+			glm::fvec3 d = localCPts[i] - ray.getOrigin();
+			rayCPts[i] = glm::fvec3(glm::dot(d, frameX), glm::dot(d, frameY), glm::dot(d, frameZ));
+		}
+		float L0 = 0;
+		for (int i = 0; i < 2; ++i) {
+			glm::fvec3 d = rayCPts[i] - 2.0f * rayCPts[i + 1] + rayCPts[i + 2];
+			L0 = max(L0, max(max(fabsf(d.x), fabsf(d.y)), fabsf(d.z)));
+		}
+		float eps = max(curve.width[0], curve.width[1]) * .05f;
+		float fr0 = L0 > 0.0f ? std::log(1.41421356237f * 12.f * L0 / (8.f * eps)) * 0.7213475108f : 0.0f;
+		int depth = std::clamp((int)std::round(fr0), 0, CurveMesh::maxPBRTDepth);
+
+		RecursivePBRT recursion{ curve, tMin, rayLength, rayLength * tMax };
+		recursion.intersect(rayCPts, s.uMin, s.uMax, depth);
+		if (recursion.hit) t = recursion.zMax / rayLength;
+		return recursion.hit;
+	}
+
+	// The iterative hitPBRT against the recursion, behind the bounds of the segments. Both find the same spans,
+	// so the closest hits must be the same.
+	bool checkPBRT() {
+		std::mt19937 rng(50);
+		auto curves = randomCurves(rng, 300);
+		curves->cacheSegments();
+		std::vector<AABB> bounds(curves->segmentCount());
+		for (size_t s = 0; s < bounds.size(); ++s) {
+			bounds[s] = curves->getBounds(s);
+		}
+		auto rays = curveRays(rng, *curves, 2000);
+
+		std::vector<float> fastT(rays.size(), INF);
+		Timer fastTimer;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			for (size_t s = 0; s < bounds.size(); ++s) {
+				float distance;
+				HitRecord rec;
+				if (!hitAABB(rays[i], bounds[s], distance) || distance > fastT[i]) continue;
+				if (curves->hitPBRT(s, rays[i], EPS, fastT[i], rec)) fastT[i] = rec.t;
+			}
+		}
+		float fastMs = fastTimer.ms();
+
+		int mismatches = 0;
+		int hits = 0;
+		Timer referenceTimer;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			float referenceT = INF;
+			for (size_t s = 0; s < bounds.size(); ++s) {
+				float distance;
+				float t;
+				if (!hitAABB(rays[i], bounds[s], distance) || distance > referenceT) continue;
+				if (hitPBRTRecursive(*curves, s, rays[i], EPS, referenceT, t)) referenceT = t;
+			}
+			hits += referenceT < INF;
+			if (!sameHit(fastT[i] < INF, fastT[i], referenceT < INF, referenceT, 1e-5f)) ++mismatches;
+		}
+		return report("Iterative CurveMesh::hitPBRT against the recursive subdivision", mismatches, 0, rays.size(), hits,
+			fastMs, referenceTimer.ms());
+	}
+
+	// Random strands, 30% curly and the others nearly straight, split adaptively: each curve must be tiled in order by
+	// its segments, all flat enough or as short as allowed. Also prints the time taken to trace the BVH of the
+	// segments against 4 uniform segments per curve.
+	bool checkAdaptiveSplit() {
+		const float tolerance = 0.5f;
+		std::mt19937 rng(47);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		auto adaptive = std::make_shared<CurveMesh>(0);
+		auto uniform = std::make_shared<CurveMesh>(0);
+		for (int c = 0; c < 2000; ++c) {
+			glm::fvec3 cp[4];
+			cp[0] = glm::fvec3(unit(rng), unit(rng), unit(rng));
+			glm::fvec3 direction = glm::normalize(glm::fvec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * 0.05f;
+			float curl = unit(rng) < 0.3f ? 0.1f : 0.001f;
+			for (int i = 1; i < 4; ++i) {
+				cp[i] = cp[i - 1] + direction + (glm::fvec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * curl;
+			}
+			float width0 = 0.002f + 0.008f * unit(rng);
+			float width1 = 0.002f + 0.008f * unit(rng);
+			adaptive->addCurve(cp, width0, width1);
+			uniform->addCurve(cp, width0, width1);
+		}
+		adaptive->splitAdaptive(tolerance);
+		uniform->split(4);
+
+		int badSegments = 0;
+		float uNext = 0.0f;
+		uint32_t curve = 0;
+		for (size_t s = 0; s < adaptive->segmentCount(); ++s) {
+			const CurveSegment& segment = adaptive->getSegment(s);
+			if (segment.curve != curve) {
+				if (uNext != 1.0f || segment.curve != curve + 1) ++badSegments;
+				curve = segment.curve;
+				uNext = 0.0f;
+			}
+			if (segment.uMin != uNext) ++badSegments;
+			uNext = segment.uMax;
+			glm::fvec3 cp[4];
+			adaptive->getControlPoints(s, cp);
+			float L0 = 0;
+			for (int i = 0; i < 2; ++i) {
+				glm::fvec3 d = cp[i] - 2.0f * cp[i + 1] + cp[i + 2];
+				L0 = max(L0, max(max(fabsf(d.x), fabsf(d.y)), fabsf(d.z)));
+			}
+			const float* width = adaptive->getCurve(curve).width;
+			float maxWidth = max(lerp(width[0], width[1], segment.uMin), lerp(width[0], width[1], segment.uMax));
+			bool shortest = segment.uMax - segment.uMin == 1.0f / (1 << CurveMesh::maxAdaptiveDepth);
+			// The control points of the segment are blossomed instead of subdivided: a little rounding is fine
+			if (!shortest && L0 > tolerance * maxWidth * 1.001f) ++badSegments;
+		}
+		if (uNext != 1.0f || curve + 1 != adaptive->curveCount()) ++badSegments;
+
+		BVH adaptiveBVH(adaptive);
+		BVH uniformBVH(uniform);
+		auto rays = curveRays(rng, *adaptive, 20000);
+		int adaptiveHits = 0;
+		int uniformHits = 0;
+		Timer adaptiveTimer;
+		for (const auto& ray : rays) {
+			HitRecord rec;
+			adaptiveHits += adaptiveBVH.hit(ray, EPS, INF, rec);
+		}
+		float adaptiveMs = adaptiveTimer.ms();
+		Timer uniformTimer;
+		for (const auto& ray : rays) {
+			HitRecord rec;
+			uniformHits += uniformBVH.hit(ray, EPS, INF, rec);
+		}
+		float uniformMs = uniformTimer.ms();
+
+		bool passed = badSegments == 0;
+		std::cout << (passed ? "PASS " : "FAIL ") << "Adaptive curve segments: " << badSegments << " misplaced or curved segments out of "
+			<< adaptive->segmentCount() << " (" << uniform->segmentCount() << " uniform segments), " << rays.size() << " rays traced in "
+			<< adaptiveMs << "ms instead of " << uniformMs << "ms (" << adaptiveHits << " hits instead of " << uniformHits << ")" << std::endl;
+		return passed;
+	}
+
+	// The curves of a BEZ file as they were read before the native importers: a line and a stream per line
+	std::vector<BezierCurve> readBEZ(const std::filesystem::path& p) {
+		std::ifstream file(p);
+		std::string line;
+		std::getline(file, line);
+		std::vector<BezierCurve> curves(std::stoi(line));
+		for (auto& curve : curves) {
+			std::getline(file, line);
+			std::istringstream(line) >> curve.width[0] >> curve.width[1];
+			for (int i = 0; i < 4; ++i) {
+				std::getline(file, line);
+				std::istringstream(line) >> curve.p[i].x >> curve.p[i].y >> curve.p[i].z;
+			}
+		}
+		return curves;
+	}
+
+	int differentCurves(const std::vector<BezierCurve>& reference, const CurveMesh& curves) {
+		if (curves.curveCount() != reference.size()) return (int)reference.size();
+		auto close = [](float a, float b) { return fabsf(a - b) <= 1e-6f * max(1.0f, fabsf(a)); };
+		int different = 0;
+		for (size_t c = 0; c < reference.size(); ++c) {
+			const BezierCurve& a = reference[c];
+			const BezierCurve& b = curves.getCurve(c);
+			bool same = close(a.width[0], b.width[0]) && close(a.width[1], b.width[1]);
+			for (int i = 0; i < 4; ++i) {
+				same &= close(a.p[i].x, b.p[i].x) && close(a.p[i].y, b.p[i].y) && close(a.p[i].z, b.p[i].z);
+			}
+			different += !same;
+		}
+		return different;
+	}
+
+	// The same random curves written as a BEZ file and as the Shape "curve" statements of a PBRT file must be
+	// imported as they are read by the reference parser
+	bool checkImporters() {
+		const int nCurves = 100000;
+		std::mt19937 rng(49);
+		auto curves = randomCurves(rng, nCurves);
+		auto bezPath = std::filesystem::temp_directory_path() / "tracey_check.bez";
+		auto pbrtPath = std::filesystem::temp_directory_path() / "tracey_check.pbrt";
+		FILE* bez = fopen(bezPath.string().c_str(), "w");
+		FILE* pbrt = fopen(pbrtPath.string().c_str(), "w");
+		if (!bez || !pbrt) {
+			if (bez) fclose(bez);
+			if (pbrt) fclose(pbrt);
+			std::cout << "FAIL Curve importers: can't write to " << bezPath.parent_path() << std::endl;
+			return false;
+		}
+		fprintf(bez, "%d\n", nCurves);
+		fprintf(pbrt, "AttributeBegin\nMaterial \"hair\"\n");
+		for (int c = 0; c < nCurves; ++c) {
+			const BezierCurve& curve = curves->getCurve(c);
+			const glm::fvec3* p = curve.p;
+			fprintf(bez, "%.9g %.9g\n", curve.width[0], curve.width[1]);
+			for (int i = 0; i < 4; ++i) fprintf(bez, "%.9g %.9g %.9g\n", p[i].x, p[i].y, p[i].z);
+			fprintf(pbrt, "Shape \"curve\" \"string type\" [ \"cylinder\" ] \"point3 P\" [ %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g ] "
+				"\"float width0\" [ %.9g ] \"float width1\" [ %.9g ]\n", p[0].x, p[0].y, p[0].z, p[1].x, p[1].y, p[1].z, p[2].x, p[2].y,
+				p[2].z, p[3].x, p[3].y, p[3].z, curve.width[0], curve.width[1]);
+		}
+		fprintf(pbrt, "AttributeEnd\n");
+		fclose(bez);
+		fclose(pbrt);
+
+		Timer referenceTimer;
+		auto reference = readBEZ(bezPath);
+		float referenceMs = referenceTimer.ms();
+		CurveMesh bezCurves(0);
+		Timer bezTimer;
+		bool bezRead = Importer::importBEZ(bezPath, bezCurves);
+		float bezMs = bezTimer.ms();
+		CurveMesh pbrtCurves(0);
+		Timer pbrtTimer;
+		bool pbrtRead = Importer::importPBRT(pbrtPath, pbrtCurves);
+		float pbrtMs = pbrtTimer.ms();
+		std::filesystem::remove(bezPath);
+		std::filesystem::remove(pbrtPath);
+
+		int different = (bezRead ? differentCurves(reference, bezCurves) : nCurves) +
+			(pbrtRead ? differentCurves(reference, pbrtCurves) : nCurves);
+		bool passed = different == 0 && reference.size() == (size_t)nCurves;
+		std::cout << (passed ? "PASS " : "FAIL ") << "Curve importers: " << different << " different curves out of " << nCurves
+			<< " in BEZ and PBRT files, read in " << bezMs << "ms and " << pbrtMs << "ms instead of " << referenceMs
+			<< "ms with a stream per line" << std::endl;
+		return passed;
+	}
+
+#if defined(SIMD_ENABLED)
+	// The SIMD Phantom kernel against the scalar one, on the same lanes behind the same boxes. Both iterate to the
+	// same tolerance from the same end, but not in the same order of operations.
+	bool checkCurveBlocks() {
+		std::mt19937 rng(44);
+		auto curves = randomCurves(rng, 500);
+		curves->cacheSegments();
+		const size_t nSegments = curves->segmentCount();
+		std::vector<CurveBlock> blocks((nSegments + CURVE_BLOCK_LANES - 1) / CURVE_BLOCK_LANES);
+		std::vector<AABB> bounds(blocks.size(), AABB{ INF, INF, INF, -INF, -INF, -INF });
+		for (size_t b = 0; b < blocks.size(); ++b) {
+			for (int lane = 0; lane < CURVE_BLOCK_LANES; ++lane) {
+				size_t segment = b * CURVE_BLOCK_LANES + lane;
+				setCurveBlockLane(blocks[b], lane, segment < nSegments ? (int)segment : -1, *curves);
+				if (segment < nSegments) {
+					AABB box = curves->getBounds(segment);
+					bounds[b] = AABB{ min(bounds[b].minX, box.minX), min(bounds[b].minY, box.minY), min(bounds[b].minZ, box.minZ),
+						max(bounds[b].maxX, box.maxX), max(bounds[b].maxY, box.maxY), max(bounds[b].maxZ, box.maxZ) };
+				}
+			}
+			fitCurveBlockBox(blocks[b], *curves);
+		}
+		auto rays = curveRays(rng, *curves, 2000);
+
+		std::vector<HitRecord> fast(rays.size());
+		std::vector<bool> fastHits(rays.size(), false);
+		Timer fastTimer;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			float tMax = INF;
+			for (size_t b = 0; b < blocks.size(); ++b) {
+				float distance;
+				if (!hitAABB(rays[i], bounds[b], distance) || distance > tMax) continue;
+				if (hitCurveBlock(blocks[b], rays[i], EPS, tMax, fast[i])) {
+					tMax = fast[i].t;
+					fastHits[i] = true;
+				}
+			}
+		}
+		float fastMs = fastTimer.ms();
+
+		int mismatches = 0;
+		int hits = 0;
+		Timer referenceTimer;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			HitRecord reference;
+			bool referenceHit = false;
+			float tMax = INF;
+			for (size_t b = 0; b < blocks.size(); ++b) {
+				float distance;
+				if (!hitAABB(rays[i], bounds[b], distance) || distance > tMax) continue;
+				for (size_t s = b * CURVE_BLOCK_LANES; s < min((b + 1) * CURVE_BLOCK_LANES, nSegments); ++s) {
+					if (curves->hitPhantom(s, rays[i], EPS, tMax, reference)) {
+						tMax = reference.t;
+						referenceHit = true;
+					}
+				}
+			}
+			hits += referenceHit;
+			if (!sameHit(fastHits[i], fast[i].t, referenceHit, reference.t, 1e-3f)) ++mismatches;
+		}
+		return report("SIMD Phantom kernel against CurveMesh::hitPhantom", mismatches, rays.size() / 1000, rays.size(), hits,
+			fastMs, referenceTimer.ms());
+	}
+#endif
+}
+
+int main() {
+	OptionsMap::Instance()->setOption(Options::THREADS, 1);
+	Threading::pool.init(1);
+	bool passed = true;
+	passed &= checkTriangleBlocks();
+	passed &= checkAdaptiveSplit();
+	passed &= checkPBRT();
+	passed &= checkImporters();
+#if defined(SIMD_ENABLED)
+	passed &= checkCurveBlocks();
+#else
+	std::cout << "SKIP SIMD Phantom kernel: built without SIMD" << std::endl;
+#endif
+	return passed ? 0 : 1;
+}
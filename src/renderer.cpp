@@ -170,6 +170,28 @@ bool Renderer::coreRayTracing(int horizontalTiles, int verticalTiles, int tWidth
 			int bounces = this->nBounces;
 			futures.push_back(Threading::pool.queue([&, tileRow, tileCol, samples, bounces](uint32_t &rng){
 						CameraPtr cam = scene->getCamera();
+						const int packetSize = OptionsMap::Instance()->getOption(Options::PACKET_SIZE);
+						// Pinhole camera rays of the tile share a frustum: cull the top level BVH against it once
+						// and start every primary ray from the nodes left instead of the root
+						std::vector<BVHNode*> tileNodes;
+						const std::vector<BVHNode*> *startNodes = nullptr;
+						if (cam && cam->getCameraType() == CameraType::normal) {
+							Frustum frustum = cam->getFrustum(
+								static_cast<float>(tWidth * tileCol) / static_cast<float>(wWidth - 1),
+								static_cast<float>(tHeight * tileRow) / static_cast<float>(wHeight - 1),
+								static_cast<float>(tWidth * (tileCol + 1)) / static_cast<float>(wWidth - 1),
+								static_cast<float>(tHeight * (tileRow + 1)) / static_cast<float>(wHeight - 1));
+							if (scene->cullFrustum(frustum, tileNodes)) startNodes = &tileNodes;
+						}
+						if (cam && packetSize > 1 && packetSize * packetSize <= RayPacket::maxSize &&
+								tWidth % packetSize == 0 && tHeight % packetSize == 0) {
+							for (int row = 0; row < tHeight; row += packetSize) {
+								for (int col = 0; col < tWidth; col += packetSize) {
+									tracePacket(col + tWidth * tileCol, row + tHeight * tileRow, packetSize, wWidth, wHeight, samples, bounces, rng, startNodes);
+								}
+							}
+							return;
+						}
 						for (int row = 0; row < tHeight; ++row) {
 							for (int col = 0; col < tWidth; ++col) {
 								Color pxColor(0,0,0);
@@ -183,7 +205,7 @@ bool Renderer::coreRayTracing(int horizontalTiles, int verticalTiles, int tWidth
 										if (ray.getDirection() == glm::fvec3(0, 0, 0)) {
 										pxColor += Color(0, 0, 0);
 										} else {
-											pxColor += Core::traceWhitted(ray, bounces, scene, rng);
+											pxColor += Core::traceWhitted(ray, bounces, scene, rng, startNodes);
 										}
 									}
 								}
@@ -204,6 +226,40 @@ bool Renderer::coreRayTracing(int horizontalTiles, int verticalTiles, int tWidth
 	return true;
 }
 
+void Renderer::tracePacket(int x0, int y0, int packetSize, int wWidth, int wHeight, int samples, int bounces, uint32_t &rng, const std::vector<BVHNode*> *startNodes) {
+	CameraPtr cam = scene->getCamera();
+	Color pxColors[RayPacket::maxSize];
+	Color colors[RayPacket::maxSize];
+	for (int s = 0; s < samples; ++s) {
+		RayPacket packet;
+		packet.size = packetSize * packetSize;
+		packet.type = RAY_CAMERA;
+		uint64_t mask = 0;
+		for (int row = 0; row < packetSize; ++row) {
+			for (int col = 0; col < packetSize; ++col) {
+				float u = static_cast<float>(x0 + col + ((samples > 1) ? Random::RandomFloat(rng) : 0)) / static_cast<float>(wWidth - 1);
+				float v = static_cast<float>(y0 + row + ((samples > 1) ? Random::RandomFloat(rng) : 0)) / static_cast<float>(wHeight - 1);
+				Ray ray = cam->generateCameraRay(u, v);
+				if (ray.getDirection() == glm::fvec3(0, 0, 0)) continue;
+				packet.setRay(row * packetSize + col, ray, INF);
+				mask |= 1ull << (row * packetSize + col);
+			}
+		}
+		packet.finalize(mask);
+		Core::traceWhittedPacket(packet, mask, bounces, scene, rng, colors, startNodes);
+		for (int i = 0; i < packet.size; ++i) {
+			if (s == 0) pxColors[i] = Color(0, 0, 0);
+			if (mask & (1ull << i)) pxColors[i] += colors[i];
+		}
+	}
+	for (int row = 0; row < packetSize; ++row) {
+		for (int col = 0; col < packetSize; ++col) {
+			Color pxColor = pxColors[row * packetSize + col] / static_cast<float>(samples);
+			putPixel(frameBuffer, wWidth * (y0 + row) + x0 + col, pxColor);
+		}
+	}
+}
+
 bool Renderer::start() {
 	const int tWidth = OptionsMap::Instance()->getOption(Options::TILE_WIDTH);
 	const int tHeight = OptionsMap::Instance()->getOption(Options::TILE_HEIGHT);
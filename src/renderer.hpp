@@ -30,6 +30,7 @@ public:
 
 	private:
 		bool coreRayTracing(int horizontalTiles, int verticalTiles, int tWidth, int tHeight, int wWidth, int wHeight);
+		void tracePacket(int x0, int y0, int packetSize, int wWidth, int wHeight, int samples, int bounces, uint32_t &rng, const std::vector<BVHNode*> *startNodes);
 
 		static void putPixel(uint32_t fb[], int idx, Color &color);
 		static void putPixel(uint32_t fb[], int idx, uint8_t r, uint8_t g, uint8_t b);
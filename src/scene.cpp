@@ -2,6 +2,7 @@
 #include "GLFW/glfw3.h"
 #include "input_manager.hpp"
 #include "scene_parser.hpp"
+#include "thread_pool.hpp"
 #include "glm/trigonometric.hpp"
 
 #include <fstream>
@@ -16,8 +17,17 @@ Scene::Scene(std::filesystem::path sceneFile){
 	auto camera = SceneParser::parseCamera(j["camera"]);
 	setCamera(camera);
 
-	for(auto t : j["textures"]){
-		auto text = SceneParser::parseTexture(t);
+	// Images are decoded concurrently; the textures keep the order of the scene file
+	auto& sceneTextures = j["textures"];
+	std::vector<TexturePtr> parsedTextures(sceneTextures.size());
+	std::vector<std::future<void>> futures;
+	for(size_t i = 0; i < parsedTextures.size(); ++i){
+		futures.push_back(Threading::pool.queue([&, i](uint32_t &rng) {
+			parsedTextures[i] = SceneParser::parseTexture(sceneTextures[i]);
+		}));
+	}
+	Threading::pool.wait(futures);
+	for(auto& text : parsedTextures){
 		if (text){
 			textures.push_back(std::move(text));
 		}
@@ -30,15 +40,27 @@ Scene::Scene(std::filesystem::path sceneFile){
 	}
 	std::cout << "Building BVHs..." << std::endl;
 	if(j.contains("instance_meshes")){
-		for (auto m : j["instance_meshes"]) {
-			std::string name;
-			std::string materialName;
-			auto mesh = SceneParser::parseMeshInstance(m, materials, textures, meshes, name);
-			if (mesh){
-				std::cout << name << ": done!" << std::endl;
-				meshesBVH[name] = mesh;
+		// Meshes are loaded and their BVHs built concurrently, then their materials are added in the
+		// order of the scene file
+		auto& instanceMeshes = j["instance_meshes"];
+		std::vector<SceneParser::MeshAsset> assets(instanceMeshes.size());
+		for(size_t i = 0; i < assets.size(); ++i){
+			futures.push_back(Threading::pool.queue([&, i](uint32_t &rng) {
+				assets[i] = SceneParser::loadMesh(instanceMeshes[i], materials);
+			}));
+		}
+		Threading::pool.wait(futures);
+		std::vector<SceneParser::ImageRequest> images;
+		for(size_t i = 0; i < assets.size(); ++i){
+			auto& asset = assets[i];
+			SceneParser::addMeshMaterials(instanceMeshes[i], asset, materials, textures, images);
+			if(asset.mesh) meshes.push_back(asset.mesh);
+			if (asset.bvh){
+				std::cout << asset.name << ": done!" << std::endl;
+				meshesBVH[asset.name] = asset.bvh;
 			}
 		}
+		SceneParser::loadImages(images, textures);
 	}
 
 	for(auto l : j["lights"]){
@@ -46,7 +68,12 @@ Scene::Scene(std::filesystem::path sceneFile){
 		if(light)
 			lights.push_back(light);
 	}
-	topLevelBVH = SceneParser::parseSceneGraph(j["scenegraph"], materials, meshesBVH, BVHs, nTris);
+	if(j.contains("groups")){
+		for(auto g : j["groups"]){
+			SceneParser::parseGroup(g, materials, meshesBVH, groups);
+		}
+	}
+	topLevelBVH = SceneParser::parseSceneGraph(j["scenegraph"], materials, meshesBVH, groups, nTris);
 	std::cout << "Total Number of triangles: " << nTris << std::endl;
 	std::filesystem::current_path(currPath);
 }
@@ -57,13 +84,16 @@ void Scene::addLight(std::shared_ptr<LightObject> light){
 	this->lights.push_back(light);
 }
 
-bool Scene::traverse(const Ray &ray, float tMin, float tMax, HitRecord &rec) const {
+bool Scene::traverse(const Ray &ray, float tMin, float tMax, HitRecord &rec, const std::vector<BVHNode*> *startNodes) const {
 	HitRecord tmp;
 	tmp.p = {INF, INF, INF};
 	bool hasHit = false;
 	float closest = tMax;
 
-	if (topLevelBVH->hit(ray, tMin, closest, tmp)) {
+	bool rayHit = startNodes ?
+		topLevelBVH->hitFrom(ray, tMin, closest, tmp, *startNodes) :
+		topLevelBVH->hit(ray, tMin, closest, tmp);
+	if (rayHit) {
 		hasHit = true;
 		closest = tmp.t;
 		rec = tmp;
@@ -72,6 +102,14 @@ bool Scene::traverse(const Ray &ray, float tMin, float tMax, HitRecord &rec) con
 	return hasHit;
 }
 
+uint64_t Scene::traversePacket(RayPacket &packet, uint64_t mask, float tMin, HitRecord *recs, const std::vector<BVHNode*> *startNodes) const {
+	return topLevelBVH->hitPacket(packet, mask, tMin, recs, startNodes);
+}
+
+bool Scene::cullFrustum(const Frustum &frustum, std::vector<BVHNode*> &nodes) const {
+	return topLevelBVH->cullFrustum(frustum, RAY_CAMERA, nodes);
+}
+
 void Scene::setCamera(CameraPtr camera){
 	this->currentCamera = camera;
 }
@@ -83,21 +121,13 @@ const CameraPtr Scene::getCamera() const {
 bool Scene::update(float dt){
 	bool ret = false;
 	for(auto &m : meshesBVH){
-		if(m.second->update(dt)){
-			auto instanceList = BVHs[m.first];
-			for(auto &i : instanceList){
-				i->constructSubBVH();
-			}
-			ret = true;
-		}
+		ret |= m.second->update(dt);
 	}
-	for(auto &b : BVHs){
-		auto instanceList = b.second;
-		for(auto &i : instanceList){
-			ret|=i->update(dt);
-		}
+	// Inner levels first: a group's bounds are only valid once the groups it contains are updated
+	for(auto &g : groups){
+		ret |= g.bvh->updateInstances(dt);
 	}
-	if(ret) topLevelBVH->constructTopLevelBVH();
+	ret |= topLevelBVH->updateInstances(dt);
 	return ret | this->currentCamera->update(dt);
 }
 
@@ -106,6 +136,7 @@ Color Scene::traceLights(HitRecord &rec) const {
 	for(auto &light : lights){
 		float tMax;
 		Ray shadowRay = light->getRay(rec, tMax);
+		shadowRay.setType(RAY_SHADOW);
 
 		// Required for Spotlights
 		if (shadowRay.getDirection() == glm::fvec3(0, 0, 0)) {
@@ -120,3 +151,37 @@ Color Scene::traceLights(HitRecord &rec) const {
 	}
 	return illumination;
 }
+
+void Scene::traceLightsPacket(HitRecord *recs, uint64_t mask, int size, Color *illumination) const {
+	for(int i = 0; i < size; ++i){
+		illumination[i] = Color(0.0f);
+	}
+	for(auto &light : lights){
+		RayPacket shadowRays;
+		shadowRays.size = size;
+		shadowRays.type = RAY_SHADOW;
+		uint64_t active = 0;
+		for(int i = 0; i < size; ++i){
+			if(!(mask & (1ull << i))) continue;
+			float tMax;
+			Ray shadowRay = light->getRay(recs[i], tMax);
+			// Required for Spotlights
+			if (shadowRay.getDirection() == glm::fvec3(0, 0, 0)) {
+				continue;
+			}
+			shadowRay.setType(RAY_SHADOW);
+			shadowRays.setRay(i, shadowRay, tMax);
+			active |= 1ull << i;
+		}
+		if(active == 0) continue;
+		shadowRays.finalize(active);
+
+		HitRecord obstructions[RayPacket::maxSize];
+		uint64_t blocked = traversePacket(shadowRays, active, EPS, obstructions);
+		for(int i = 0; i < size; ++i){
+			if(!(active & ~blocked & (1ull << i))) continue;
+			auto contribution = light->getLight(recs[i], shadowRays.rays[i]);
+			illumination[i] += light->attenuate(contribution, recs[i].p);
+		}
+	}
+}
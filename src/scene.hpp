@@ -7,6 +7,7 @@
 #include "hittables/triangle_mesh.hpp"
 #include "json.hpp"
 #include "bvh.hpp"
+#include "scene_parser.hpp"
 
 #include <vector>
 #include <string>
@@ -21,8 +22,13 @@ class Scene {
 		const CameraPtr getCamera() const;
 		void setCamera(CameraPtr camera);
 
-		bool traverse(const Ray &ray, float tMin, float tMax, HitRecord &rec) const;
+		bool traverse(const Ray &ray, float tMin, float tMax, HitRecord &rec, const std::vector<BVHNode*> *startNodes = nullptr) const;
+		// Top level nodes the camera rays of the frustum start from, see BVH::cullFrustum
+		bool cullFrustum(const Frustum &frustum, std::vector<BVHNode*> &nodes) const;
 		Color traceLights(HitRecord &rec) const;
+		uint64_t traversePacket(RayPacket &packet, uint64_t mask, float tMin, HitRecord *recs, const std::vector<BVHNode*> *startNodes = nullptr) const;
+		// traceLights for the hits of mask, with one packet of shadow rays per light
+		void traceLightsPacket(HitRecord *recs, uint64_t mask, int size, Color *illumination) const;
 		bool update(float dt);
 
 		void addLight(std::shared_ptr<LightObject> light);
@@ -45,7 +51,7 @@ class Scene {
 	private:
 		CameraPtr currentCamera;
 		std::unordered_map<std::string, BVHPtr> meshesBVH;
-		std::unordered_map<std::string, std::list<BVHPtr>> BVHs;
+		std::vector<SceneParser::InstanceGroup> groups; // Sorted so that a group only contains groups that come before it
 		std::vector<std::shared_ptr<LightObject>> lights;
 		std::vector<MaterialPtr> materials;
 		std::vector<TexturePtr> textures;
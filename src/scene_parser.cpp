@@ -2,7 +2,7 @@
 #include "textures/texture.hpp"
 #include "textures/checkered.hpp"
 #include "textures/image_texture.hpp"
-#include "hittables/triangle.hpp"
+#include "hittables/curve_mesh.hpp"
 #include "materials/material.hpp"
 #include "materials/material_dielectric.hpp"
 #include "materials/material_mirror.hpp"
@@ -13,9 +13,14 @@
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 #include "importer.hpp"
+#include "thread_pool.hpp"
+#include "mesh_file.hpp"
+#include "mesh_stream.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <cstring>
 
 namespace SceneParser {
 
@@ -82,111 +87,236 @@ namespace SceneParser {
 		return glm::fvec4(arr[0].get<float>(), arr[1].get<float>(), arr[2].get<float>(), arr[3].get<float>());
 	}
 
-	std::shared_ptr<BVH> parseMeshInstance(nlohmann::json& hit, std::vector<MaterialPtr>& materials, std::vector<TexturePtr>& textures, std::vector<std::shared_ptr<TriangleMesh>> meshes, std::string &name) {
-		name = hit.at("name");
-
-		if (!hit.contains("path")) {
-			throw std::invalid_argument("Mesh doesn't have a valid path");
+	int findOrCreateMaterial(nlohmann::json& hit, const std::filesystem::path& meshPath, const std::string& name, const Importer::OBJMaterial& material, std::vector<MaterialPtr>& materials, std::vector<TexturePtr>& textures, std::vector<ImageRequest>& images) {
+		std::string matName;
+		if(hit.contains("material")) matName = hit.at("material");
+		else matName = material.name;
+		if(matName.empty()) matName = name + "_material";
+		auto matIdx = findMaterial(matName, materials);
+		if(matIdx == -1){
+			if(!material.diffuseTexture.empty()){
+				// Decoded later by loadImages, together with the other images
+				std::filesystem::path fp = meshPath.parent_path() / std::filesystem::path(material.diffuseTexture);
+				images.push_back({ textures.size(), material.diffuseTexture, fp.string() });
+				textures.emplace_back();
+			} else {
+				textures.emplace_back(std::make_unique<SolidColor>(matName, material.diffuse.r, material.diffuse.g, material.diffuse.b));
+			}
+			materials.emplace_back(std::make_shared<DiffuseMaterial>(matName, textures.size() - 1));
+			matIdx = materials.size() - 1;
 		}
-	
-		std::filesystem::path meshPath = hit.at("path");
-		std::vector<std::shared_ptr<Hittable>> hittables;
-		if(meshPath.extension() == ".obj") {
-			Assimp::Importer importer;
-			const aiScene* scene = importer.ReadFile(meshPath.string(), aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_SortByPType);
+		return matIdx;
+	}
 
-			if(!scene)
-				throw std::invalid_argument("Failed parsing the obj file");
+	void loadAssimpOBJ(const std::filesystem::path& meshPath, MeshAsset& asset) {
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(meshPath.string(), aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_SortByPType);
 
-			for(int i = 0; i < scene->mNumMeshes; ++i){
-				auto mesh = scene->mMeshes[i];
+		if(!scene)
+			throw std::invalid_argument("Failed parsing the obj file");
 
-				if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)) {
-					continue;
-				}
+		// The meshes of the file are merged into a single TriangleMesh, with a material range each
+		std::vector<glm::fvec3> verts;
+		std::vector<glm::fvec3> norms;
+		std::vector<glm::fvec2> uvs;
+		std::vector<unsigned int> indices;
+		bool hasUVs = false;
+		for(int i = 0; i < scene->mNumMeshes; ++i){
+			hasUVs |= scene->mMeshes[i]->HasTextureCoords(0);
+		}
+		for(int i = 0; i < scene->mNumMeshes; ++i){
+			auto mesh = scene->mMeshes[i];
 
-				std::vector<glm::fvec3> verts(mesh->mNumVertices);
-				std::vector<glm::fvec3> norms;
-				std::vector<glm::fvec2> uvs;
-				std::vector<unsigned int> indices(mesh->mNumFaces*3);
-				std::string meshName = mesh->mName.C_Str();
-				if(meshName.empty()) meshName = name;
-				for(int j = 0; j < verts.size(); ++j){
-					verts[j] = glm::fvec3(mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z);
-				}
+			if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)) {
+				continue;
+			}
+
+			unsigned int firstVertex = verts.size();
+			asset.materialRanges.emplace_back(indices.size() / 3, asset.materials.size());
+			for(int j = 0; j < mesh->mNumVertices; ++j){
+				verts.emplace_back(mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z);
 				if(mesh->HasNormals()){
-					norms.resize(mesh->mNumVertices);
-					for(int j = 0; j < norms.size(); ++j){
-						norms[j] = glm::fvec3(mesh->mNormals[j].x, mesh->mNormals[j].y, mesh->mNormals[j].z);
-					}
+					norms.emplace_back(mesh->mNormals[j].x, mesh->mNormals[j].y, mesh->mNormals[j].z);
 				}
 				if(mesh->HasTextureCoords(0)){
-					uvs.resize(mesh->mNumVertices);
-					for(int j = 0; j < verts.size(); ++j){
-						uvs[j] = glm::fvec2(mesh->mTextureCoords[0][j].x, mesh->mTextureCoords[0][j].y);
-					}
+					uvs.emplace_back(mesh->mTextureCoords[0][j].x, mesh->mTextureCoords[0][j].y);
+				} else if(hasUVs) {
+					uvs.emplace_back(0.0f, 0.0f);
 				}
-				int faceIdx = 0;
-				for(unsigned int j = 0; j < mesh->mNumFaces; ++j){
-					indices[faceIdx++] = mesh->mFaces[j].mIndices[0];
-					indices[faceIdx++] = mesh->mFaces[j].mIndices[1];
-					indices[faceIdx++] = mesh->mFaces[j].mIndices[2];
-				}
-				auto triMesh = std::make_shared<TriangleMesh>(meshName, mesh->mNumFaces, mesh->mNumVertices, indices.data(), verts.data(), norms.data(), uvs.data());
-				meshes.emplace_back(triMesh);
-				/* Get Material */
-				auto material = scene->mMaterials[mesh->mMaterialIndex];
-				std::string matName;
-				if(hit.contains("material")) matName = hit.at("material");
-				else matName = material->GetName().C_Str();
-				if(matName.empty()) matName = name + "_material";
-				auto matIdx = findMaterial(matName, materials);
-				if(matIdx == -1){
-					TexturePtr text;
-					int numTextures = material->GetTextureCount(aiTextureType_DIFFUSE);
-					if(numTextures > 0){
-						aiString textureName;
-						material->GetTexture(aiTextureType_DIFFUSE, 0, &textureName);
-						std::filesystem::path fp = meshPath.parent_path() / std::filesystem::path(textureName.C_Str());
-						text = std::make_unique<ImageTexture>(textureName.C_Str(), fp.string());
-					} else {
-						aiColor4D color{0.0,0.0,0.0,0.0};
-						aiGetMaterialColor(material,AI_MATKEY_COLOR_DIFFUSE,&color);
-						text = std::make_unique<SolidColor>(matName, color.r, color.g, color.b);
-					}
-					textures.emplace_back(std::move(text));
-					materials.emplace_back(std::make_shared<DiffuseMaterial>(matName, textures.size() - 1));
-					matIdx = materials.size() - 1;
-				}
-				/* Create mesh' triangles */
-				for(unsigned int k = 0; k < mesh->mNumFaces; ++k){
-					auto tri = std::make_shared<Triangle>(triMesh, k, matIdx);
-					hittables.emplace_back(tri);
+			}
+			for(unsigned int j = 0; j < mesh->mNumFaces; ++j){
+				indices.push_back(firstVertex + mesh->mFaces[j].mIndices[0]);
+				indices.push_back(firstVertex + mesh->mFaces[j].mIndices[1]);
+				indices.push_back(firstVertex + mesh->mFaces[j].mIndices[2]);
+			}
+			if(!mesh->HasNormals()){
+				std::vector<unsigned int> faces(mesh->mNumFaces * 3);
+				for(unsigned int j = 0; j < faces.size(); ++j){
+					faces[j] = mesh->mFaces[j / 3].mIndices[j % 3];
 				}
-			}		
-		} else if(meshPath.extension() == ".bez") {
-			std::string matName;
-			int matIdx = -1;
-			if(hit.contains("material")) matName = hit.at("material");
-			matIdx = findMaterial(matName, materials);
-			if(matName.empty() || matIdx == -1) {
-				throw std::invalid_argument("Curve does not name a material!");
+				norms.resize(verts.size());
+				Importer::computeNormals(&verts[firstVertex], mesh->mNumVertices, faces.data(), mesh->mNumFaces, &norms[firstVertex]);
 			}
-			int numSegments = (hit.contains("segments")) ? (int)hit.at("segments") : 4;
-			Importer::importBEZ(meshPath, hittables, matIdx, numSegments);
-		} else if(meshPath.extension() == ".bcc") {
-			std::string matName;
-			int matIdx = -1;
-			if(hit.contains("material")) matName = hit.at("material");
-			matIdx = findMaterial(matName, materials);
-			if(matName.empty() || matIdx == -1) {
-				throw std::invalid_argument("Curve does not name a material!");
+			/* Get Material */
+			auto material = scene->mMaterials[mesh->mMaterialIndex];
+			Importer::OBJMaterial meshMaterial;
+			meshMaterial.name = material->GetName().C_Str();
+			if(material->GetTextureCount(aiTextureType_DIFFUSE) > 0){
+				aiString textureName;
+				material->GetTexture(aiTextureType_DIFFUSE, 0, &textureName);
+				meshMaterial.diffuseTexture = textureName.C_Str();
+			} else {
+				aiColor4D color{0.0,0.0,0.0,0.0};
+				aiGetMaterialColor(material,AI_MATKEY_COLOR_DIFFUSE,&color);
+				meshMaterial.diffuse = glm::fvec3(color.r, color.g, color.b);
 			}
-			int numSegments = (hit.contains("segments")) ? (int)hit.at("segments") : 4;
-			Importer::importBCC(meshPath, hittables, matIdx, numSegments);
+			asset.materials.push_back(meshMaterial);
 		}
+		if(indices.empty())
+			throw std::invalid_argument("The obj file has no triangles");
+		asset.mesh = std::make_shared<TriangleMesh>(asset.name, indices.size() / 3, verts.size(), indices.data(), verts.data(), norms.data(), hasUVs ? uvs.data() : nullptr);
+	}
+
+	void loadOBJ(const std::filesystem::path& meshPath, MeshAsset& asset) {
+		Importer::OBJMesh mesh;
+		if(!Importer::importOBJ(meshPath, mesh))
+			throw std::invalid_argument("Failed parsing the obj file");
+		asset.materials = std::move(mesh.materials);
+		asset.materialRanges = std::move(mesh.materialRanges);
+		asset.mesh = std::make_shared<TriangleMesh>(asset.name, mesh.nTriangles, mesh.nVertices, std::move(mesh.indices), std::move(mesh.p), std::move(mesh.n), std::move(mesh.uv));
+	}
+
+	static Importer::OBJMaterial toOBJMaterial(const MeshFile::Material& fileMaterial) {
+		Importer::OBJMaterial material;
+		material.name = std::string(fileMaterial.name, strnlen(fileMaterial.name, sizeof(fileMaterial.name)));
+		material.diffuse = glm::fvec3(fileMaterial.diffuse[0], fileMaterial.diffuse[1], fileMaterial.diffuse[2]);
+		material.diffuseTexture = std::string(fileMaterial.diffuseTexture, strnlen(fileMaterial.diffuseTexture, sizeof(fileMaterial.diffuseTexture)));
+		return material;
+	}
+
+	void loadMeshFile(const std::shared_ptr<MappedFile>& file, MeshAsset& asset) {
+		const auto& header = MeshFile::getHeader(*file);
+		auto fileMaterials = MeshFile::getSection<MeshFile::Material>(file, MeshFile::MATERIALS);
+		for(uint32_t i = 0; i < header.nMaterials; ++i){
+			asset.materials.push_back(toOBJMaterial(fileMaterials[i]));
+		}
+		auto ranges = MeshFile::getSection<MeshFile::MaterialRange>(file, MeshFile::MATERIAL_RANGES);
+		// MeshFile::open checked the materials of the ranges
+		for(uint32_t i = 0; i < header.nMaterialRanges; ++i){
+			asset.materialRanges.emplace_back(ranges[i].firstTriangle, ranges[i].material);
+		}
+		asset.mesh = MeshFile::loadTriangleMesh(file, asset.name);
+	}
+
+	static int findCurveMaterial(nlohmann::json& hit, const std::vector<MaterialPtr>& materials) {
+		std::string matName;
+		if(hit.contains("material")) matName = hit.at("material");
+		int matIdx = findMaterial(matName, materials);
+		if(matName.empty() || matIdx == -1) {
+			throw std::invalid_argument("Curve does not name a material!");
+		}
+		return matIdx;
+	}
 
+	// Adaptive when "segmentTolerance" is set, else "segments" segments per curve
+	static void splitCurves(nlohmann::json& hit, CurveMesh& curves) {
+		if(hit.contains("segmentTolerance")) {
+			float tolerance = hit.at("segmentTolerance");
+			if(tolerance <= 0.0f) throw std::invalid_argument("segmentTolerance must be positive");
+			curves.splitAdaptive(tolerance);
+		} else {
+			int numSegments = hit.contains("segments") ? (int)hit.at("segments") : 4;
+			if(numSegments < 1) throw std::invalid_argument("Curves need at least one segment");
+			curves.split(numSegments);
+		}
+	}
 
+	MeshAsset loadMesh(nlohmann::json& hit, const std::vector<MaterialPtr>& materials) {
+		MeshAsset asset;
+		asset.name = hit.at("name");
+
+		if (!hit.contains("path")) {
+			throw std::invalid_argument("Mesh doesn't have a valid path");
+		}
+	
+		std::filesystem::path meshPath = hit.at("path");
+		std::shared_ptr<CurveMesh> curves;
+		SAHCost sahCost;
+		// Set for .tmesh files, whose BVH is used unless the mesh is modified
+		std::shared_ptr<MappedFile> meshFile;
+		if(meshPath.extension() == ".obj") {
+			std::string loader = hit.contains("loader") ? hit.at("loader") : "native";
+			auto timedLoad = [&meshPath](const std::string& loaderName, MeshAsset& target) {
+				auto startTime = std::chrono::high_resolution_clock::now();
+				if(loaderName == "assimp") loadAssimpOBJ(meshPath, target);
+				else loadOBJ(meshPath, target);
+				auto endTime = std::chrono::high_resolution_clock::now();
+				float ms = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+				std::cout << "Loaded " << meshPath.string() << " with the " << loaderName << " loader in " << ms << "ms" << std::endl;
+				return ms;
+			};
+			if(loader == "compare") {
+				// The native loader goes first, so that only Assimp gets the file from a warm cache
+				float nativeTime = timedLoad("native", asset);
+				MeshAsset assimpAsset;
+				assimpAsset.name = asset.name;
+				float assimpTime = timedLoad("assimp", assimpAsset);
+				std::cout << "The native loader is " << assimpTime / nativeTime << "x as fast as Assimp on " << meshPath.string()
+					<< " (" << asset.mesh->nTriangles << " triangles, " << assimpAsset.mesh->nTriangles << " with Assimp)" << std::endl;
+			} else if(loader == "assimp" || loader == "native") {
+				timedLoad(loader, asset);
+			} else {
+				throw std::invalid_argument("Unknown obj loader " + loader);
+			}
+		} else if(meshPath.extension() == ".tmesh") {
+			auto startTime = std::chrono::high_resolution_clock::now();
+			meshFile = MeshFile::open(meshPath);
+			if(MeshFile::getHeader(*meshFile).nTriangles > 0) {
+				loadMeshFile(meshFile, asset);
+			} else {
+				curves = MeshFile::loadCurves(meshFile, findCurveMaterial(hit, materials));
+			}
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "Mapped " << meshPath.string() << " in "
+				<< std::chrono::duration<float, std::milli>(endTime - startTime).count() << "ms" << std::endl;
+		} else if(meshPath.extension() == ".tstream") {
+			// The chunks come with their BVHs, so none of the options below apply
+			auto index = MeshStream::readIndex(meshPath);
+			for(auto& material : index.materials){
+				asset.materials.push_back(toOBJMaterial(material));
+			}
+			asset.streamMaterials = std::make_shared<std::vector<int>>();
+			asset.bvh = MeshStream::load(meshPath, index, asset.streamMaterials);
+			std::cout << "Streaming " << meshPath.string() << ": " << index.header.nTriangles << " triangles in "
+				<< index.header.nChunks << " chunks" << std::endl;
+			return asset;
+		} else if(meshPath.extension() == ".bez" || meshPath.extension() == ".bcc" || meshPath.extension() == ".pbrt") {
+			auto startTime = std::chrono::high_resolution_clock::now();
+			curves = std::make_shared<CurveMesh>(findCurveMaterial(hit, materials));
+			bool ok = meshPath.extension() == ".bez" ? Importer::importBEZ(meshPath, *curves) :
+				meshPath.extension() == ".bcc" ? Importer::importBCC(meshPath, *curves) :
+				Importer::importPBRT(meshPath, *curves);
+			if(!ok || curves->curveCount() == 0) throw std::invalid_argument("Failed parsing the curves of " + meshPath.string());
+			splitCurves(hit, *curves);
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "Loaded " << meshPath.string() << " in "
+				<< std::chrono::duration<float, std::milli>(endTime - startTime).count() << "ms" << std::endl;
+		} else {
+			throw std::invalid_argument("Unsupported mesh format " + meshPath.extension().string() + " of " + meshPath.string());
+		}
+
+		if(curves && hit.contains("curveIntersector")) {
+			std::string intersector = hit.at("curveIntersector");
+			if(intersector == "pbrt") curves->setIntersector(CurveIntersector::PBRT);
+			else if(intersector != "phantom") throw std::invalid_argument("Unknown curve intersector " + intersector);
+		}
+
+		auto triMesh = asset.mesh;
+		sahCost.intersection = triMesh ? TriangleMesh::intersectionCost : CurveMesh::intersectionCost;
+		if(triMesh) {
+			bool compress = hit.contains("compressAttributes") && (bool)hit.at("compressAttributes");
+			if(compress) triMesh->compressAttributes();
+		}
 
 		Heuristic heuristic = Heuristic::SAH;
 		if(hit.contains("bvh")){
@@ -196,38 +326,125 @@ namespace SceneParser {
 		if(hit.contains("refit")){
 			refit = hit.at("refit");
 		}
-		return std::make_shared<BVH>(hittables, heuristic, refit);
+		if(hit.contains("sah")){
+			auto& cost = hit.at("sah");
+			if(cost.contains("traversal")) sahCost.traversal = cost.at("traversal");
+			if(cost.contains("intersection")) sahCost.intersection = cost.at("intersection");
+			if(cost.contains("maxLeafSize")) sahCost.maxLeafSize = cost.at("maxLeafSize");
+		}
+		bool compressBVH = hit.contains("compressBVH") && (bool)hit.at("compressBVH");
+		if(compressBVH && refit){
+			throw std::invalid_argument("A compressed BVH can't be refitted");
+		}
+		bool rebuildBVH = hit.contains("rebuildBVH") && (bool)hit.at("rebuildBVH");
+		if(meshFile && !rebuildBVH && !refit) asset.bvh = MeshFile::loadBVH(meshFile, triMesh, curves);
+		if(!asset.bvh) {
+			asset.bvh = triMesh ?
+				std::make_shared<BVH>(triMesh, heuristic, refit, sahCost) :
+				std::make_shared<BVH>(curves, heuristic, refit, sahCost);
+		}
+		if(compressBVH) asset.bvh->compressNodes();
+		return asset;
+	}
+
+	void addMeshMaterials(nlohmann::json& hit, MeshAsset& asset, std::vector<MaterialPtr>& materials, std::vector<TexturePtr>& textures, std::vector<ImageRequest>& images) {
+		if(!asset.mesh && !asset.streamMaterials) return;
+		std::filesystem::path meshPath = hit.at("path");
+		std::vector<int> materialIndices;
+		for(auto& material : asset.materials){
+			materialIndices.push_back(findOrCreateMaterial(hit, meshPath, asset.name, material, materials, textures, images));
+		}
+		if(asset.streamMaterials){
+			*asset.streamMaterials = materialIndices;
+			return;
+		}
+		for(auto& m : asset.materialRanges){
+			asset.mesh->setMaterial(m.first, materialIndices[m.second]);
+		}
 	}
 
-	std::pair<std::string, BVHPtr> parseInstance(nlohmann::json& mesh, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr> meshes, int &numTri) {
+	void loadImages(const std::vector<ImageRequest>& images, std::vector<TexturePtr>& textures) {
+		std::vector<std::future<void>> futures;
+		for(auto& image : images){
+			futures.push_back(Threading::pool.queue([&](uint32_t &rng) {
+				textures[image.texture] = std::make_unique<ImageTexture>(image.name, image.path);
+			}));
+		}
+		Threading::pool.wait(futures);
+	}
+
+	std::pair<std::string, BVHPtr> parseInstance(nlohmann::json& mesh, const std::vector<MaterialPtr>& materials, const std::unordered_map<std::string, BVHPtr>& meshes, const std::vector<InstanceGroup>& groups, int &numTri) {
 		if (!mesh.contains("name")) throw std::invalid_argument("Mesh doesn't name an instance");
 		std::string name = mesh.at("name");
 		auto m = meshes.find(name);
-		numTri += m->second->getHittable().size();
-		if(m == meshes.end()){
-			throw std::invalid_argument("Mesh doesn't name a valid instance");
+		if(m != meshes.end()){
+			numTri += m->second->primitiveCount();
+			return std::make_pair(m->first, m->second);
+		}
+		for(auto& g : groups){
+			if(g.name == name){
+				numTri += g.nTris;
+				return std::make_pair(g.name, g.bvh);
+			}
 		}
-		return std::make_pair(m->first, m->second);
+		throw std::invalid_argument("Mesh doesn't name a valid instance");
 	};
 
-	void parseTransform(nlohmann::basic_json<>& hit, HittablePtr primitive) {
+	BVHInstance createInstance(nlohmann::json& instance, const BVHPtr& instanced, int instancedIdx, std::vector<Animation>& animations) {
+		Transform transform = parseTransform(instance);
+		BVHInstance ret;
+		ret.transform = transform.getMatrix();
+		ret.transformInv = transform.getInverse();
+		ret.bvh = instancedIdx;
+		ret.animation = -1;
+		// A group can't be seen by rays that none of its children accept
+		ret.visibility = parseVisibility(instance) & instanced->getVisibility();
+		if(instance.contains("animation")){
+			Animation anim = SceneParser::parseAnimation(instance.at("animation"));
+			anim.setInitial(transform);
+			animations.push_back(anim);
+			ret.animation = animations.size() - 1;
+		}
+		return ret;
+	}
+
+	Transform parseTransform(nlohmann::basic_json<>& hit) {
+		Transform transform;
 		if (hit.contains("transform")) {
 			auto trans = hit.at("transform");
-			if (trans.contains("translation")) primitive->translate(parseVec3(trans.at("translation")));
+			if (trans.contains("translation")) {
+				auto t = parseVec3(trans.at("translation"));
+				transform.translate(t);
+			}
 			if (trans.contains("scale")) {
-				if (trans.at("scale").is_array()) primitive->scale(parseVec3(trans.at("scale")));
-				else primitive->scale((float)(trans.at("scale")));
+				if (trans.at("scale").is_array()) {
+					auto s = parseVec3(trans.at("scale"));
+					transform.scale(s);
+				}
+				else transform.scale((float)(trans.at("scale")));
 			}
 			if (trans.contains("rotation")) {
 				auto rot = parseVec3(trans.at("rotation"));
-				if (rot.x != 0) primitive->rotate(glm::radians(rot.x), glm::fvec3(1.0, 0.0, 0.0));
-				if (rot.y != 0) primitive->rotate(glm::radians(rot.y), glm::fvec3(0.0, 1.0, 0.0));
-				if (rot.z != 0) primitive->rotate(glm::radians(rot.z), glm::fvec3(0.0, 0.0, 1.0));
+				if (rot.x != 0) transform.rotate(glm::radians(rot.x), glm::fvec3(1.0, 0.0, 0.0));
+				if (rot.y != 0) transform.rotate(glm::radians(rot.y), glm::fvec3(0.0, 1.0, 0.0));
+				if (rot.z != 0) transform.rotate(glm::radians(rot.z), glm::fvec3(0.0, 0.0, 1.0));
 			}
 		}
+		return transform;
 	}
 
 
+	uint8_t parseVisibility(nlohmann::json& instance) {
+		uint8_t mask = RAY_ALL;
+		if (instance.contains("visibility")) {
+			auto& vis = instance.at("visibility");
+			if (vis.contains("camera") && !vis.at("camera").get<bool>()) mask &= ~RAY_CAMERA;
+			if (vis.contains("shadow") && !vis.at("shadow").get<bool>()) mask &= ~RAY_SHADOW;
+			if (vis.contains("reflection") && !vis.at("reflection").get<bool>()) mask &= ~RAY_REFLECTION;
+		}
+		return mask;
+	}
+
 	CameraPtr parseCamera(nlohmann::json& cam) {
 		glm::fvec3 pos = parseVec3(cam.at("position"));
 		glm::fvec3 dir = parseVec3(cam.at("dir"));
@@ -321,47 +538,58 @@ namespace SceneParser {
 		return texture;
 	}
 
-	std::shared_ptr<BVH> parseSceneGraph(nlohmann::json& text, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr>& meshes, std::unordered_map<std::string, std::list<BVHPtr>>& BVHs, int &numTri) {
+	void parseGroup(nlohmann::json& group, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr>& meshes, std::vector<InstanceGroup>& groups) {
+		if (!group.contains("name")) throw std::invalid_argument("Group is missing name");
+		if (!group.contains("scenegraph")) throw std::invalid_argument("Group is missing scenegraph");
+		std::string name = group.at("name");
+		if (meshes.count(name)) throw std::invalid_argument("Group " + name + " has the name of a mesh");
+		for (auto& g : groups) {
+			if (g.name == name) throw std::invalid_argument("Group " + name + " is defined twice");
+		}
+		int nTris = 0;
+		auto bvh = parseSceneGraph(group.at("scenegraph"), materials, meshes, groups, nTris);
+		if (bvh) {
+			groups.push_back({ name, bvh, nTris });
+		}
+	}
+
+	std::shared_ptr<BVH> parseSceneGraph(nlohmann::json& text, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr>& meshes, std::vector<InstanceGroup>& groups, int &numTri) {
+		// Every mesh or group referenced by this level is stored once, instances point to it by index
+		std::vector<BVHPtr> instanced;
+		std::unordered_map<std::string, int> instancedIdxs;
+		std::vector<BVHInstance> instances;
+		std::vector<Animation> animations;
 
 		for (auto& obj : text) {
-			//if (obj.contains("node"))
-			//for (auto& node : obj["node"]) {
-			//auto bvh = SceneParser::parseSceneGraph(node, materials, meshes, BVHs, numTri);
-			//if (bvh)
-			//BVHs.push_back(bvh);
-			//}
+			if (obj.contains("node")) {
+				// Nested level: it becomes an anonymous group instanced once with the transform of obj
+				int nodeTris = 0;
+				auto node = SceneParser::parseSceneGraph(obj["node"], materials, meshes, groups, nodeTris);
+				if (node) {
+					std::string name = "node#" + std::to_string(groups.size());
+					groups.push_back({ name, node, nodeTris });
+					numTri += nodeTris;
+					instanced.push_back(node);
+					instances.push_back(createInstance(obj, node, instanced.size() - 1, animations));
+				}
+			}
 
 			if (obj.contains("meshes")) {
 				for (auto& m : obj["meshes"]) {
-					auto instance = SceneParser::parseInstance(m, materials, meshes, numTri);
-					bool animate = false;
-					std::vector<HittablePtr> hittableVec;
-					hittableVec.push_back(instance.second);
-					auto bvh = std::make_shared<BVH>(hittableVec);
-					parseTransform(m, bvh);
-					if(m.contains("animation")){
-						Animation anim = SceneParser::parseAnimation(m.at("animation"));
-						bvh->setAnimation(anim);
+					auto instance = SceneParser::parseInstance(m, materials, meshes, groups, numTri);
+					auto idx = instancedIdxs.find(instance.first);
+					if (idx == instancedIdxs.end()) {
+						instanced.push_back(instance.second);
+						idx = instancedIdxs.emplace(instance.first, instanced.size() - 1).first;
 					}
-					BVHs[instance.first].push_back(bvh);
+					instances.push_back(createInstance(m, instance.second, idx->second, animations));
 				}
 			}
 		}
 
 		std::shared_ptr<BVH> topLevelBVH = nullptr;
-		// TODO: my god. This is really ugly. Stop passing pointers around. 
-		// Start using indices.
-		// This is awful and slow.
-		// Rework this when we implement back meshes as an abstraction, right now this is needed as we need to rebuild the BVH
-		// of the instances associated with refitting meshes;
-		if (!BVHs.empty()) {
-			std::vector<HittablePtr> bvhs;
-			for(auto const& imap: BVHs){
-				for(auto const& i : imap.second){
-					bvhs.push_back(i);
-				}
-			}
-			topLevelBVH = std::make_shared<BVH>(bvhs, Heuristic::SAH, /*refit*/ false, /*makeTopLevel*/ true);
+		if (!instances.empty()) {
+			topLevelBVH = std::make_shared<BVH>(instanced, instances, animations);
 		}
 		return topLevelBVH;
 	}
@@ -374,7 +602,7 @@ namespace SceneParser {
 		}
 		return -1;
 	}
-	static int findMaterial(std::string& name, std::vector<MaterialPtr>& materials) {
+	static int findMaterial(const std::string& name, const std::vector<MaterialPtr>& materials) {
 		size_t i = 0;
 		while (i < materials.size()) {
 			if (materials[i]->getName() == name) return i;
@@ -7,6 +7,8 @@
 #include "hittables/triangle_mesh.hpp"
 #include "json.hpp"
 #include "bvh.hpp"
+#include "importer.hpp"
+#include "mapped_file.hpp"
 #include "GLFW/glfw3.h"
 #include "json.hpp"
 
@@ -16,15 +18,61 @@
 
 namespace SceneParser {
 
+	// A named sub-graph that can be instanced in the scene graph like a mesh
+	struct InstanceGroup {
+		std::string name;
+		BVHPtr bvh;
+		int nTris;
+	};
+
 	glm::fvec3 parseVec3(nlohmann::basic_json<>& arr);
 
 	glm::fvec4 parseVec4(nlohmann::basic_json<>& arr);
 
-	BVHPtr parseMeshInstance(nlohmann::json& hit, std::vector<MaterialPtr>& materials, std::vector<TexturePtr>& textures, std::vector<std::shared_ptr<TriangleMesh>> meshes, std::string &name);
+	// A mesh loaded and with its BVH built, whose materials aren't added to the scene yet
+	struct MeshAsset {
+		std::string name;
+		BVHPtr bvh;
+		std::shared_ptr<TriangleMesh> mesh; // Null for curves
+		std::vector<Importer::OBJMaterial> materials;
+		std::vector<std::pair<unsigned int, int>> materialRanges; // First triangle, index in materials
+		// Only set for streamed meshes, whose chunks map their materials with it once loaded
+		std::shared_ptr<std::vector<int>> streamMaterials;
+	};
+
+	// An image texture whose slot in the textures is reserved, decoded by loadImages
+	struct ImageRequest {
+		size_t texture;
+		std::string name;
+		std::string path;
+	};
+
+	// Material of an obj or mesh file, created unless the scene already has one with its name
+	int findOrCreateMaterial(nlohmann::json& hit, const std::filesystem::path& meshPath, const std::string& name, const Importer::OBJMaterial& material, std::vector<MaterialPtr>& materials, std::vector<TexturePtr>& textures, std::vector<ImageRequest>& images);
+
+	// Both merge the meshes of the file into a single TriangleMesh, with a material range per mesh
+	void loadOBJ(const std::filesystem::path& meshPath, MeshAsset& asset);
+
+	void loadAssimpOBJ(const std::filesystem::path& meshPath, MeshAsset& asset);
+
+	void loadMeshFile(const std::shared_ptr<MappedFile>& file, MeshAsset& asset);
+
+	// Loads the mesh of an instance_meshes entry and builds its BVH. Only reads the materials, so
+	// meshes can be loaded concurrently.
+	MeshAsset loadMesh(nlohmann::json& hit, const std::vector<MaterialPtr>& materials);
+
+	// Adds the materials of the mesh to the scene. Called in the order of the scene file, which keeps
+	// the material and texture indices the same from run to run.
+	void addMeshMaterials(nlohmann::json& hit, MeshAsset& asset, std::vector<MaterialPtr>& materials, std::vector<TexturePtr>& textures, std::vector<ImageRequest>& images);
+
+	// Decodes the images on the thread pool
+	void loadImages(const std::vector<ImageRequest>& images, std::vector<TexturePtr>& textures);
 
 	Animation parseAnimation(nlohmann::json& animation);
 
-	void parseTransform(nlohmann::basic_json<>& hit, HittablePtr primitive);
+	Transform parseTransform(nlohmann::basic_json<>& hit);
+
+	uint8_t parseVisibility(nlohmann::json& instance);
 
 	CameraPtr parseCamera(nlohmann::json& cam);
 
@@ -34,9 +82,13 @@ namespace SceneParser {
 
 	TexturePtr parseTexture(nlohmann::json& text);
 
-	std::shared_ptr<BVH> parseSceneGraph(nlohmann::json& text, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr>& meshes, std::unordered_map<std::string, std::list<BVHPtr>>& BVHs, int& numTri);
+	BVHInstance createInstance(nlohmann::json& instance, const BVHPtr& instanced, int instancedIdx, std::vector<Animation>& animations);
+
+	void parseGroup(nlohmann::json& group, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr>& meshes, std::vector<InstanceGroup>& groups);
+
+	std::shared_ptr<BVH> parseSceneGraph(nlohmann::json& text, const std::vector<MaterialPtr>& materials, std::unordered_map<std::string, BVHPtr>& meshes, std::vector<InstanceGroup>& groups, int& numTri);
 
-	static int findMaterial(std::string& name, std::vector<MaterialPtr>& materials);
+	static int findMaterial(const std::string& name, const std::vector<MaterialPtr>& materials);
 
 	static int findTexture(std::string& name, std::vector<TexturePtr>& textures);
 
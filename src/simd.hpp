@@ -0,0 +1,76 @@
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+
+// Thin wrappers over the SSE/AVX2 intrinsics used by the SIMD kernels, so that the same code
+// can be compiled 4 or 8 wide. SIMD_ENABLED is left undefined when neither is available and
+// the kernels fall back to scalar loops over SIMD_WIDTH elements.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_ENABLED
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_ENABLED
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 4
+#endif
+
+#if defined(SIMD_ENABLED)
+namespace simd {
+// Comparisons return lane masks; vandnot(a, b) is ~a & b and vselect takes a where the mask is set, b elsewhere
+#if defined(__AVX2__)
+	typedef __m256 vfloat;
+	inline vfloat vset(float a) { return _mm256_set1_ps(a); }
+	inline vfloat vload(const float* a) { return _mm256_load_ps(a); }
+	inline void vstore(float* a, vfloat b) { _mm256_store_ps(a, b); }
+	inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+	inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+	inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+	inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+	inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+	inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+	inline vfloat vor(vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+	inline vfloat vandnot(vfloat a, vfloat b) { return _mm256_andnot_ps(a, b); }
+	inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+	inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	inline vfloat vge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	inline vfloat vgt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	inline vfloat vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline vfloat veq(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	inline vfloat vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline int vmask(vfloat a) { return _mm256_movemask_ps(a); }
+#else
+	typedef __m128 vfloat;
+	inline vfloat vset(float a) { return _mm_set1_ps(a); }
+	inline vfloat vload(const float* a) { return _mm_load_ps(a); }
+	inline void vstore(float* a, vfloat b) { _mm_store_ps(a, b); }
+	inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+	inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+	inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+	inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+	inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+	inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+	inline vfloat vor(vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+	inline vfloat vandnot(vfloat a, vfloat b) { return _mm_andnot_ps(a, b); }
+	inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	inline vfloat vge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+	inline vfloat vgt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+	inline vfloat vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+	inline vfloat veq(vfloat a, vfloat b) { return _mm_cmpeq_ps(a, b); }
+	inline vfloat vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+	inline int vmask(vfloat a) { return _mm_movemask_ps(a); }
+#endif
+	inline vfloat vdot(vfloat ax, vfloat ay, vfloat az, vfloat bx, vfloat by, vfloat bz) {
+		return vadd(vadd(vmul(ax, bx), vmul(ay, by)), vmul(az, bz));
+	}
+}
+#endif
+
+#endif
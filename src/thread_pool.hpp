@@ -7,6 +7,9 @@
 #include <deque>
 #include <condition_variable>
 #include <thread>
+#include <chrono>
+#include <functional>
+#include <exception>
 
 namespace Threading{
 	class ThreadPool {
@@ -18,6 +21,10 @@ namespace Threading{
 
 			std::future<void> queue(std::function<void(uint32_t&)>&& f);
 
+			// Waits for the futures, running queued tasks meanwhile so that tasks can wait on the tasks
+			// they queue. Rethrows the first exception once all of them are done.
+			void wait(std::vector<std::future<void>>& futures);
+
 			inline void cancel_pending() {
 				std::unique_lock<std::mutex> l(mutex);
 				tasks.clear();
@@ -45,6 +52,34 @@ namespace Threading{
 		return r;
 	}
 
+	inline void ThreadPool::wait(std::vector<std::future<void>>& futures) {
+		auto gen32 = uint32_t(std::hash<std::thread::id>{}(std::this_thread::get_id()) * time(NULL));
+		for (auto& f : futures) {
+			while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				std::packaged_task<void(uint32_t&)> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					if (!tasks.empty()) {
+						task = std::move(tasks.front());
+						tasks.pop_front();
+					}
+				}
+				if (task.valid()) task(gen32);
+				else f.wait_for(std::chrono::milliseconds(1));
+			}
+		}
+		std::exception_ptr error;
+		for (auto& f : futures) {
+			try {
+				f.get();
+			} catch (...) {
+				if (!error) error = std::current_exception();
+			}
+		}
+		futures.clear();
+		if (error) std::rethrow_exception(error);
+	}
+
 	inline void ThreadPool::init(std::size_t n){
 		for (std::size_t i = 0; i < n; ++i){
 			workers.emplace_back([this] {
@@ -6,6 +6,7 @@
 #include "textures/image_texture.hpp"
 #include "renderer.hpp"
 #include "options_manager.hpp"
+#include "chunk_cache.hpp"
 #include <algorithm>
 #include <cstring>
 #include <chrono>
@@ -27,6 +28,8 @@ void parseOptions(std::filesystem::path path){
 		if(key == "W_HEIGHT") OptionsMap::Instance()->setOption(Options::W_HEIGHT, std::stoi(line));
 		if(key == "W_WIDTH") OptionsMap::Instance()->setOption(Options::W_WIDTH, std::stoi(line));
 		if(key == "SCALING") OptionsMap::Instance()->setOption(Options::SCALING, std::stoi(line));
+		if(key == "PACKET_SIZE") OptionsMap::Instance()->setOption(Options::PACKET_SIZE, std::stoi(line));
+		if(key == "STREAM_BUDGET") OptionsMap::Instance()->setOption(Options::STREAM_BUDGET, std::stoi(line));
 		if(key == "THREADS"){
 			int nThreads = std::stoi(line);
 			// std::thread::hardware_concurrency() can return 0 on failure 
@@ -68,6 +71,7 @@ int main(int argc, char *args[]){
 	}
 	OptionsMap::Instance()->printOptions();
 	Threading::pool.init(OptionsMap::Instance()->getOption(Options::THREADS));
+	Streaming::cache.setBudget(size_t(OptionsMap::Instance()->getOption(Options::STREAM_BUDGET)) << 20);
 	auto t1 = std::chrono::high_resolution_clock::now();
 	try{
 		if(!scenePath.empty() && std::filesystem::exists(scenePath)){
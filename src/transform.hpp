@@ -13,6 +13,7 @@ class Transform {
 		glm::mat4 getMatrix() const;
 		glm::mat4 getTransposeInverse() const;
 		glm::mat4 getInverse() const;
+		inline bool isIdentity() const { return m == glm::mat4(1.0f); }
 
 		void scale(float uniform);
 		void scale(glm::vec3 &scaling);